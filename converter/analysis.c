@@ -0,0 +1,172 @@
+// Frame-difference analysis and quality measures, see analysis.h
+// Single passes of absolute differences, window sums and squared
+// differences over a plane, using WebAssembly SIMD when built with
+// -msimd128.
+#include <stdlib.h>
+#include "analysis.h"
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+
+static inline uint32_t sum_lanes(v128_t v) {
+    return wasm_u32x4_extract_lane(v, 0) + wasm_u32x4_extract_lane(v, 1) +
+           wasm_u32x4_extract_lane(v, 2) + wasm_u32x4_extract_lane(v, 3);
+}
+#endif
+
+// Mean absolute luma difference above which a block has changed. Ordered
+// dithering between two palettes stays below this; real motion does not.
+#define CHANGED_BLOCK_MAD 4
+
+// Sum of absolute differences over n bytes
+static uint32_t row_sad(const uint8_t* a, const uint8_t* b, int n) {
+    uint32_t sad = 0;
+    int x = 0;
+#ifdef __wasm_simd128__
+    v128_t acc = wasm_i32x4_splat(0);
+    for (; x + 16 <= n; x += 16) {
+        v128_t va = wasm_v128_load(a + x);
+        v128_t vb = wasm_v128_load(b + x);
+        // |a - b| as the larger of the two saturating differences
+        v128_t diff = wasm_v128_or(wasm_u8x16_sub_sat(va, vb),
+                                   wasm_u8x16_sub_sat(vb, va));
+        acc = wasm_i32x4_add(acc, wasm_u32x4_extadd_pairwise_u16x8(
+                                      wasm_u16x8_extadd_pairwise_u8x16(diff)));
+    }
+    sad = sum_lanes(acc);
+#endif
+    for (; x < n; x++) {
+        sad += abs(a[x] - b[x]);
+    }
+    return sad;
+}
+
+int luma_change_permille(const uint8_t* prev, const uint8_t* cur, size_t stride,
+                         int width, int height) {
+    if (width <= 0 || height <= 0) return 0;
+
+    int blocks_x = (width + ANALYSIS_BLOCK_SIZE - 1) / ANALYSIS_BLOCK_SIZE;
+    int blocks_y = (height + ANALYSIS_BLOCK_SIZE - 1) / ANALYSIS_BLOCK_SIZE;
+    int changed = 0;
+
+    for (int by = 0; by < blocks_y; by++) {
+        int y0 = by * ANALYSIS_BLOCK_SIZE;
+        int bh = height - y0 < ANALYSIS_BLOCK_SIZE ? height - y0 : ANALYSIS_BLOCK_SIZE;
+        for (int bx = 0; bx < blocks_x; bx++) {
+            int x0 = bx * ANALYSIS_BLOCK_SIZE;
+            int bw = width - x0 < ANALYSIS_BLOCK_SIZE ? width - x0 : ANALYSIS_BLOCK_SIZE;
+
+            // Edge blocks are judged on the pixels they have
+            uint32_t sad = 0;
+            for (int y = y0; y < y0 + bh; y++) {
+                size_t row = (size_t)y * stride + x0;
+                sad += row_sad(prev + row, cur + row, bw);
+            }
+            if (sad > (uint32_t)(CHANGED_BLOCK_MAD * bw * bh)) {
+                changed++;
+            }
+        }
+    }
+
+    return (int)((int64_t)changed * 1000 / ((int64_t)blocks_x * blocks_y));
+}
+
+// SSIM's stabilising constants, (0.01 * 255)^2 and (0.03 * 255)^2
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+#define SSIM_WINDOW 8
+#define SSIM_STEP 4
+
+// Sums SSIM needs over one window: a, b, a*a, b*b and a*b
+typedef struct {
+    uint32_t a, b, aa, bb, ab;
+} window_sums;
+
+static void add_row_sums(const uint8_t* a, const uint8_t* b, int n,
+                         window_sums* sums) {
+    int x = 0;
+#ifdef __wasm_simd128__
+    for (; x + 8 <= n; x += 8) {
+        v128_t va = wasm_u16x8_load8x8(a + x);
+        v128_t vb = wasm_u16x8_load8x8(b + x);
+        v128_t sa = wasm_u32x4_extadd_pairwise_u16x8(va);
+        v128_t sb = wasm_u32x4_extadd_pairwise_u16x8(vb);
+        // Products of values up to 255 fit the signed 16-bit dot product
+        v128_t aa = wasm_i32x4_dot_i16x8(va, va);
+        v128_t bb = wasm_i32x4_dot_i16x8(vb, vb);
+        v128_t ab = wasm_i32x4_dot_i16x8(va, vb);
+        sums->a += sum_lanes(sa);
+        sums->b += sum_lanes(sb);
+        sums->aa += sum_lanes(aa);
+        sums->bb += sum_lanes(bb);
+        sums->ab += sum_lanes(ab);
+    }
+#endif
+    for (; x < n; x++) {
+        sums->a += a[x];
+        sums->b += b[x];
+        sums->aa += a[x] * a[x];
+        sums->bb += b[x] * b[x];
+        sums->ab += a[x] * b[x];
+    }
+}
+
+static double window_ssim(const window_sums* s, int n) {
+    double mean_a = (double)s->a / n;
+    double mean_b = (double)s->b / n;
+    double var_a = (double)s->aa / n - mean_a * mean_a;
+    double var_b = (double)s->bb / n - mean_b * mean_b;
+    double covar = (double)s->ab / n - mean_a * mean_b;
+    return ((2 * mean_a * mean_b + SSIM_C1) * (2 * covar + SSIM_C2)) /
+           ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) * (var_a + var_b + SSIM_C2));
+}
+
+double plane_ssim(const uint8_t* a, const uint8_t* b, size_t stride, int width,
+                  int height) {
+    if (width <= 0 || height <= 0) return 1.0;
+
+    int win_w = width < SSIM_WINDOW ? width : SSIM_WINDOW;
+    int win_h = height < SSIM_WINDOW ? height : SSIM_WINDOW;
+    double total = 0;
+    int windows = 0;
+
+    for (int y0 = 0; y0 + win_h <= height; y0 += SSIM_STEP) {
+        for (int x0 = 0; x0 + win_w <= width; x0 += SSIM_STEP) {
+            window_sums sums = {0, 0, 0, 0, 0};
+            for (int y = y0; y < y0 + win_h; y++) {
+                size_t row = (size_t)y * stride + x0;
+                add_row_sums(a + row, b + row, win_w, &sums);
+            }
+            total += window_ssim(&sums, win_w * win_h);
+            windows++;
+        }
+    }
+
+    return total / windows;
+}
+
+uint64_t plane_sse(const uint8_t* a, const uint8_t* b, size_t stride, int width,
+                   int height) {
+    uint64_t sse = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* ra = a + (size_t)y * stride;
+        const uint8_t* rb = b + (size_t)y * stride;
+        uint32_t row = 0;
+        int x = 0;
+#ifdef __wasm_simd128__
+        v128_t acc = wasm_i32x4_splat(0);
+        for (; x + 8 <= width; x += 8) {
+            v128_t diff = wasm_i16x8_sub(wasm_u16x8_load8x8(ra + x),
+                                         wasm_u16x8_load8x8(rb + x));
+            acc = wasm_i32x4_add(acc, wasm_i32x4_dot_i16x8(diff, diff));
+        }
+        row = sum_lanes(acc);
+#endif
+        for (; x < width; x++) {
+            int diff = ra[x] - rb[x];
+            row += diff * diff;
+        }
+        sse += row;
+    }
+    return sse;
+}
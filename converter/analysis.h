@@ -0,0 +1,32 @@
+#ifndef GIF2VID_ANALYSIS_H
+#define GIF2VID_ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame-difference analysis on a grid of 16x16 luma blocks, the macroblock
+// size of H.264. Its output decides where keyframes go: scene cuts change
+// most blocks, static stretches almost none.
+//
+// The same file measures how far an encoded frame is from its source, for
+// tuning encoder settings against a quality target.
+
+#define ANALYSIS_BLOCK_SIZE 16
+
+// Share of blocks that changed between two luma planes, in thousandths.
+// A block counts as changed when its mean absolute difference is above the
+// level dithering noise usually reaches.
+int luma_change_permille(const uint8_t* prev, const uint8_t* cur, size_t stride,
+                         int width, int height);
+
+// Structural similarity of two planes, the mean over 8x8 windows placed
+// every 4 pixels as x264 and ffmpeg measure it. 1 means identical; planes
+// smaller than a window are compared as one window.
+double plane_ssim(const uint8_t* a, const uint8_t* b, size_t stride, int width,
+                  int height);
+
+// Sum of squared differences of two planes, from which PSNR is derived
+uint64_t plane_sse(const uint8_t* a, const uint8_t* b, size_t stride, int width,
+                   int height);
+
+#endif
@@ -3,383 +3,351 @@
 #include <string.h>
 #include <stdint.h>
 #include <emscripten.h>
+#include "analysis.h"
+#include "mp4_writer.h"
+#include "yuv.h"
 
-// MP4 Buffer
-typedef struct {
-    uint8_t* data;
-    size_t size;
-    size_t capacity;
-} Mp4Buf;
+// Pixel layouts a video can store its frames in
+#define VIDEO_FORMAT_RGB24 0  // 'raw ' sample entry, 3 bytes per pixel
+#define VIDEO_FORMAT_I420 1   // 'I420' sample entry, 1.5 bytes per pixel
 
 // Frame storage
 typedef struct {
-    uint8_t* rgb_data;  // RGB24 (3 bytes per pixel)
+    uint8_t* data;      // RGB24 or I420, depending on the video format
     size_t size;
     uint32_t delay_ms;  // Frame delay in milliseconds
+    int change;         // Blocks changed since the previous frame, in
+                        // thousandths (luma_change_permille), or -1 if unknown
 } FrameData;
 
-static void buf_init(Mp4Buf* b, size_t cap) {
-    b->data = malloc(cap);
-    b->size = 0;
-    b->capacity = cap;
-}
-
-static void buf_ensure(Mp4Buf* b, size_t add) {
-    if (b->size + add > b->capacity) {
-        b->capacity = (b->size + add) * 2;
-        b->data = realloc(b->data, b->capacity);
-    }
-}
-
-static void wr_u32(Mp4Buf* b, uint32_t v) {
-    buf_ensure(b, 4);
-    b->data[b->size++] = (v >> 24);
-    b->data[b->size++] = (v >> 16);
-    b->data[b->size++] = (v >> 8);
-    b->data[b->size++] = v;
-}
-
-static void wr_u16(Mp4Buf* b, uint16_t v) {
-    buf_ensure(b, 2);
-    b->data[b->size++] = (v >> 8);
-    b->data[b->size++] = v;
-}
-
-static void wr_u8(Mp4Buf* b, uint8_t v) {
-    buf_ensure(b, 1);
-    b->data[b->size++] = v;
-}
-
-static void wr_bytes(Mp4Buf* b, const void* d, size_t len) {
-    buf_ensure(b, len);
-    memcpy(b->data + b->size, d, len);
-    b->size += len;
-}
-
-static size_t box_start(Mp4Buf* b, const char* type) {
-    size_t off = b->size;
-    wr_u32(b, 0);
-    wr_bytes(b, type, 4);
-    return off;
-}
-
-static void box_end(Mp4Buf* b, size_t off) {
-    uint32_t sz = b->size - off;
-    b->data[off] = sz >> 24;
-    b->data[off+1] = sz >> 16;
-    b->data[off+2] = sz >> 8;
-    b->data[off+3] = sz;
-}
-
-// Convert RGBA to RGB24
-static uint8_t* rgba_to_rgb24(const uint8_t* rgba, int width, int height, size_t* out_size) {
-    size_t rgb_size = width * height * 3;
+// Convert any supported pixel format to RGB24, one row at a time so that
+// row padding (stride) is skipped
+static uint8_t* pixels_to_rgb24(const uint8_t* src, int format, size_t stride,
+                                int width, int height, const uint8_t* palette,
+                                int palette_size, size_t* out_size) {
+    size_t rgb_size = (size_t)width * height * 3;
     uint8_t* rgb = malloc(rgb_size);
-
-    for (int i = 0; i < width * height; i++) {
-        rgb[i * 3 + 0] = rgba[i * 4 + 0]; // R
-        rgb[i * 3 + 1] = rgba[i * 4 + 1]; // G
-        rgb[i * 3 + 2] = rgba[i * 4 + 2]; // B
-        // Skip A channel
+    if (!rgb) return NULL;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t* in = src + (size_t)y * stride;
+        uint8_t* out = rgb + (size_t)y * width * 3;
+        switch (format) {
+            case PIXEL_FORMAT_RGBA:
+                for (int x = 0; x < width; x++) {
+                    out[x * 3 + 0] = in[x * 4 + 0]; // R
+                    out[x * 3 + 1] = in[x * 4 + 1]; // G
+                    out[x * 3 + 2] = in[x * 4 + 2]; // B
+                    // Skip A channel
+                }
+                break;
+            case PIXEL_FORMAT_BGRA:
+                for (int x = 0; x < width; x++) {
+                    out[x * 3 + 0] = in[x * 4 + 2];
+                    out[x * 3 + 1] = in[x * 4 + 1];
+                    out[x * 3 + 2] = in[x * 4 + 0];
+                }
+                break;
+            case PIXEL_FORMAT_RGB24:
+                memcpy(out, in, (size_t)width * 3);
+                break;
+            case PIXEL_FORMAT_INDEXED:
+                for (int x = 0; x < width; x++) {
+                    if (palette && in[x] < palette_size) {
+                        memcpy(out + x * 3, palette + in[x] * 3, 3);
+                    } else {
+                        memset(out + x * 3, 0, 3);
+                    }
+                }
+                break;
+            default:
+                free(rgb);
+                return NULL;
+        }
     }
 
     *out_size = rgb_size;
     return rgb;
 }
 
+// Everything the moov box describes
+typedef struct {
+    const FrameData* frames;
+    uint32_t count;
+    uint32_t width;
+    uint32_t height;
+    int format;
+    uint32_t duration;     // Sum of the frame delays, in ms
+    uint32_t mdat_offset;  // File offset of the first frame
+} Track;
+
+static const uint32_t unity_matrix[9] = {
+    0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+};
+
 // MP4 Box writers
-static void wr_ftyp(Mp4Buf* b) {
-    size_t s = box_start(b, "ftyp");
-    wr_bytes(b, "isom", 4);
-    wr_u32(b, 512);
-    wr_bytes(b, "isomiso2avc1mp41", 16);
-    box_end(b, s);
-}
-
-static void wr_mdat(Mp4Buf* b, const uint8_t** frames, size_t* frame_sizes, int frame_count) {
-    size_t s = box_start(b, "mdat");
-    for (int i = 0; i < frame_count; i++) {
-        wr_bytes(b, frames[i], frame_sizes[i]);
+static void ftyp_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_fourcc(s, "isom");
+    mp4_u32(s, 512);
+    mp4_bytes(s, "isomiso2avc1mp41", 16);
+}
+
+static void mvhd_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); mp4_u32(s, 0);
+    mp4_u32(s, 1000); // Timescale: milliseconds
+    mp4_u32(s, t->duration);
+    mp4_u32(s, 0x00010000);
+    mp4_u16(s, 0x0100);
+    mp4_zeros(s, 10);
+    for (int i = 0; i < 9; i++) mp4_u32(s, unity_matrix[i]);
+    mp4_zeros(s, 24);
+    mp4_u32(s, 2);
+}
+
+static void tkhd_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 7);
+    mp4_u32(s, 0); mp4_u32(s, 0);
+    mp4_u32(s, 1);
+    mp4_u32(s, 0);
+    mp4_u32(s, t->duration);
+    mp4_zeros(s, 16);
+    for (int i = 0; i < 9; i++) mp4_u32(s, unity_matrix[i]);
+    mp4_u32(s, t->width << 16);
+    mp4_u32(s, t->height << 16);
+}
+
+static void mdhd_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); mp4_u32(s, 0);
+    mp4_u32(s, 1000);
+    mp4_u32(s, t->duration);
+    mp4_u16(s, 0x55c4);
+    mp4_u16(s, 0);
+}
+
+static void hdlr_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0);
+    mp4_fourcc(s, "vide");
+    mp4_zeros(s, 12);
+    mp4_bytes(s, "VideoHandler", 13);
+}
+
+static void vmhd_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 1);
+    mp4_zeros(s, 8);
+}
+
+static void url_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 1); // Media is in this file
+}
+
+static void dref_body(Mp4Sink* s, const void* ctx) {
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1);
+    mp4_box(s, "url ", url_body, ctx);
+}
+
+static void dinf_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "dref", dref_body, ctx);
+}
+
+static void sample_entry_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_zeros(s, 6);
+    mp4_u16(s, 1);
+    mp4_zeros(s, 16);
+    mp4_u16(s, t->width);
+    mp4_u16(s, t->height);
+    mp4_u32(s, 0x00480000);
+    mp4_u32(s, 0x00480000);
+    mp4_u32(s, 0);
+    mp4_u16(s, 1);
+    mp4_zeros(s, 32);
+    mp4_u16(s, t->format == VIDEO_FORMAT_I420 ? 0x000C : 0x0018); // Bits per pixel
+    mp4_u16(s, 0xFFFF);
+}
+
+static void stsd_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1);
+    // ffmpeg maps the I420 fourcc straight to yuv420p
+    mp4_box(s, t->format == VIDEO_FORMAT_I420 ? "I420" : "raw ",
+            sample_entry_body, ctx);
+}
+
+// Length of the run of frames with the same delay starting at i
+static uint32_t delay_run(const Track* t, uint32_t i) {
+    uint32_t n = 1;
+    while (i + n < t->count && t->frames[i + n].delay_ms == t->frames[i].delay_ms) {
+        n++;
     }
-    box_end(b, s);
-}
-
-static void wr_mvhd(Mp4Buf* b, uint32_t scale, uint32_t dur) {
-    size_t s = box_start(b, "mvhd");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 0); wr_u32(b, 0);
-    wr_u32(b, scale);
-    wr_u32(b, dur);
-    wr_u32(b, 0x00010000);
-    wr_u16(b, 0x0100);
-    wr_u16(b, 0);
-    wr_u32(b, 0); wr_u32(b, 0);
-    uint32_t matrix[9] = {0x00010000,0,0,0,0x00010000,0,0,0,0x40000000};
-    for(int i=0; i<9; i++) wr_u32(b, matrix[i]);
-    for(int i=0; i<6; i++) wr_u32(b, 0);
-    wr_u32(b, 2);
-    box_end(b, s);
-}
-
-static void wr_tkhd(Mp4Buf* b, uint32_t dur, uint32_t w, uint32_t h) {
-    size_t s = box_start(b, "tkhd");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 7);
-    wr_u32(b, 0); wr_u32(b, 0);
-    wr_u32(b, 1);
-    wr_u32(b, 0);
-    wr_u32(b, dur);
-    wr_u32(b, 0); wr_u32(b, 0);
-    wr_u16(b, 0); wr_u16(b, 0); wr_u16(b, 0); wr_u16(b, 0);
-    uint32_t matrix[9] = {0x00010000,0,0,0,0x00010000,0,0,0,0x40000000};
-    for(int i=0; i<9; i++) wr_u32(b, matrix[i]);
-    wr_u32(b, w << 16);
-    wr_u32(b, h << 16);
-    box_end(b, s);
-}
-
-static void wr_mdhd(Mp4Buf* b, uint32_t scale, uint32_t dur) {
-    size_t s = box_start(b, "mdhd");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 0); wr_u32(b, 0);
-    wr_u32(b, scale);
-    wr_u32(b, dur);
-    wr_u16(b, 0x55c4);
-    wr_u16(b, 0);
-    box_end(b, s);
-}
-
-static void wr_hdlr(Mp4Buf* b) {
-    size_t s = box_start(b, "hdlr");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 0);
-    wr_bytes(b, "vide", 4);
-    wr_u32(b, 0); wr_u32(b, 0); wr_u32(b, 0);
-    wr_bytes(b, "VideoHandler", 13);
-    box_end(b, s);
-}
-
-static void wr_vmhd(Mp4Buf* b) {
-    size_t s = box_start(b, "vmhd");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 1);
-    wr_u16(b, 0);
-    wr_u16(b, 0); wr_u16(b, 0); wr_u16(b, 0);
-    box_end(b, s);
-}
-
-static void wr_dref(Mp4Buf* b) {
-    size_t s = box_start(b, "dref");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 1);
-    size_t url_s = box_start(b, "url ");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 1);
-    box_end(b, url_s);
-    box_end(b, s);
-}
-
-static void wr_stsd(Mp4Buf* b, uint32_t w, uint32_t h) {
-    size_t s = box_start(b, "stsd");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 1);
-    size_t raw_s = box_start(b, "raw ");
-    wr_u16(b, 0); wr_u16(b, 0); wr_u16(b, 0);
-    wr_u16(b, 1);
-    wr_u16(b, 0); wr_u16(b, 0);
-    wr_u32(b, 0); wr_u32(b, 0); wr_u32(b, 0);
-    wr_u16(b, w);
-    wr_u16(b, h);
-    wr_u32(b, 0x00480000);
-    wr_u32(b, 0x00480000);
-    wr_u32(b, 0);
-    wr_u16(b, 1);
-    for(int i=0; i<32; i++) wr_u8(b, 0);
-    wr_u16(b, 0x0018); // 24-bit depth
-    wr_u16(b, 0xFFFF);
-    box_end(b, raw_s);
-    box_end(b, s);
-}
-
-static void wr_stts(Mp4Buf* b, uint32_t* deltas, uint32_t count) {
-    size_t s = box_start(b, "stts");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-
-    // Write entries (compress consecutive frames with same delay)
-    uint32_t entry_count = 0;
-    for (uint32_t i = 0; i < count; ) {
-        uint32_t sample_count = 1;
-        uint32_t sample_delta = deltas[i];
+    return n;
+}
 
-        // Count consecutive frames with same delay
-        while (i + sample_count < count && deltas[i + sample_count] == sample_delta) {
-            sample_count++;
-        }
+static void stts_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+
+    // Consecutive frames with the same delay share an entry
+    uint32_t entry_count = 0;
+    for (uint32_t i = 0; i < t->count; i += delay_run(t, i)) {
         entry_count++;
-        i += sample_count;
     }
+    mp4_u32(s, entry_count);
 
-    wr_u32(b, entry_count);
-
-    // Write compressed entries
-    for (uint32_t i = 0; i < count; ) {
-        uint32_t sample_count = 1;
-        uint32_t sample_delta = deltas[i];
-
-        while (i + sample_count < count && deltas[i + sample_count] == sample_delta) {
-            sample_count++;
-        }
-
-        wr_u32(b, sample_count);
-        wr_u32(b, sample_delta);
-        i += sample_count;
+    for (uint32_t i = 0; i < t->count; ) {
+        uint32_t run = delay_run(t, i);
+        mp4_u32(s, run);
+        mp4_u32(s, t->frames[i].delay_ms);
+        i += run;
     }
-
-    box_end(b, s);
 }
 
-static void wr_stsc(Mp4Buf* b, uint32_t count) {
-    size_t s = box_start(b, "stsc");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 1);
-    wr_u32(b, 1);
-    wr_u32(b, count);
-    wr_u32(b, 1);
-    box_end(b, s);
+static void stsc_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1);
+    mp4_u32(s, 1);
+    mp4_u32(s, t->count); // Every sample in one chunk
+    mp4_u32(s, 1);
 }
 
-static void wr_stsz(Mp4Buf* b, size_t* sample_sizes, uint32_t count) {
-    size_t s = box_start(b, "stsz");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    // Check if all samples are same size
+static void stsz_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+
     int all_same = 1;
-    for (uint32_t i = 1; i < count; i++) {
-        if (sample_sizes[i] != sample_sizes[0]) {
+    for (uint32_t i = 1; i < t->count; i++) {
+        if (t->frames[i].size != t->frames[0].size) {
             all_same = 0;
             break;
         }
     }
 
     if (all_same) {
-        wr_u32(b, sample_sizes[0]);
-        wr_u32(b, count);
+        mp4_u32(s, t->frames[0].size);
+        mp4_u32(s, t->count);
     } else {
-        wr_u32(b, 0);
-        wr_u32(b, count);
-        for (uint32_t i = 0; i < count; i++) {
-            wr_u32(b, sample_sizes[i]);
+        mp4_u32(s, 0);
+        mp4_u32(s, t->count);
+        for (uint32_t i = 0; i < t->count; i++) {
+            mp4_u32(s, t->frames[i].size);
         }
     }
-    box_end(b, s);
 }
 
-static void wr_stco(Mp4Buf* b, uint32_t offset) {
-    size_t s = box_start(b, "stco");
-    wr_u8(b, 0);
-    wr_u8(b, 0); wr_u8(b, 0); wr_u8(b, 0);
-    wr_u32(b, 1);
-    wr_u32(b, offset);
-    box_end(b, s);
+static void stco_body(Mp4Sink* s, const void* ctx) {
+    const Track* t = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1);
+    mp4_u32(s, t->mdat_offset);
 }
 
-static void wr_stbl(Mp4Buf* b, uint32_t w, uint32_t h, size_t* sample_sizes, uint32_t* deltas, uint32_t count, uint32_t offset) {
-    size_t s = box_start(b, "stbl");
-    wr_stsd(b, w, h);
-    wr_stts(b, deltas, count);
-    wr_stsc(b, count);
-    wr_stsz(b, sample_sizes, count);
-    wr_stco(b, offset);
-    box_end(b, s);
+static void stbl_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "stsd", stsd_body, ctx);
+    mp4_box(s, "stts", stts_body, ctx);
+    mp4_box(s, "stsc", stsc_body, ctx);
+    mp4_box(s, "stsz", stsz_body, ctx);
+    mp4_box(s, "stco", stco_body, ctx);
 }
 
-static void create_mp4(Mp4Buf* b, const uint8_t** frames, size_t* frame_sizes, uint32_t* frame_delays,
-                       int frame_count, uint32_t w, uint32_t h) {
-    uint32_t timescale = 1000; // milliseconds
-
-    // Calculate total duration from all frame delays
-    uint32_t total_duration = 0;
-    for (int i = 0; i < frame_count; i++) {
-        total_duration += frame_delays[i];
-    }
-
-    // Calculate mdat size first (header + all frame data)
-    size_t mdat_data_size = 0;
-    for (int i = 0; i < frame_count; i++) {
-        mdat_data_size += frame_sizes[i];
-    }
-
-    // Write ftyp first
-    wr_ftyp(b);
-
-    // Create a temporary buffer to write moov
-    Mp4Buf moov_buf;
-    buf_init(&moov_buf, 4096);
-
-    size_t moov_s = box_start(&moov_buf, "moov");
-    wr_mvhd(&moov_buf, timescale, total_duration);
-
-    size_t trak_s = box_start(&moov_buf, "trak");
-    wr_tkhd(&moov_buf, total_duration, w, h);
-
-    size_t mdia_s = box_start(&moov_buf, "mdia");
-    wr_mdhd(&moov_buf, timescale, total_duration);
-    wr_hdlr(&moov_buf);
-
-    size_t minf_s = box_start(&moov_buf, "minf");
-    wr_vmhd(&moov_buf);
-
-    size_t dinf_s = box_start(&moov_buf, "dinf");
-    wr_dref(&moov_buf);
-    box_end(&moov_buf, dinf_s);
+static void minf_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "vmhd", vmhd_body, ctx);
+    mp4_box(s, "dinf", dinf_body, ctx);
+    mp4_box(s, "stbl", stbl_body, ctx);
+}
 
-    // Calculate mdat offset: current buffer (ftyp) + moov size + 8 (mdat header)
-    uint32_t mdat_offset = b->size + moov_buf.size + 8;
+static void mdia_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "mdhd", mdhd_body, ctx);
+    mp4_box(s, "hdlr", hdlr_body, ctx);
+    mp4_box(s, "minf", minf_body, ctx);
+}
 
-    wr_stbl(&moov_buf, w, h, frame_sizes, frame_delays, frame_count, mdat_offset);
+static void trak_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "tkhd", tkhd_body, ctx);
+    mp4_box(s, "mdia", mdia_body, ctx);
+}
 
-    box_end(&moov_buf, minf_s);
-    box_end(&moov_buf, mdia_s);
-    box_end(&moov_buf, trak_s);
-    box_end(&moov_buf, moov_s);
+static void moov_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "mvhd", mvhd_body, ctx);
+    mp4_box(s, "trak", trak_body, ctx);
+}
 
-    // Write moov to main buffer
-    buf_ensure(b, moov_buf.size);
-    memcpy(b->data + b->size, moov_buf.data, moov_buf.size);
-    b->size += moov_buf.size;
-    free(moov_buf.data);
+// Write the video as ftyp, moov and mdat, optionally leaving out the frame
+// data after the mdat header so callers can append the frames from wherever
+// they are stored. Every box size is known before its header is written, so
+// the output streams to the sink front to back.
+static void write_mp4(Mp4Sink* s, const FrameData* frame_list, int count,
+                      uint32_t w, uint32_t h, int format, int with_frames) {
+    Track t = {frame_list, count, w, h, format, 0, 0};
+    uint64_t mdat_data_size = 0;
+    for (int i = 0; i < count; i++) {
+        t.duration += frame_list[i].delay_ms;
+        mdat_data_size += frame_list[i].size;
+    }
 
-    // Now write mdat
-    wr_mdat(b, frames, frame_sizes, frame_count);
+    // The chunk offset's value doesn't change the size of moov
+    uint64_t ftyp_size = 8 + mp4_measure(ftyp_body, NULL);
+    uint64_t moov_payload = mp4_measure(moov_body, &t);
+    t.mdat_offset = ftyp_size + mp4_box_header_size(moov_payload) + moov_payload +
+                    mp4_box_header_size(mdat_data_size);
+
+    mp4_box(s, "ftyp", ftyp_body, NULL);
+    mp4_box_header(s, "moov", moov_payload);
+    moov_body(s, &t);
+    mp4_box_header(s, "mdat", mdat_data_size);
+    if (with_frames) {
+        for (int i = 0; i < count; i++) {
+            mp4_bytes(s, frame_list[i].data, frame_list[i].size);
+        }
+    }
 }
 
 // Global state
-static Mp4Buf* mp4_output = NULL;
+static uint8_t* mp4_output = NULL;  // Whole file, built on request
+static size_t mp4_output_size = 0;
+static uint8_t* mp4_header = NULL;  // Everything before the frame data
+static size_t mp4_header_size = 0;
 static FrameData* frames = NULL;
 static int frame_count = 0;
 static int frame_capacity = 0;
 static uint32_t video_width = 0;
 static uint32_t video_height = 0;
 static uint32_t video_fps = 10;
+static int video_format = VIDEO_FORMAT_RGB24;
+
+// Drop the cached header and whole-file copies. They describe the frames
+// added so far, so any change to the frames makes them stale.
+static void invalidate_output() {
+    free(mp4_output);
+    mp4_output = NULL;
+    free(mp4_header);
+    mp4_header = NULL;
+}
 
+// Start a new video whose frames are stored in the given pixel format.
+// I420 is what encoders consume, so ffmpeg can read it without converting.
 EMSCRIPTEN_KEEPALIVE
-int init_encoder(int width, int height, int fps) {
-    // Cleanup previous
-    if (mp4_output) {
-        free(mp4_output->data);
-        free(mp4_output);
-        mp4_output = NULL;
+int init_encoder_format(int width, int height, int fps, int format) {
+    if (format != VIDEO_FORMAT_RGB24 && format != VIDEO_FORMAT_I420) {
+        return 0;
     }
+
+    // Cleanup previous
+    invalidate_output();
     if (frames) {
         for (int i = 0; i < frame_count; i++) {
-            free(frames[i].rgb_data);
+            free(frames[i].data);
         }
         free(frames);
         frames = NULL;
@@ -388,6 +356,7 @@ int init_encoder(int width, int height, int fps) {
     video_width = width;
     video_height = height;
     video_fps = fps;
+    video_format = format;
     frame_count = 0;
     frame_capacity = 10;
 
@@ -398,81 +367,255 @@ int init_encoder(int width, int height, int fps) {
 }
 
 EMSCRIPTEN_KEEPALIVE
-int add_frame(unsigned char* rgba_data, int width, int height, int delay_ms) {
-    if (!frames || width != video_width || height != video_height) {
-        return 0;
-    }
+int init_encoder(int width, int height, int fps) {
+    return init_encoder_format(width, height, fps, VIDEO_FORMAT_RGB24);
+}
+
+// Store converted frame data, taking ownership of it
+static int push_frame(uint8_t* data, size_t size, int delay_ms, int change) {
+    if (!data) return 0;
 
     // Expand capacity if needed
     if (frame_count >= frame_capacity) {
+        FrameData* grown = realloc(frames, sizeof(FrameData) * frame_capacity * 2);
+        if (!grown) {
+            free(data);
+            return 0;
+        }
+        frames = grown;
         frame_capacity *= 2;
-        frames = realloc(frames, sizeof(FrameData) * frame_capacity);
-        if (!frames) return 0;
     }
 
-    // Convert RGBA to RGB24
-    size_t rgb_size;
-    uint8_t* rgb = rgba_to_rgb24(rgba_data, width, height, &rgb_size);
-    if (!rgb) return 0;
-
-    frames[frame_count].rgb_data = rgb;
-    frames[frame_count].size = rgb_size;
+    frames[frame_count].data = data;
+    frames[frame_count].size = size;
     frames[frame_count].delay_ms = delay_ms > 0 ? delay_ms : 100; // Default 100ms if 0
+    frames[frame_count].change = change;
     frame_count++;
 
     return 1;
 }
 
+// Add a frame in any pixel format (PIXEL_FORMAT_* in yuv.h). stride is the
+// distance between rows in bytes, or 0 for tightly packed rows, so callers
+// can pass canvas data, RGB buffers or a sub-rectangle of a larger surface
+// as they are. The palette is only read for indexed frames; for I420 video
+// their colour conversion then runs once per palette entry, not per pixel.
 EMSCRIPTEN_KEEPALIVE
-unsigned char* get_video_buffer() {
-    if (!mp4_output && frames && frame_count > 0) {
-        // Prepare frame pointers, sizes, and delays
-        uint8_t** frame_ptrs = malloc(sizeof(uint8_t*) * frame_count);
-        size_t* frame_sizes = malloc(sizeof(size_t) * frame_count);
-        uint32_t* frame_delays = malloc(sizeof(uint32_t) * frame_count);
+int add_frame_pixels(unsigned char* pixels, int format, int stride, int width, int height,
+                     unsigned char* palette, int palette_size, int delay_ms) {
+    int pixel_size = pixel_format_size(format);
+    if (!frames || !pixel_size || width <= 0 || height <= 0 ||
+        (uint32_t)width != video_width || (uint32_t)height != video_height ||
+        palette_size < 0 || palette_size > 256) {
+        return 0;
+    }
 
-        for (int i = 0; i < frame_count; i++) {
-            frame_ptrs[i] = frames[i].rgb_data;
-            frame_sizes[i] = frames[i].size;
-            frame_delays[i] = frames[i].delay_ms;
-        }
+    size_t row_stride = stride > 0 ? (size_t)stride : (size_t)width * pixel_size;
+    if (row_stride < (size_t)width * pixel_size) {
+        return 0;
+    }
 
-        // Generate MP4
-        mp4_output = malloc(sizeof(Mp4Buf));
-        size_t total_size = 0;
-        for (int i = 0; i < frame_count; i++) {
-            total_size += frame_sizes[i];
+    // Every frame is added through here (add_frame included), so this keeps
+    // get_header_buffer and get_video_buffer in step with the frames
+    invalidate_output();
+
+    if (video_format == VIDEO_FORMAT_I420) {
+        size_t size = i420_size(width, height);
+        uint8_t* yuv = malloc(size);
+        if (yuv && !pixels_to_i420(pixels, format, row_stride, width, height,
+                                   palette, palette_size, yuv)) {
+            free(yuv);
+            yuv = NULL;
+        }
+        // Compared on the Y plane, which leads the stored frame
+        int change = 1000;
+        if (yuv && frame_count > 0) {
+            change = luma_change_permille(frames[frame_count - 1].data, yuv,
+                                          width, width, height);
         }
-        buf_init(mp4_output, total_size + 8192);
+        return push_frame(yuv, size, delay_ms, change);
+    }
+
+    size_t rgb_size = 0;
+    uint8_t* rgb = pixels_to_rgb24(pixels, format, row_stride, width, height,
+                                   palette, palette_size, &rgb_size);
+    return push_frame(rgb, rgb_size, delay_ms, -1);
+}
 
-        create_mp4(mp4_output, (const uint8_t**)frame_ptrs, frame_sizes, frame_delays,
-                   frame_count, video_width, video_height);
+// Add a tightly packed RGBA frame
+EMSCRIPTEN_KEEPALIVE
+int add_frame(unsigned char* rgba_data, int width, int height, int delay_ms) {
+    return add_frame_pixels(rgba_data, PIXEL_FORMAT_RGBA, 0, width, height, NULL, 0, delay_ms);
+}
 
-        free(frame_ptrs);
-        free(frame_sizes);
-        free(frame_delays);
+// Convert a frame to I420 into dst (i420_size bytes) without storing it, for
+// encoders outside the converter that take planar YUV. width and height may
+// be smaller than the source, e.g. to crop to even dimensions.
+EMSCRIPTEN_KEEPALIVE
+int convert_to_i420(unsigned char* pixels, int format, int stride, int width, int height,
+                    unsigned char* palette, int palette_size, unsigned char* dst) {
+    int pixel_size = pixel_format_size(format);
+    if (!pixel_size || width <= 0 || height <= 0) {
+        return 0;
+    }
+    size_t row_stride = stride > 0 ? (size_t)stride : (size_t)width * pixel_size;
+    if (row_stride < (size_t)width * pixel_size) {
+        return 0;
+    }
+    return pixels_to_i420(pixels, format, row_stride, width, height,
+                          palette, palette_size, dst);
+}
+
+// Write into an exactly sized allocation, measured with a counting sink
+static uint8_t* write_mp4_buffer(int with_frames, size_t* out_size) {
+    Mp4Sink sink;
+    mp4_sink_counting(&sink);
+    write_mp4(&sink, frames, frame_count, video_width, video_height,
+              video_format, with_frames);
+    size_t size = sink.written;
+
+    uint8_t* data = malloc(size);
+    if (!data) return NULL;
+    mp4_sink_memory(&sink, data, size);
+    write_mp4(&sink, frames, frame_count, video_width, video_height,
+              video_format, with_frames);
+    if (!mp4_sink_finish(&sink)) {
+        free(data);
+        return NULL;
+    }
+    *out_size = size;
+    return data;
+}
+
+// Build the MP4 header (ftyp + moov + mdat header) for the frames added so far
+static uint8_t* build_header() {
+    if (!mp4_header && frames && frame_count > 0) {
+        mp4_header = write_mp4_buffer(0, &mp4_header_size);
     }
-    return mp4_output ? mp4_output->data : NULL;
+    return mp4_header;
 }
 
+// Header and frame accessors let callers write the file as header followed
+// by each frame's pixel data (e.g. with writev) without assembling the whole
+// video in one buffer first.
 EMSCRIPTEN_KEEPALIVE
-int get_video_size() {
+unsigned char* get_header_buffer() {
+    return build_header();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_header_size() {
+    return build_header() ? mp4_header_size : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_frame_count() {
+    return frame_count;
+}
+
+// How much of the picture changed since the previous frame, in thousandths
+// of its 16x16 blocks; the first frame counts as fully changed. Keyframes are
+// placed from these. Only known for I420 video, -1 otherwise.
+EMSCRIPTEN_KEEPALIVE
+int get_frame_change(int index) {
+    if (!frames || index < 0 || index >= frame_count) {
+        return -1;
+    }
+    return frames[index].change;
+}
+
+// Compare a frame's luma plane with the previous one's (luma_change_permille),
+// then keep it in prev for the next call. For encoders fed outside the
+// converter, which see one frame at a time.
+EMSCRIPTEN_KEEPALIVE
+int track_luma_change(unsigned char* prev, const unsigned char* cur, int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    int change = luma_change_permille(prev, cur, width, width, height);
+    memcpy(prev, cur, (size_t)width * height);
+    return change;
+}
+
+// Quality of a decoded I420 frame against the frame it was encoded from,
+// with the planes weighted 4:1:1 as ffmpeg's ssim filter does. Both frames
+// are packed width x height I420 (chroma planes rounded up).
+EMSCRIPTEN_KEEPALIVE
+double i420_ssim(const unsigned char* ref, const unsigned char* test, int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    size_t luma = (size_t)width * height;
+    int cw = (width + 1) / 2;
+    int ch = (height + 1) / 2;
+    size_t chroma = (size_t)cw * ch;
+    double y = plane_ssim(ref, test, width, width, height);
+    double u = plane_ssim(ref + luma, test + luma, cw, cw, ch);
+    double v = plane_ssim(ref + luma + chroma, test + luma + chroma, cw, cw, ch);
+    return (4 * y + u + v) / 6;
+}
+
+// Squared error over all three planes of two I420 frames, as for i420_ssim.
+// PSNR follows from it and the sample count (i420 size) across any number
+// of frames. A double holds the sum exactly, unlike a 32-bit wasm return.
+EMSCRIPTEN_KEEPALIVE
+double i420_sse(const unsigned char* ref, const unsigned char* test, int width, int height) {
+    if (width <= 0 || height <= 0) {
+        return -1;
+    }
+    size_t luma = (size_t)width * height;
+    int cw = (width + 1) / 2;
+    int ch = (height + 1) / 2;
+    size_t chroma = (size_t)cw * ch;
+    return (double)(plane_sse(ref, test, width, width, height) +
+                    plane_sse(ref + luma, test + luma, cw, cw, ch) +
+                    plane_sse(ref + luma + chroma, test + luma + chroma, cw, cw, ch));
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char* get_frame_buffer(int index) {
+    if (!frames || index < 0 || index >= frame_count) {
+        return NULL;
+    }
+    return frames[index].data;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_frame_size(int index) {
+    if (!frames || index < 0 || index >= frame_count) {
+        return 0;
+    }
+    return frames[index].size;
+}
+
+// Contiguous copy of header + frames, for callers that need one buffer
+EMSCRIPTEN_KEEPALIVE
+unsigned char* get_video_buffer() {
     if (!mp4_output && frames && frame_count > 0) {
-        get_video_buffer();
+        mp4_output = write_mp4_buffer(1, &mp4_output_size);
     }
-    return mp4_output ? mp4_output->size : 0;
+    return mp4_output;
 }
 
+// Size of the whole file, counted without building it
 EMSCRIPTEN_KEEPALIVE
-void cleanup() {
-    if (mp4_output) {
-        free(mp4_output->data);
-        free(mp4_output);
-        mp4_output = NULL;
+int get_video_size() {
+    if (!frames || frame_count == 0) {
+        return 0;
     }
+    Mp4Sink sink;
+    mp4_sink_counting(&sink);
+    write_mp4(&sink, frames, frame_count, video_width, video_height,
+              video_format, 1);
+    return sink.written;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void cleanup() {
+    invalidate_output();
     if (frames) {
         for (int i = 0; i < frame_count; i++) {
-            free(frames[i].rgb_data);
+            free(frames[i].data);
         }
         free(frames);
         frames = NULL;
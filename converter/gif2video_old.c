@@ -12,71 +12,6 @@ typedef struct {
     int delay_ms;
 } Frame;
 
-// MP4 Box writing utilities
-typedef struct {
-    uint8_t* data;
-    size_t size;
-    size_t capacity;
-} Mp4Buffer;
-
-static void buf_init(Mp4Buffer* buf, size_t cap) {
-    buf->data = (uint8_t*)malloc(cap);
-    buf->size = 0;
-    buf->capacity = cap;
-}
-
-static void buf_ensure(Mp4Buffer* buf, size_t add) {
-    if (buf->size + add > buf->capacity) {
-        size_t new_cap = (buf->size + add) * 2;
-        buf->data = (uint8_t*)realloc(buf->data, new_cap);
-        buf->capacity = new_cap;
-    }
-}
-
-static void buf_u32(Mp4Buffer* buf, uint32_t v) {
-    buf_ensure(buf, 4);
-    buf->data[buf->size++] = (v >> 24) & 0xFF;
-    buf->data[buf->size++] = (v >> 16) & 0xFF;
-    buf->data[buf->size++] = (v >> 8) & 0xFF;
-    buf->data[buf->size++] = v & 0xFF;
-}
-
-static void buf_u16(Mp4Buffer* buf, uint16_t v) {
-    buf_ensure(buf, 2);
-    buf->data[buf->size++] = (v >> 8) & 0xFF;
-    buf->data[buf->size++] = v & 0xFF;
-}
-
-static void buf_u8(Mp4Buffer* buf, uint8_t v) {
-    buf_ensure(buf, 1);
-    buf->data[buf->size++] = v;
-}
-
-static void buf_bytes(Mp4Buffer* buf, const void* data, size_t len) {
-    buf_ensure(buf, len);
-    memcpy(buf->data + buf->size, data, len);
-    buf->size += len;
-}
-
-static void buf_fourcc(Mp4Buffer* buf, const char* fourcc) {
-    buf_bytes(buf, fourcc, 4);
-}
-
-static size_t box_start(Mp4Buffer* buf, const char* type) {
-    size_t off = buf->size;
-    buf_u32(buf, 0);
-    buf_fourcc(buf, type);
-    return off;
-}
-
-static void box_end(Mp4Buffer* buf, size_t off) {
-    uint32_t sz = buf->size - off;
-    buf->data[off] = (sz >> 24) & 0xFF;
-    buf->data[off + 1] = (sz >> 16) & 0xFF;
-    buf->data[off + 2] = (sz >> 8) & 0xFF;
-    buf->data[off + 3] = sz & 0xFF;
-}
-
 // Simple BMP writer for testing
 void write_bmp(const char* filename, unsigned char* data, int width, int height) {
     FILE* f = fopen(filename, "wb");
@@ -0,0 +1,715 @@
+/**
+ * Still image support: RGBA scaling plus PNG and JPEG encoding
+ * Used for poster frames and thumbnails, and by anything that needs to
+ * resize frames inside the converter.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include <emscripten.h>
+
+// Image Buffer
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    int failed; // Set once an allocation fails; later writes are dropped
+} ImageBuf;
+
+static ImageBuf* image_output = NULL;
+
+static void img_init(ImageBuf* b, size_t cap) {
+    b->data = malloc(cap);
+    b->size = 0;
+    b->capacity = b->data ? cap : 0;
+    b->failed = b->data == NULL;
+}
+
+// Returns 0 when the buffer cannot grow. The old block is kept so that it
+// can still be freed, and the failure sticks so the encoder can report it.
+static int img_ensure(ImageBuf* b, size_t add) {
+    if (b->failed) return 0;
+    if (b->size + add > b->capacity) {
+        size_t capacity = (b->size + add) * 2;
+        uint8_t* data = realloc(b->data, capacity);
+        if (!data) {
+            b->failed = 1;
+            return 0;
+        }
+        b->data = data;
+        b->capacity = capacity;
+    }
+    return 1;
+}
+
+static void img_u8(ImageBuf* b, uint8_t v) {
+    if (!img_ensure(b, 1)) return;
+    b->data[b->size++] = v;
+}
+
+static void img_u16(ImageBuf* b, uint16_t v) {
+    if (!img_ensure(b, 2)) return;
+    b->data[b->size++] = (v >> 8) & 0xFF;
+    b->data[b->size++] = v & 0xFF;
+}
+
+static void img_u32(ImageBuf* b, uint32_t v) {
+    if (!img_ensure(b, 4)) return;
+    b->data[b->size++] = (v >> 24) & 0xFF;
+    b->data[b->size++] = (v >> 16) & 0xFF;
+    b->data[b->size++] = (v >> 8) & 0xFF;
+    b->data[b->size++] = v & 0xFF;
+}
+
+static void img_bytes(ImageBuf* b, const void* d, size_t len) {
+    if (!img_ensure(b, len)) return;
+    memcpy(b->data + b->size, d, len);
+    b->size += len;
+}
+
+static void free_output() {
+    if (image_output) {
+        free(image_output->data);
+        free(image_output);
+        image_output = NULL;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Scaling
+// ---------------------------------------------------------------------------
+
+// Contribution of a run of source pixels to one destination pixel
+typedef struct {
+    int first;
+    int count;
+    float* weights;
+} Contrib;
+
+// Weights for resampling one axis. Downscaling averages the covered source
+// area (box filter); upscaling interpolates linearly between neighbours.
+static Contrib* make_contribs(int src_len, int dst_len) {
+    Contrib* contribs = malloc(sizeof(Contrib) * dst_len);
+    if (!contribs) return NULL;
+
+    float ratio = (float)src_len / dst_len;
+    for (int i = 0; i < dst_len; i++) {
+        Contrib* c = &contribs[i];
+        if (ratio > 1.0f) {
+            float start = i * ratio;
+            float end = start + ratio;
+            c->first = (int)start;
+            int last = (int)ceilf(end) - 1;
+            if (last >= src_len) last = src_len - 1;
+            c->count = last - c->first + 1;
+            c->weights = malloc(sizeof(float) * c->count);
+            for (int k = 0; k < c->count; k++) {
+                float lo = fmaxf(start, (float)(c->first + k));
+                float hi = fminf(end, (float)(c->first + k + 1));
+                c->weights[k] = (hi - lo) / ratio;
+            }
+        } else {
+            float center = (i + 0.5f) * ratio - 0.5f;
+            if (center < 0) center = 0;
+            int left = (int)center;
+            if (left >= src_len - 1) {
+                c->first = src_len - 1;
+                c->count = 1;
+                c->weights = malloc(sizeof(float));
+                c->weights[0] = 1.0f;
+            } else {
+                float frac = center - left;
+                c->first = left;
+                c->count = 2;
+                c->weights = malloc(sizeof(float) * 2);
+                c->weights[0] = 1.0f - frac;
+                c->weights[1] = frac;
+            }
+        }
+    }
+    return contribs;
+}
+
+static void free_contribs(Contrib* contribs, int len) {
+    for (int i = 0; i < len; i++) {
+        free(contribs[i].weights);
+    }
+    free(contribs);
+}
+
+static uint8_t clamp_u8(float v) {
+    if (v <= 0.0f) return 0;
+    if (v >= 255.0f) return 255;
+    return (uint8_t)(v + 0.5f);
+}
+
+// Resize an RGBA image into dst. Colour is weighted by alpha so that
+// transparent pixels do not bleed dark fringes into their neighbours.
+EMSCRIPTEN_KEEPALIVE
+int scale_rgba(const uint8_t* src, int src_w, int src_h,
+               uint8_t* dst, int dst_w, int dst_h) {
+    if (!src || !dst || src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+        return 0;
+    }
+    if (src_w == dst_w && src_h == dst_h) {
+        memcpy(dst, src, (size_t)src_w * src_h * 4);
+        return 1;
+    }
+
+    Contrib* cx = make_contribs(src_w, dst_w);
+    Contrib* cy = make_contribs(src_h, dst_h);
+    // Horizontal pass output, premultiplied
+    float* tmp = malloc(sizeof(float) * 4 * dst_w * src_h);
+    if (!cx || !cy || !tmp) {
+        if (cx) free_contribs(cx, dst_w);
+        if (cy) free_contribs(cy, dst_h);
+        free(tmp);
+        return 0;
+    }
+
+    for (int y = 0; y < src_h; y++) {
+        const uint8_t* row = src + (size_t)y * src_w * 4;
+        float* out = tmp + (size_t)y * dst_w * 4;
+        for (int x = 0; x < dst_w; x++) {
+            const Contrib* c = &cx[x];
+            float r = 0, g = 0, b = 0, a = 0;
+            for (int k = 0; k < c->count; k++) {
+                const uint8_t* p = row + (size_t)(c->first + k) * 4;
+                float wa = c->weights[k] * p[3];
+                r += p[0] * wa;
+                g += p[1] * wa;
+                b += p[2] * wa;
+                a += wa;
+            }
+            out[x * 4] = r;
+            out[x * 4 + 1] = g;
+            out[x * 4 + 2] = b;
+            out[x * 4 + 3] = a;
+        }
+    }
+
+    for (int y = 0; y < dst_h; y++) {
+        const Contrib* c = &cy[y];
+        uint8_t* out = dst + (size_t)y * dst_w * 4;
+        for (int x = 0; x < dst_w; x++) {
+            float r = 0, g = 0, b = 0, a = 0;
+            for (int k = 0; k < c->count; k++) {
+                const float* p = tmp + ((size_t)(c->first + k) * dst_w + x) * 4;
+                float w = c->weights[k];
+                r += p[0] * w;
+                g += p[1] * w;
+                b += p[2] * w;
+                a += p[3] * w;
+            }
+            if (a > 0.0f) {
+                out[x * 4] = clamp_u8(r / a);
+                out[x * 4 + 1] = clamp_u8(g / a);
+                out[x * 4 + 2] = clamp_u8(b / a);
+            } else {
+                out[x * 4] = out[x * 4 + 1] = out[x * 4 + 2] = 0;
+            }
+            out[x * 4 + 3] = clamp_u8(a);
+        }
+    }
+
+    free(tmp);
+    free_contribs(cx, dst_w);
+    free_contribs(cy, dst_h);
+    return 1;
+}
+
+// Resize an RGBA image to fit inside dst, keeping its aspect ratio, and
+// centre it on opaque black. Used to bring clips of different sizes onto
+// one canvas.
+EMSCRIPTEN_KEEPALIVE
+int fit_rgba(const uint8_t* src, int src_w, int src_h,
+             uint8_t* dst, int dst_w, int dst_h) {
+    if (!src || !dst || src_w <= 0 || src_h <= 0 || dst_w <= 0 || dst_h <= 0) {
+        return 0;
+    }
+
+    int fit_w = dst_w, fit_h = dst_h;
+    if ((int64_t)src_w * dst_h > (int64_t)src_h * dst_w) {
+        fit_h = (int)(((int64_t)src_h * dst_w + src_w / 2) / src_w);
+    } else {
+        fit_w = (int)(((int64_t)src_w * dst_h + src_h / 2) / src_h);
+    }
+    if (fit_w < 1) fit_w = 1;
+    if (fit_h < 1) fit_h = 1;
+    if (fit_w == dst_w && fit_h == dst_h) {
+        return scale_rgba(src, src_w, src_h, dst, dst_w, dst_h);
+    }
+
+    uint8_t* fitted = malloc((size_t)fit_w * fit_h * 4);
+    if (!fitted || !scale_rgba(src, src_w, src_h, fitted, fit_w, fit_h)) {
+        free(fitted);
+        return 0;
+    }
+
+    size_t pixels = (size_t)dst_w * dst_h;
+    for (size_t i = 0; i < pixels; i++) {
+        dst[i * 4] = dst[i * 4 + 1] = dst[i * 4 + 2] = 0;
+        dst[i * 4 + 3] = 255;
+    }
+    int left = (dst_w - fit_w) / 2;
+    int top = (dst_h - fit_h) / 2;
+    for (int y = 0; y < fit_h; y++) {
+        memcpy(dst + ((size_t)(top + y) * dst_w + left) * 4,
+               fitted + (size_t)y * fit_w * 4, (size_t)fit_w * 4);
+    }
+
+    free(fitted);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// PNG
+// ---------------------------------------------------------------------------
+
+static void png_chunk(ImageBuf* b, const char* type, const uint8_t* data, size_t len) {
+    img_u32(b, (uint32_t)len);
+    size_t crc_start = b->size;
+    img_bytes(b, type, 4);
+    if (len > 0) img_bytes(b, data, len);
+    if (b->failed) return;
+    img_u32(b, (uint32_t)crc32(0, b->data + crc_start, len + 4));
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// Apply one PNG filter to a scanline; returns the sum of absolute values,
+// the usual heuristic for picking the filter that compresses best
+static unsigned filter_row(int type, const uint8_t* row, const uint8_t* prev,
+                           uint8_t* out, size_t len) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        int a = i >= 4 ? row[i - 4] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = prev && i >= 4 ? prev[i - 4] : 0;
+        int pred = 0;
+        switch (type) {
+            case 1: pred = a; break;
+            case 2: pred = b; break;
+            case 3: pred = (a + b) / 2; break;
+            case 4: pred = paeth(a, b, c); break;
+        }
+        out[i] = (uint8_t)(row[i] - pred);
+        sum += out[i] < 128 ? out[i] : 256 - out[i];
+    }
+    return sum;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char* encode_png(const uint8_t* rgba, int width, int height) {
+    free_output();
+    if (!rgba || width <= 0 || height <= 0) return NULL;
+
+    size_t stride = (size_t)width * 4;
+    size_t raw_size = (stride + 1) * height;
+    uint8_t* raw = malloc(raw_size);
+    uint8_t* candidate = malloc(stride);
+    if (!raw || !candidate) {
+        free(raw);
+        free(candidate);
+        return NULL;
+    }
+
+    // Choose the best filter per scanline
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = rgba + y * stride;
+        const uint8_t* prev = y > 0 ? rgba + (y - 1) * stride : NULL;
+        uint8_t* out = raw + y * (stride + 1);
+        unsigned best = UINT32_MAX;
+        for (int type = 0; type <= 4; type++) {
+            unsigned sum = filter_row(type, row, prev, candidate, stride);
+            if (sum < best) {
+                best = sum;
+                out[0] = (uint8_t)type;
+                memcpy(out + 1, candidate, stride);
+            }
+        }
+    }
+    free(candidate);
+
+    uLongf compressed_size = compressBound(raw_size);
+    uint8_t* compressed = malloc(compressed_size);
+    if (!compressed || compress2(compressed, &compressed_size, raw, raw_size, 6) != Z_OK) {
+        free(raw);
+        free(compressed);
+        return NULL;
+    }
+    free(raw);
+
+    image_output = malloc(sizeof(ImageBuf));
+    if (!image_output) {
+        free(compressed);
+        return NULL;
+    }
+    img_init(image_output, compressed_size + 64);
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    img_bytes(image_output, signature, 8);
+
+    uint8_t ihdr[13] = {
+        (width >> 24) & 0xFF, (width >> 16) & 0xFF, (width >> 8) & 0xFF, width & 0xFF,
+        (height >> 24) & 0xFF, (height >> 16) & 0xFF, (height >> 8) & 0xFF, height & 0xFF,
+        8, // Bit depth
+        6, // Colour type: RGBA
+        0, 0, 0 // Compression, filter, interlace
+    };
+    png_chunk(image_output, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(image_output, "IDAT", compressed, compressed_size);
+    png_chunk(image_output, "IEND", NULL, 0);
+    free(compressed);
+
+    if (image_output->failed) {
+        free_output();
+        return NULL;
+    }
+    return image_output->data;
+}
+
+// ---------------------------------------------------------------------------
+// JPEG (baseline, 4:2:0, standard Huffman tables)
+// ---------------------------------------------------------------------------
+
+static const uint8_t ZIGZAG[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+static const uint8_t LUMA_QUANT[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const uint8_t CHROMA_QUANT[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const uint8_t DC_LUMA_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t DC_CHROMA_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t DC_VALS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t AC_LUMA_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t AC_LUMA_VALS[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t AC_CHROMA_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t AC_CHROMA_VALS[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+typedef struct {
+    uint16_t code[256];
+    uint8_t size[256];
+} HuffTable;
+
+typedef struct {
+    ImageBuf* out;
+    uint32_t bits;
+    int count;
+} BitWriter;
+
+static void build_huffman(HuffTable* t, const uint8_t* bits, const uint8_t* vals) {
+    uint16_t code = 0;
+    int k = 0;
+    memset(t, 0, sizeof(*t));
+    for (int len = 1; len <= 16; len++) {
+        for (int i = 0; i < bits[len - 1]; i++) {
+            t->code[vals[k]] = code++;
+            t->size[vals[k]] = len;
+            k++;
+        }
+        code <<= 1;
+    }
+}
+
+static void put_bits(BitWriter* w, uint32_t value, int size) {
+    w->bits = (w->bits << size) | (value & ((1u << size) - 1));
+    w->count += size;
+    while (w->count >= 8) {
+        uint8_t byte = (w->bits >> (w->count - 8)) & 0xFF;
+        img_u8(w->out, byte);
+        if (byte == 0xFF) img_u8(w->out, 0); // Byte stuffing
+        w->count -= 8;
+    }
+}
+
+static void flush_bits(BitWriter* w) {
+    if (w->count > 0) put_bits(w, 0x7F, 8 - w->count); // Pad with 1 bits
+}
+
+static void put_value(BitWriter* w, const HuffTable* t, int symbol, int value, int nbits) {
+    put_bits(w, t->code[symbol], t->size[symbol]);
+    if (nbits > 0) {
+        put_bits(w, value < 0 ? value - 1 : value, nbits);
+    }
+}
+
+static int bit_length(int v) {
+    int n = 0;
+    if (v < 0) v = -v;
+    while (v) {
+        n++;
+        v >>= 1;
+    }
+    return n;
+}
+
+static float dct_cos[8][8];
+
+static void init_dct() {
+    static int ready = 0;
+    if (ready) return;
+    for (int x = 0; x < 8; x++) {
+        for (int u = 0; u < 8; u++) {
+            float cu = u == 0 ? (float)M_SQRT1_2 : 1.0f;
+            dct_cos[x][u] = cu * cosf((2 * x + 1) * u * (float)M_PI / 16.0f) / 2.0f;
+        }
+    }
+    ready = 1;
+}
+
+// Forward DCT, quantisation and entropy coding of one 8x8 block
+static int encode_block(BitWriter* w, const float* block, const float* quant,
+                        int prev_dc, const HuffTable* dc, const HuffTable* ac) {
+    float rows[64];
+    for (int y = 0; y < 8; y++) {
+        for (int u = 0; u < 8; u++) {
+            float s = 0;
+            for (int x = 0; x < 8; x++) s += block[y * 8 + x] * dct_cos[x][u];
+            rows[y * 8 + u] = s;
+        }
+    }
+
+    int coeffs[64];
+    for (int u = 0; u < 8; u++) {
+        for (int v = 0; v < 8; v++) {
+            float s = 0;
+            for (int y = 0; y < 8; y++) s += rows[y * 8 + u] * dct_cos[y][v];
+            coeffs[v * 8 + u] = (int)lroundf(s / quant[v * 8 + u]);
+        }
+    }
+
+    int diff = coeffs[0] - prev_dc;
+    int nbits = bit_length(diff);
+    put_value(w, dc, nbits, diff, nbits);
+
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+        int c = coeffs[ZIGZAG[k]];
+        if (c == 0) {
+            run++;
+            continue;
+        }
+        while (run > 15) {
+            put_value(w, ac, 0xF0, 0, 0); // ZRL
+            run -= 16;
+        }
+        nbits = bit_length(c);
+        put_value(w, ac, (run << 4) | nbits, c, nbits);
+        run = 0;
+    }
+    if (run > 0) put_value(w, ac, 0x00, 0, 0); // EOB
+
+    return coeffs[0];
+}
+
+static void write_dqt(ImageBuf* b, const uint8_t* quant) {
+    for (int k = 0; k < 64; k++) img_u8(b, quant[ZIGZAG[k]]);
+}
+
+static void write_dht(ImageBuf* b, int class_id, const uint8_t* bits, const uint8_t* vals) {
+    int count = 0;
+    for (int i = 0; i < 16; i++) count += bits[i];
+    img_u8(b, class_id);
+    img_bytes(b, bits, 16);
+    img_bytes(b, vals, count);
+}
+
+// Encode an RGBA image as JPEG. Transparent areas are composited onto white.
+EMSCRIPTEN_KEEPALIVE
+unsigned char* encode_jpeg(const uint8_t* rgba, int width, int height, int quality) {
+    free_output();
+    if (!rgba || width <= 0 || height <= 0 || width > 65535 || height > 65535) return NULL;
+    init_dct();
+
+    if (quality < 1) quality = 1;
+    if (quality > 100) quality = 100;
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+    uint8_t luma_q[64], chroma_q[64];
+    float luma_qf[64], chroma_qf[64];
+    for (int i = 0; i < 64; i++) {
+        int l = (LUMA_QUANT[i] * scale + 50) / 100;
+        int c = (CHROMA_QUANT[i] * scale + 50) / 100;
+        luma_q[i] = l < 1 ? 1 : l > 255 ? 255 : l;
+        chroma_q[i] = c < 1 ? 1 : c > 255 ? 255 : c;
+        luma_qf[i] = luma_q[i];
+        chroma_qf[i] = chroma_q[i];
+    }
+
+    HuffTable dc_luma, dc_chroma, ac_luma, ac_chroma;
+    build_huffman(&dc_luma, DC_LUMA_BITS, DC_VALS);
+    build_huffman(&dc_chroma, DC_CHROMA_BITS, DC_VALS);
+    build_huffman(&ac_luma, AC_LUMA_BITS, AC_LUMA_VALS);
+    build_huffman(&ac_chroma, AC_CHROMA_BITS, AC_CHROMA_VALS);
+
+    image_output = malloc(sizeof(ImageBuf));
+    if (!image_output) return NULL;
+    img_init(image_output, (size_t)width * height / 2 + 1024);
+    ImageBuf* b = image_output;
+
+    // SOI + JFIF APP0
+    img_u16(b, 0xFFD8);
+    img_u16(b, 0xFFE0);
+    img_u16(b, 16);
+    img_bytes(b, "JFIF\0", 5);
+    img_u16(b, 0x0101); // Version 1.1
+    img_u8(b, 0);       // No density units
+    img_u16(b, 1);
+    img_u16(b, 1);
+    img_u8(b, 0);
+    img_u8(b, 0);
+
+    // Quantisation tables
+    img_u16(b, 0xFFDB);
+    img_u16(b, 2 + 2 * 65);
+    img_u8(b, 0);
+    write_dqt(b, luma_q);
+    img_u8(b, 1);
+    write_dqt(b, chroma_q);
+
+    // Frame header: 3 components, luma sampled 2x2
+    img_u16(b, 0xFFC0);
+    img_u16(b, 17);
+    img_u8(b, 8);
+    img_u16(b, height);
+    img_u16(b, width);
+    img_u8(b, 3);
+    img_u8(b, 1); img_u8(b, 0x22); img_u8(b, 0);
+    img_u8(b, 2); img_u8(b, 0x11); img_u8(b, 1);
+    img_u8(b, 3); img_u8(b, 0x11); img_u8(b, 1);
+
+    // Huffman tables
+    img_u16(b, 0xFFC4);
+    img_u16(b, 2 + (17 + 12) * 2 + (17 + 162) * 2);
+    write_dht(b, 0x00, DC_LUMA_BITS, DC_VALS);
+    write_dht(b, 0x10, AC_LUMA_BITS, AC_LUMA_VALS);
+    write_dht(b, 0x01, DC_CHROMA_BITS, DC_VALS);
+    write_dht(b, 0x11, AC_CHROMA_BITS, AC_CHROMA_VALS);
+
+    // Scan header
+    img_u16(b, 0xFFDA);
+    img_u16(b, 12);
+    img_u8(b, 3);
+    img_u8(b, 1); img_u8(b, 0x00);
+    img_u8(b, 2); img_u8(b, 0x11);
+    img_u8(b, 3); img_u8(b, 0x11);
+    img_u8(b, 0); img_u8(b, 63); img_u8(b, 0);
+
+    BitWriter w = {b, 0, 0};
+    int dc_y = 0, dc_cb = 0, dc_cr = 0;
+    float y_blocks[4][64], cb_block[64], cr_block[64];
+
+    for (int my = 0; my < height; my += 16) {
+        for (int mx = 0; mx < width; mx += 16) {
+            memset(cb_block, 0, sizeof(cb_block));
+            memset(cr_block, 0, sizeof(cr_block));
+
+            for (int py = 0; py < 16; py++) {
+                int sy = my + py < height ? my + py : height - 1;
+                for (int px = 0; px < 16; px++) {
+                    int sx = mx + px < width ? mx + px : width - 1;
+                    const uint8_t* p = rgba + ((size_t)sy * width + sx) * 4;
+                    // Composite onto white
+                    float a = p[3] / 255.0f;
+                    float r = p[0] * a + 255.0f * (1.0f - a);
+                    float g = p[1] * a + 255.0f * (1.0f - a);
+                    float bl = p[2] * a + 255.0f * (1.0f - a);
+
+                    float yv = 0.299f * r + 0.587f * g + 0.114f * bl;
+                    float cb = -0.168736f * r - 0.331264f * g + 0.5f * bl;
+                    float cr = 0.5f * r - 0.418688f * g - 0.081312f * bl;
+
+                    int block = (py >= 8) * 2 + (px >= 8);
+                    y_blocks[block][(py & 7) * 8 + (px & 7)] = yv - 128.0f;
+                    int ci = (py >> 1) * 8 + (px >> 1);
+                    cb_block[ci] += cb * 0.25f;
+                    cr_block[ci] += cr * 0.25f;
+                }
+            }
+
+            for (int i = 0; i < 4; i++) {
+                dc_y = encode_block(&w, y_blocks[i], luma_qf, dc_y, &dc_luma, &ac_luma);
+            }
+            dc_cb = encode_block(&w, cb_block, chroma_qf, dc_cb, &dc_chroma, &ac_chroma);
+            dc_cr = encode_block(&w, cr_block, chroma_qf, dc_cr, &dc_chroma, &ac_chroma);
+        }
+    }
+
+    flush_bits(&w);
+    img_u16(b, 0xFFD9);
+
+    if (b->failed) {
+        free_output();
+        return NULL;
+    }
+    return image_output->data;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_image_size() {
+    return image_output ? image_output->size : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void free_image() {
+    free_output();
+}
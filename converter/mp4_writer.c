@@ -0,0 +1,101 @@
+// Shared MP4 box writing, see mp4_writer.h
+#include <string.h>
+#include "mp4_writer.h"
+
+void mp4_sink_counting(Mp4Sink* sink) {
+    memset(sink, 0, sizeof(*sink));
+}
+
+void mp4_sink_memory(Mp4Sink* sink, uint8_t* data, size_t capacity) {
+    memset(sink, 0, sizeof(*sink));
+    sink->cursor = data;
+    sink->end = data + capacity;
+}
+
+int mp4_sink_finish(Mp4Sink* sink) {
+    return !sink->failed;
+}
+
+void mp4_bytes(Mp4Sink* sink, const void* data, size_t len) {
+    sink->written += len;
+    if (!sink->cursor || sink->failed) return;
+
+    if ((size_t)(sink->end - sink->cursor) < len) {
+        sink->failed = 1;
+        return;
+    }
+    memcpy(sink->cursor, data, len);
+    sink->cursor += len;
+}
+
+void mp4_zeros(Mp4Sink* sink, size_t len) {
+    static const uint8_t zeros[64];
+    while (len > 0) {
+        size_t n = len < sizeof(zeros) ? len : sizeof(zeros);
+        mp4_bytes(sink, zeros, n);
+        len -= n;
+    }
+}
+
+void mp4_u8(Mp4Sink* sink, uint8_t v) {
+    mp4_bytes(sink, &v, 1);
+}
+
+void mp4_u16(Mp4Sink* sink, uint16_t v) {
+    uint8_t b[2] = {v >> 8, v};
+    mp4_bytes(sink, b, 2);
+}
+
+void mp4_u32(Mp4Sink* sink, uint32_t v) {
+    uint8_t b[4] = {v >> 24, v >> 16, v >> 8, v};
+    mp4_bytes(sink, b, 4);
+}
+
+void mp4_u64(Mp4Sink* sink, uint64_t v) {
+    mp4_u32(sink, (uint32_t)(v >> 32));
+    mp4_u32(sink, (uint32_t)v);
+}
+
+void mp4_fourcc(Mp4Sink* sink, const char* fourcc) {
+    mp4_bytes(sink, fourcc, 4);
+}
+
+void mp4_full_box(Mp4Sink* sink, uint8_t version, uint32_t flags) {
+    mp4_u32(sink, ((uint32_t)version << 24) | (flags & 0xFFFFFF));
+}
+
+size_t mp4_box_header_size(uint64_t payload_size) {
+    return payload_size + 8 > UINT32_MAX ? 16 : 8;
+}
+
+void mp4_box_header(Mp4Sink* sink, const char* type, uint64_t payload_size) {
+    if (mp4_box_header_size(payload_size) == 16) {
+        // size 1 means a 64-bit largesize follows the type
+        mp4_u32(sink, 1);
+        mp4_fourcc(sink, type);
+        mp4_u64(sink, payload_size + 16);
+    } else {
+        mp4_u32(sink, (uint32_t)(payload_size + 8));
+        mp4_fourcc(sink, type);
+    }
+}
+
+uint64_t mp4_measure(Mp4BoxBody body, const void* ctx) {
+    Mp4Sink counter;
+    mp4_sink_counting(&counter);
+    body(&counter, ctx);
+    return counter.written;
+}
+
+void mp4_box(Mp4Sink* sink, const char* type, Mp4BoxBody body,
+             const void* ctx) {
+    if (!sink->cursor) {
+        // Counting needs no header values, so nested boxes are walked once
+        uint64_t start = sink->written;
+        body(sink, ctx);
+        sink->written += mp4_box_header_size(sink->written - start);
+        return;
+    }
+    mp4_box_header(sink, type, mp4_measure(body, ctx));
+    body(sink, ctx);
+}
@@ -0,0 +1,56 @@
+#ifndef GIF2VID_MP4_WRITER_H
+#define GIF2VID_MP4_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared MP4 box writing
+// Boxes are written front to back with their sizes known before their
+// headers go out, so nothing is ever backpatched or reallocated. Sizes come
+// from running a box's body against a counting sink first.
+
+typedef struct {
+    uint8_t* cursor;   // Where the next byte goes; NULL for a counting sink
+    uint8_t* end;      // End of the memory window
+    uint64_t written;  // Bytes written (or counted) so far
+    int failed;        // Set by the first failed write; later writes are dropped
+} Mp4Sink;
+
+// Count bytes without storing them, to size a box or a whole file
+void mp4_sink_counting(Mp4Sink* sink);
+
+// Write into caller-owned memory; exceeding capacity fails the sink
+void mp4_sink_memory(Mp4Sink* sink, uint8_t* data, size_t capacity);
+
+// Returns 1 if every write succeeded
+int mp4_sink_finish(Mp4Sink* sink);
+
+void mp4_u8(Mp4Sink* sink, uint8_t v);
+void mp4_u16(Mp4Sink* sink, uint16_t v);
+void mp4_u32(Mp4Sink* sink, uint32_t v);
+void mp4_u64(Mp4Sink* sink, uint64_t v);
+void mp4_fourcc(Mp4Sink* sink, const char* fourcc);
+void mp4_bytes(Mp4Sink* sink, const void* data, size_t len);
+void mp4_zeros(Mp4Sink* sink, size_t len);
+
+// Version and flags of a full box
+void mp4_full_box(Mp4Sink* sink, uint8_t version, uint32_t flags);
+
+// Writes the payload of a box; ctx carries whatever the body needs
+typedef void (*Mp4BoxBody)(Mp4Sink* sink, const void* ctx);
+
+// Size of a box header for a payload, using the 64-bit form past 4 GiB
+size_t mp4_box_header_size(uint64_t payload_size);
+
+// Write a box header for a payload of known size. Used for boxes such as
+// mdat whose payload is written separately.
+void mp4_box_header(Mp4Sink* sink, const char* type, uint64_t payload_size);
+
+// Payload size of a box body, measured with a counting sink
+uint64_t mp4_measure(Mp4BoxBody body, const void* ctx);
+
+// Write a whole box: the body is measured first, then written after its
+// header
+void mp4_box(Mp4Sink* sink, const char* type, Mp4BoxBody body, const void* ctx);
+
+#endif
@@ -7,16 +7,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "mp4_writer.h"
 
 #define MAX_FRAMES 10000
 #define MAX_BUFFER_SIZE (100 * 1024 * 1024) // 100 MB max
 
-typedef struct {
-    uint8_t* data;
-    size_t size;
-    size_t capacity;
-} Buffer;
-
 typedef struct {
     uint8_t* data;
     uint32_t size;
@@ -29,75 +24,14 @@ typedef struct {
     int frame_count;
     uint32_t width;
     uint32_t height;
-    Buffer output;
+    uint32_t chunk_offset; // File offset of the first sample, for stco
+    uint8_t* output;
     uint8_t* decoder_config;
     uint32_t decoder_config_size;
 } Muxer;
 
 static Muxer* muxer = NULL;
 
-// Buffer utilities
-static void buffer_init(Buffer* buf, size_t capacity) {
-    buf->data = (uint8_t*)malloc(capacity);
-    buf->size = 0;
-    buf->capacity = capacity;
-}
-
-static void buffer_ensure(Buffer* buf, size_t needed) {
-    if (buf->size + needed > buf->capacity) {
-        size_t new_cap = (buf->size + needed) * 2;
-        uint8_t* new_data = (uint8_t*)realloc(buf->data, new_cap);
-        if (new_data) {
-            buf->data = new_data;
-            buf->capacity = new_cap;
-        }
-    }
-}
-
-static void buffer_write_u32(Buffer* buf, uint32_t value) {
-    buffer_ensure(buf, 4);
-    buf->data[buf->size++] = (value >> 24) & 0xFF;
-    buf->data[buf->size++] = (value >> 16) & 0xFF;
-    buf->data[buf->size++] = (value >> 8) & 0xFF;
-    buf->data[buf->size++] = value & 0xFF;
-}
-
-static void buffer_write_u16(Buffer* buf, uint16_t value) {
-    buffer_ensure(buf, 2);
-    buf->data[buf->size++] = (value >> 8) & 0xFF;
-    buf->data[buf->size++] = value & 0xFF;
-}
-
-static void buffer_write_u8(Buffer* buf, uint8_t value) {
-    buffer_ensure(buf, 1);
-    buf->data[buf->size++] = value;
-}
-
-static void buffer_write_bytes(Buffer* buf, const void* data, size_t len) {
-    buffer_ensure(buf, len);
-    memcpy(buf->data + buf->size, data, len);
-    buf->size += len;
-}
-
-static void buffer_write_fourcc(Buffer* buf, const char* fourcc) {
-    buffer_write_bytes(buf, fourcc, 4);
-}
-
-static size_t box_start(Buffer* buf, const char* type) {
-    size_t offset = buf->size;
-    buffer_write_u32(buf, 0);
-    buffer_write_fourcc(buf, type);
-    return offset;
-}
-
-static void box_end(Buffer* buf, size_t offset) {
-    uint32_t size = buf->size - offset;
-    buf->data[offset] = (size >> 24) & 0xFF;
-    buf->data[offset + 1] = (size >> 16) & 0xFF;
-    buf->data[offset + 2] = (size >> 8) & 0xFF;
-    buf->data[offset + 3] = size & 0xFF;
-}
-
 // Initialize muxer
 int init_webcodecs_muxer(uint32_t width, uint32_t height) {
     if (muxer) {
@@ -112,7 +46,6 @@ int init_webcodecs_muxer(uint32_t width, uint32_t height) {
     muxer->frame_count = 0;
     muxer->decoder_config = NULL;
     muxer->decoder_config_size = 0;
-    buffer_init(&muxer->output, 1024 * 1024); // Start with 1MB
 
     return 1;
 }
@@ -151,347 +84,339 @@ int add_h264_frame(const uint8_t* data, uint32_t size, uint32_t timestamp, int i
     return 1;
 }
 
-// Write ftyp box
-static void write_ftyp(Buffer* buf) {
-    size_t start = box_start(buf, "ftyp");
-    buffer_write_fourcc(buf, "isom");
-    buffer_write_u32(buf, 512);
-    buffer_write_fourcc(buf, "isom");
-    buffer_write_fourcc(buf, "iso2");
-    buffer_write_fourcc(buf, "avc1");
-    buffer_write_fourcc(buf, "mp41");
-    box_end(buf, start);
+// Box bodies take the muxer as their context; mp4_box measures each one
+// before writing it, so sizes are known up front
+
+// ftyp box
+static void ftyp_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_fourcc(s, "isom");
+    mp4_u32(s, 512);
+    mp4_fourcc(s, "isom");
+    mp4_fourcc(s, "iso2");
+    mp4_fourcc(s, "avc1");
+    mp4_fourcc(s, "mp41");
 }
 
-// Write mdat box with all frame data
-static void write_mdat(Buffer* buf) {
-    size_t start = box_start(buf, "mdat");
+// Bytes of frame data in mdat
+static uint64_t mdat_payload_size(const Muxer* m) {
+    uint64_t size = 0;
+    for (int i = 0; i < m->frame_count; i++) {
+        size += 4 + (uint64_t)m->frames[i].size;
+    }
+    return size;
+}
 
-    for (int i = 0; i < muxer->frame_count; i++) {
-        Frame* frame = &muxer->frames[i];
+// mdat box with all frame data
+static void write_mdat(Mp4Sink* s, const Muxer* m) {
+    mp4_box_header(s, "mdat", mdat_payload_size(m));
+    for (int i = 0; i < m->frame_count; i++) {
+        const Frame* frame = &m->frames[i];
         // Write frame size as 4-byte length prefix
-        buffer_write_u32(buf, frame->size);
-        buffer_write_bytes(buf, frame->data, frame->size);
+        mp4_u32(s, frame->size);
+        mp4_bytes(s, frame->data, frame->size);
     }
+}
 
-    box_end(buf, start);
+// avcC box (decoder configuration from WebCodecs)
+static void avcc_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    if (m->decoder_config && m->decoder_config_size > 0) {
+        // Use the decoder config from WebCodecs (contains SPS/PPS)
+        mp4_bytes(s, m->decoder_config, m->decoder_config_size);
+    } else {
+        // Fallback: minimal avcC without SPS/PPS
+        mp4_u8(s, 1); // configurationVersion
+        mp4_u8(s, 0x42); // AVCProfileIndication (Baseline)
+        mp4_u8(s, 0x00); // profile_compatibility
+        mp4_u8(s, 0x1E); // AVCLevelIndication
+        mp4_u8(s, 0xFF); // lengthSizeMinusOne (4 bytes)
+        mp4_u8(s, 0xE0); // numOfSequenceParameterSets (0)
+        mp4_u8(s, 0x00); // numOfPictureParameterSets (0)
+    }
 }
 
-// Write avc1 sample description
-static void write_avc1(Buffer* buf) {
-    size_t start = box_start(buf, "avc1");
+// avc1 sample description
+static void avc1_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
 
-    // Reserved (6 bytes)
-    for (int i = 0; i < 6; i++) buffer_write_u8(buf, 0);
-    buffer_write_u16(buf, 1); // Data reference index
+    mp4_zeros(s, 6); // Reserved
+    mp4_u16(s, 1); // Data reference index
 
     // Video sample description
-    buffer_write_u16(buf, 0); // Pre-defined
-    buffer_write_u16(buf, 0); // Reserved
-    for (int i = 0; i < 3; i++) buffer_write_u32(buf, 0); // Pre-defined
+    mp4_u16(s, 0); // Pre-defined
+    mp4_u16(s, 0); // Reserved
+    mp4_zeros(s, 12); // Pre-defined
 
-    buffer_write_u16(buf, muxer->width);
-    buffer_write_u16(buf, muxer->height);
-    buffer_write_u32(buf, 0x00480000); // Horizontal resolution (72 dpi)
-    buffer_write_u32(buf, 0x00480000); // Vertical resolution (72 dpi)
-    buffer_write_u32(buf, 0); // Reserved
-    buffer_write_u16(buf, 1); // Frame count
+    mp4_u16(s, m->width);
+    mp4_u16(s, m->height);
+    mp4_u32(s, 0x00480000); // Horizontal resolution (72 dpi)
+    mp4_u32(s, 0x00480000); // Vertical resolution (72 dpi)
+    mp4_u32(s, 0); // Reserved
+    mp4_u16(s, 1); // Frame count
 
     // Compressor name (32 bytes, first byte is length)
-    buffer_write_u8(buf, 0);
-    for (int i = 0; i < 31; i++) buffer_write_u8(buf, 0);
+    mp4_zeros(s, 32);
 
-    buffer_write_u16(buf, 0x0018); // Depth
-    buffer_write_u16(buf, 0xFFFF); // Pre-defined
-
-    // avcC box (decoder configuration from WebCodecs)
-    size_t avcc_start = box_start(buf, "avcC");
-    if (muxer->decoder_config && muxer->decoder_config_size > 0) {
-        // Use the decoder config from WebCodecs (contains SPS/PPS)
-        buffer_write_bytes(buf, muxer->decoder_config, muxer->decoder_config_size);
-    } else {
-        // Fallback: minimal avcC without SPS/PPS
-        buffer_write_u8(buf, 1); // configurationVersion
-        buffer_write_u8(buf, 0x42); // AVCProfileIndication (Baseline)
-        buffer_write_u8(buf, 0x00); // profile_compatibility
-        buffer_write_u8(buf, 0x1E); // AVCLevelIndication
-        buffer_write_u8(buf, 0xFF); // lengthSizeMinusOne (4 bytes)
-        buffer_write_u8(buf, 0xE0); // numOfSequenceParameterSets (0)
-        buffer_write_u8(buf, 0x00); // numOfPictureParameterSets (0)
-    }
-    box_end(buf, avcc_start);
+    mp4_u16(s, 0x0018); // Depth
+    mp4_u16(s, 0xFFFF); // Pre-defined
 
-    box_end(buf, start);
+    mp4_box(s, "avcC", avcc_body, ctx);
 }
 
-// Write stsd box (sample descriptions)
-static void write_stsd(Buffer* buf) {
-    size_t start = box_start(buf, "stsd");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 1); // entry count
-    write_avc1(buf);
-    box_end(buf, start);
+// stsd box (sample descriptions)
+static void stsd_body(Mp4Sink* s, const void* ctx) {
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1); // entry count
+    mp4_box(s, "avc1", avc1_body, ctx);
 }
 
-// Write stts box (time-to-sample)
-static void write_stts(Buffer* buf) {
-    size_t start = box_start(buf, "stts");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 1); // entry count
-    buffer_write_u32(buf, muxer->frame_count); // sample count
+// stts box (time-to-sample)
+static void stts_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1); // entry count
+    mp4_u32(s, m->frame_count); // sample count
 
     // Calculate average delta (in timescale units)
     uint32_t avg_delta = 1000; // Default to ~30fps (assuming timescale=30000)
-    if (muxer->frame_count > 1) {
-        uint32_t total_duration = muxer->frames[muxer->frame_count - 1].timestamp - muxer->frames[0].timestamp;
-        avg_delta = (total_duration * 30) / (muxer->frame_count - 1) / 1000; // Convert microseconds to timescale units
+    if (m->frame_count > 1) {
+        uint32_t total_duration = m->frames[m->frame_count - 1].timestamp - m->frames[0].timestamp;
+        avg_delta = (total_duration * 30) / (m->frame_count - 1) / 1000; // Convert microseconds to timescale units
     }
 
-    buffer_write_u32(buf, avg_delta); // sample delta
-    box_end(buf, start);
+    mp4_u32(s, avg_delta); // sample delta
 }
 
-// Write stsc box (sample-to-chunk)
-static void write_stsc(Buffer* buf) {
-    size_t start = box_start(buf, "stsc");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 1); // entry count
-    buffer_write_u32(buf, 1); // first chunk
-    buffer_write_u32(buf, muxer->frame_count); // samples per chunk
-    buffer_write_u32(buf, 1); // sample description index
-    box_end(buf, start);
+// stsc box (sample-to-chunk)
+static void stsc_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1); // entry count
+    mp4_u32(s, 1); // first chunk
+    mp4_u32(s, m->frame_count); // samples per chunk
+    mp4_u32(s, 1); // sample description index
 }
 
-// Write stsz box (sample sizes)
-static void write_stsz(Buffer* buf) {
-    size_t start = box_start(buf, "stsz");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 0); // sample size (0 = variable)
-    buffer_write_u32(buf, muxer->frame_count); // sample count
+// stsz box (sample sizes)
+static void stsz_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); // sample size (0 = variable)
+    mp4_u32(s, m->frame_count); // sample count
 
-    for (int i = 0; i < muxer->frame_count; i++) {
-        buffer_write_u32(buf, muxer->frames[i].size + 4); // +4 for length prefix
+    for (int i = 0; i < m->frame_count; i++) {
+        mp4_u32(s, m->frames[i].size + 4); // +4 for length prefix
     }
-
-    box_end(buf, start);
 }
 
-// Write stco box (chunk offsets)
-static void write_stco(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "stco");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 1); // entry count
-    buffer_write_u32(buf, mdat_offset + 8); // chunk offset (mdat start + box header)
-    box_end(buf, start);
+// stco box (chunk offsets)
+static void stco_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1); // entry count
+    mp4_u32(s, m->chunk_offset);
 }
 
-// Write stss box (sync samples / keyframes)
-static void write_stss(Buffer* buf) {
-    // Count keyframes
-    int keyframe_count = 0;
-    for (int i = 0; i < muxer->frame_count; i++) {
-        if (muxer->frames[i].is_keyframe) keyframe_count++;
+static int keyframe_count(const Muxer* m) {
+    int count = 0;
+    for (int i = 0; i < m->frame_count; i++) {
+        if (m->frames[i].is_keyframe) count++;
     }
+    return count;
+}
 
-    if (keyframe_count == 0) return; // No keyframes, skip this box
-
-    size_t start = box_start(buf, "stss");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, keyframe_count); // entry count
+// stss box (sync samples / keyframes)
+static void stss_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, keyframe_count(m)); // entry count
 
-    for (int i = 0; i < muxer->frame_count; i++) {
-        if (muxer->frames[i].is_keyframe) {
-            buffer_write_u32(buf, i + 1); // sample number (1-indexed)
+    for (int i = 0; i < m->frame_count; i++) {
+        if (m->frames[i].is_keyframe) {
+            mp4_u32(s, i + 1); // sample number (1-indexed)
         }
     }
+}
 
-    box_end(buf, start);
-}
-
-// Write stbl box (sample table)
-static void write_stbl(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "stbl");
-    write_stsd(buf);
-    write_stts(buf);
-    write_stsc(buf);
-    write_stsz(buf);
-    write_stco(buf, mdat_offset);
-    write_stss(buf);
-    box_end(buf, start);
-}
-
-// Write minf box (media information)
-static void write_minf(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "minf");
-
-    // vmhd (video media header)
-    size_t vmhd_start = box_start(buf, "vmhd");
-    buffer_write_u32(buf, 1); // version + flags (flags = 1)
-    buffer_write_u16(buf, 0); // graphicsmode
-    buffer_write_u16(buf, 0); // opcolor[0]
-    buffer_write_u16(buf, 0); // opcolor[1]
-    buffer_write_u16(buf, 0); // opcolor[2]
-    box_end(buf, vmhd_start);
-
-    // dinf (data information)
-    size_t dinf_start = box_start(buf, "dinf");
-    size_t dref_start = box_start(buf, "dref");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 1); // entry count
-    size_t url_start = box_start(buf, "url ");
-    buffer_write_u32(buf, 1); // version + flags (flags = 1, self-contained)
-    box_end(buf, url_start);
-    box_end(buf, dref_start);
-    box_end(buf, dinf_start);
-
-    write_stbl(buf, mdat_offset);
-
-    box_end(buf, start);
-}
-
-// Write mdia box (media)
-static void write_mdia(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "mdia");
-
-    // mdhd (media header)
-    size_t mdhd_start = box_start(buf, "mdhd");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 0); // creation time
-    buffer_write_u32(buf, 0); // modification time
-    buffer_write_u32(buf, 30000); // timescale (30000 units per second)
-
-    // Calculate duration
-    uint32_t duration = 30000; // default
-    if (muxer->frame_count > 0) {
-        uint32_t last_timestamp = muxer->frames[muxer->frame_count - 1].timestamp;
-        duration = (last_timestamp * 30) / 1000; // Convert microseconds to timescale units
+// stbl box (sample table)
+static void stbl_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "stsd", stsd_body, ctx);
+    mp4_box(s, "stts", stts_body, ctx);
+    mp4_box(s, "stsc", stsc_body, ctx);
+    mp4_box(s, "stsz", stsz_body, ctx);
+    mp4_box(s, "stco", stco_body, ctx);
+    if (keyframe_count(ctx) > 0) { // No keyframes, skip this box
+        mp4_box(s, "stss", stss_body, ctx);
     }
-    buffer_write_u32(buf, duration); // duration
+}
 
-    buffer_write_u16(buf, 0x55C4); // language (und = undetermined)
-    buffer_write_u16(buf, 0); // pre-defined
-    box_end(buf, mdhd_start);
+// vmhd (video media header)
+static void vmhd_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 1);
+    mp4_u16(s, 0); // graphicsmode
+    mp4_zeros(s, 6); // opcolor
+}
 
-    // hdlr (handler)
-    size_t hdlr_start = box_start(buf, "hdlr");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 0); // pre-defined
-    buffer_write_fourcc(buf, "vide"); // handler type
-    buffer_write_u32(buf, 0); // reserved
-    buffer_write_u32(buf, 0); // reserved
-    buffer_write_u32(buf, 0); // reserved
-    buffer_write_u8(buf, 0); // name (empty string)
-    box_end(buf, hdlr_start);
+static void url_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 1); // self-contained
+}
 
-    write_minf(buf, mdat_offset);
+static void dref_body(Mp4Sink* s, const void* ctx) {
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 1); // entry count
+    mp4_box(s, "url ", url_body, ctx);
+}
 
-    box_end(buf, start);
+// dinf (data information)
+static void dinf_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "dref", dref_body, ctx);
 }
 
-// Write trak box (track)
-static void write_trak(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "trak");
+// minf box (media information)
+static void minf_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "vmhd", vmhd_body, ctx);
+    mp4_box(s, "dinf", dinf_body, ctx);
+    mp4_box(s, "stbl", stbl_body, ctx);
+}
 
-    // tkhd (track header)
-    size_t tkhd_start = box_start(buf, "tkhd");
-    buffer_write_u32(buf, 0x00000007); // version + flags (enabled, in movie, in preview)
-    buffer_write_u32(buf, 0); // creation time
-    buffer_write_u32(buf, 0); // modification time
-    buffer_write_u32(buf, 1); // track ID
-    buffer_write_u32(buf, 0); // reserved
+// mdhd (media header)
+static void mdhd_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); // creation time
+    mp4_u32(s, 0); // modification time
+    mp4_u32(s, 30000); // timescale (30000 units per second)
 
     // Calculate duration
-    uint32_t duration = 1000; // default
-    if (muxer->frame_count > 0) {
-        uint32_t last_timestamp = muxer->frames[muxer->frame_count - 1].timestamp;
-        duration = last_timestamp / 1000; // Convert microseconds to milliseconds
+    uint32_t duration = 30000; // default
+    if (m->frame_count > 0) {
+        uint32_t last_timestamp = m->frames[m->frame_count - 1].timestamp;
+        duration = (last_timestamp * 30) / 1000; // Convert microseconds to timescale units
     }
-    buffer_write_u32(buf, duration); // duration (in movie timescale)
-
-    buffer_write_u32(buf, 0); // reserved
-    buffer_write_u32(buf, 0); // reserved
-    buffer_write_u16(buf, 0); // layer
-    buffer_write_u16(buf, 0); // alternate group
-    buffer_write_u16(buf, 0); // volume
-    buffer_write_u16(buf, 0); // reserved
-
-    // Matrix
-    buffer_write_u32(buf, 0x00010000); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0x00010000);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0x40000000);
+    mp4_u32(s, duration);
 
-    buffer_write_u32(buf, muxer->width << 16); // width
-    buffer_write_u32(buf, muxer->height << 16); // height
-    box_end(buf, tkhd_start);
-
-    write_mdia(buf, mdat_offset);
-
-    box_end(buf, start);
+    mp4_u16(s, 0x55C4); // language (und = undetermined)
+    mp4_u16(s, 0); // pre-defined
 }
 
-// Write moov box (movie)
-static void write_moov(Buffer* buf, uint32_t mdat_offset) {
-    size_t start = box_start(buf, "moov");
+// hdlr (handler)
+static void hdlr_body(Mp4Sink* s, const void* ctx) {
+    (void)ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); // pre-defined
+    mp4_fourcc(s, "vide"); // handler type
+    mp4_zeros(s, 12); // reserved
+    mp4_u8(s, 0); // name (empty string)
+}
 
-    // mvhd (movie header)
-    size_t mvhd_start = box_start(buf, "mvhd");
-    buffer_write_u32(buf, 0); // version + flags
-    buffer_write_u32(buf, 0); // creation time
-    buffer_write_u32(buf, 0); // modification time
-    buffer_write_u32(buf, 1000); // timescale (1000 = 1ms)
+// mdia box (media)
+static void mdia_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "mdhd", mdhd_body, ctx);
+    mp4_box(s, "hdlr", hdlr_body, ctx);
+    mp4_box(s, "minf", minf_body, ctx);
+}
 
-    // Calculate duration
+// Duration in the movie timescale (milliseconds)
+static uint32_t movie_duration(const Muxer* m) {
     uint32_t duration = 1000; // default
-    if (muxer->frame_count > 0) {
-        uint32_t last_timestamp = muxer->frames[muxer->frame_count - 1].timestamp;
+    if (m->frame_count > 0) {
+        uint32_t last_timestamp = m->frames[m->frame_count - 1].timestamp;
         duration = last_timestamp / 1000; // Convert microseconds to milliseconds
     }
-    buffer_write_u32(buf, duration); // duration
+    return duration;
+}
+
+// Unity transformation matrix (nine 16.16 / 2.30 fixed point values)
+static void write_matrix(Mp4Sink* s) {
+    static const uint32_t matrix[9] = {
+        0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+    };
+    for (int i = 0; i < 9; i++) mp4_u32(s, matrix[i]);
+}
 
-    buffer_write_u32(buf, 0x00010000); // rate (1.0)
-    buffer_write_u16(buf, 0x0100); // volume (1.0)
-    buffer_write_u16(buf, 0); // reserved
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0); // reserved
+// tkhd (track header)
+static void tkhd_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 7); // enabled, in movie, in preview
+    mp4_u32(s, 0); // creation time
+    mp4_u32(s, 0); // modification time
+    mp4_u32(s, 1); // track ID
+    mp4_u32(s, 0); // reserved
+    mp4_u32(s, movie_duration(m)); // duration (in movie timescale)
+    mp4_zeros(s, 8); // reserved
+    mp4_u16(s, 0); // layer
+    mp4_u16(s, 0); // alternate group
+    mp4_u16(s, 0); // volume
+    mp4_u16(s, 0); // reserved
+    write_matrix(s);
+    mp4_u32(s, m->width << 16); // width
+    mp4_u32(s, m->height << 16); // height
+}
 
-    // Matrix
-    buffer_write_u32(buf, 0x00010000); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0x00010000);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0);
-    buffer_write_u32(buf, 0); buffer_write_u32(buf, 0x40000000);
+// trak box (track)
+static void trak_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "tkhd", tkhd_body, ctx);
+    mp4_box(s, "mdia", mdia_body, ctx);
+}
 
-    // Pre-defined
-    for (int i = 0; i < 6; i++) buffer_write_u32(buf, 0);
+// mvhd (movie header)
+static void mvhd_body(Mp4Sink* s, const void* ctx) {
+    const Muxer* m = ctx;
+    mp4_full_box(s, 0, 0);
+    mp4_u32(s, 0); // creation time
+    mp4_u32(s, 0); // modification time
+    mp4_u32(s, 1000); // timescale (1000 = 1ms)
+    mp4_u32(s, movie_duration(m));
+    mp4_u32(s, 0x00010000); // rate (1.0)
+    mp4_u16(s, 0x0100); // volume (1.0)
+    mp4_u16(s, 0); // reserved
+    mp4_zeros(s, 8); // reserved
+    write_matrix(s);
+    mp4_zeros(s, 24); // Pre-defined
+    mp4_u32(s, 2); // next track ID
+}
 
-    buffer_write_u32(buf, 2); // next track ID
-    box_end(buf, mvhd_start);
+// moov box (movie)
+static void moov_body(Mp4Sink* s, const void* ctx) {
+    mp4_box(s, "mvhd", mvhd_body, ctx);
+    mp4_box(s, "trak", trak_body, ctx);
+}
 
-    write_trak(buf, mdat_offset);
+// Write the whole file: ftyp, mdat, then moov
+static void write_mp4(Mp4Sink* s, Muxer* m) {
+    uint64_t ftyp_size = 8 + mp4_measure(ftyp_body, m);
+    m->chunk_offset = ftyp_size + mp4_box_header_size(mdat_payload_size(m));
 
-    box_end(buf, start);
+    mp4_box(s, "ftyp", ftyp_body, m);
+    write_mdat(s, m);
+    mp4_box(s, "moov", moov_body, m);
 }
 
-// Finalize and get MP4 data
+// Finalize and get MP4 data, written into an exactly sized buffer
 const uint8_t* finalize_webcodecs_mp4(uint32_t* out_size) {
+    *out_size = 0;
     if (!muxer || muxer->frame_count == 0) {
-        *out_size = 0;
         return NULL;
     }
 
-    // Build MP4 structure
-    write_ftyp(&muxer->output);
+    Mp4Sink sink;
+    mp4_sink_counting(&sink);
+    write_mp4(&sink, muxer);
+    size_t size = sink.written;
 
-    // Remember where mdat will be
-    uint32_t mdat_offset = muxer->output.size;
-    write_mdat(&muxer->output);
+    free(muxer->output);
+    muxer->output = malloc(size);
+    if (!muxer->output) return NULL;
 
-    // Write moov with correct mdat offset
-    write_moov(&muxer->output, mdat_offset);
+    mp4_sink_memory(&sink, muxer->output, size);
+    write_mp4(&sink, muxer);
+    if (!mp4_sink_finish(&sink)) return NULL;
 
-    *out_size = muxer->output.size;
-    return muxer->output.data;
+    *out_size = size;
+    return muxer->output;
 }
 
 // Cleanup
@@ -504,8 +429,8 @@ void cleanup_webcodecs_muxer() {
         }
     }
 
-    if (muxer->output.data) {
-        free(muxer->output.data);
+    if (muxer->output) {
+        free(muxer->output);
     }
 
     if (muxer->decoder_config) {
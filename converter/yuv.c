@@ -0,0 +1,238 @@
+// Colour conversion straight to I420 planes
+// Encoders take 4:2:0 input, so converting here saves ffmpeg a swscale pass
+// and halves the bytes stored per frame compared with RGB24. Built with
+// -msimd128 the hot loops use WebAssembly SIMD; the scalar loops give the
+// same results and handle the row tails.
+#include <stdlib.h>
+#include <string.h>
+#include "yuv.h"
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+// BT.601 limited range in 8-bit fixed point
+static inline uint8_t rgb_to_y(int r, int g, int b) {
+    return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+static inline uint8_t rgb_to_u(int r, int g, int b) {
+    return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+static inline uint8_t rgb_to_v(int r, int g, int b) {
+    return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// Produces one row of Y plus full-resolution U and V, which are averaged
+// down to 4:2:0 once both rows of a pair are done
+typedef void (*RowConverter)(const uint8_t* src, int width, const void* ctx,
+                             uint8_t* y, uint8_t* u, uint8_t* v);
+
+#ifdef __wasm_simd128__
+// Weighted sum of R, G and B for 4 RGBA pixels, rounded and shifted back down
+static inline v128_t dot4(v128_t px, v128_t k) {
+    // Each i32 lane of the dot product holds R*kr+G*kg or B*kb+A*0
+    v128_t lo = wasm_i32x4_dot_i16x8(wasm_u16x8_extend_low_u8x16(px), k);
+    v128_t hi = wasm_i32x4_dot_i16x8(wasm_u16x8_extend_high_u8x16(px), k);
+    v128_t sum = wasm_i32x4_add(wasm_i32x4_shuffle(lo, hi, 0, 2, 4, 6),
+                                wasm_i32x4_shuffle(lo, hi, 1, 3, 5, 7));
+    return wasm_i32x4_shr(wasm_i32x4_add(sum, wasm_i32x4_splat(128)), 8);
+}
+
+// One output byte for each of 16 RGBA pixels
+static inline v128_t dot16(const v128_t* px, v128_t k, int offset) {
+    v128_t off = wasm_i32x4_splat(offset);
+    v128_t a = wasm_i16x8_narrow_i32x4(wasm_i32x4_add(dot4(px[0], k), off),
+                                       wasm_i32x4_add(dot4(px[1], k), off));
+    v128_t b = wasm_i16x8_narrow_i32x4(wasm_i32x4_add(dot4(px[2], k), off),
+                                       wasm_i32x4_add(dot4(px[3], k), off));
+    return wasm_u8x16_narrow_i16x8(a, b);
+}
+#endif
+
+// Four-byte pixels with red at byte `red` and blue at byte 2 - red
+static inline void four_byte_row(const uint8_t* src, int width, int red,
+                                 uint8_t* y, uint8_t* u, uint8_t* v) {
+    int blue = 2 - red;
+    int x = 0;
+#ifdef __wasm_simd128__
+    // Coefficients laid out in the pixel's own byte order
+    int16_t cy[3], cu[3], cv[3];
+    cy[red] = 66;  cy[1] = 129; cy[blue] = 25;
+    cu[red] = -38; cu[1] = -74; cu[blue] = 112;
+    cv[red] = 112; cv[1] = -94; cv[blue] = -18;
+    const v128_t ky = wasm_i16x8_make(cy[0], cy[1], cy[2], 0,
+                                      cy[0], cy[1], cy[2], 0);
+    const v128_t ku = wasm_i16x8_make(cu[0], cu[1], cu[2], 0,
+                                      cu[0], cu[1], cu[2], 0);
+    const v128_t kv = wasm_i16x8_make(cv[0], cv[1], cv[2], 0,
+                                      cv[0], cv[1], cv[2], 0);
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* p = src + x * 4;
+        v128_t px[4] = {
+            wasm_v128_load(p), wasm_v128_load(p + 16),
+            wasm_v128_load(p + 32), wasm_v128_load(p + 48),
+        };
+        wasm_v128_store(y + x, dot16(px, ky, 16));
+        wasm_v128_store(u + x, dot16(px, ku, 128));
+        wasm_v128_store(v + x, dot16(px, kv, 128));
+    }
+#endif
+    for (; x < width; x++) {
+        const uint8_t* p = src + x * 4;
+        y[x] = rgb_to_y(p[red], p[1], p[blue]);
+        u[x] = rgb_to_u(p[red], p[1], p[blue]);
+        v[x] = rgb_to_v(p[red], p[1], p[blue]);
+    }
+}
+
+static void rgba_row(const uint8_t* src, int width, const void* ctx,
+                     uint8_t* y, uint8_t* u, uint8_t* v) {
+    (void)ctx;
+    four_byte_row(src, width, 0, y, u, v);
+}
+
+static void bgra_row(const uint8_t* src, int width, const void* ctx,
+                     uint8_t* y, uint8_t* u, uint8_t* v) {
+    (void)ctx;
+    four_byte_row(src, width, 2, y, u, v);
+}
+
+static void rgb24_row(const uint8_t* src, int width, const void* ctx,
+                      uint8_t* y, uint8_t* u, uint8_t* v) {
+    (void)ctx;
+    for (int x = 0; x < width; x++) {
+        const uint8_t* p = src + x * 3;
+        y[x] = rgb_to_y(p[0], p[1], p[2]);
+        u[x] = rgb_to_u(p[0], p[1], p[2]);
+        v[x] = rgb_to_v(p[0], p[1], p[2]);
+    }
+}
+
+// A GIF frame has at most 256 colours, so Y/U/V are looked up per index
+// rather than computed per pixel
+static void indexed_row(const uint8_t* indices, int width, const void* ctx,
+                        uint8_t* y, uint8_t* u, uint8_t* v) {
+    const uint8_t (*lut)[3] = ctx;
+    for (int x = 0; x < width; x++) {
+        const uint8_t* e = lut[indices[x]];
+        y[x] = e[0];
+        u[x] = e[1];
+        v[x] = e[2];
+    }
+}
+
+// Average the 2x2 blocks of two full-resolution chroma rows. An odd last
+// column is averaged with itself, as is an odd last row (passed twice).
+static void average_2x2(const uint8_t* r0, const uint8_t* r1, int width,
+                        uint8_t* out) {
+    int x = 0;
+#ifdef __wasm_simd128__
+    const v128_t two = wasm_i16x8_splat(2);
+    for (; x + 32 <= width; x += 32) {
+        v128_t a = wasm_i16x8_add(
+            wasm_u16x8_extadd_pairwise_u8x16(wasm_v128_load(r0 + x)),
+            wasm_u16x8_extadd_pairwise_u8x16(wasm_v128_load(r1 + x)));
+        v128_t b = wasm_i16x8_add(
+            wasm_u16x8_extadd_pairwise_u8x16(wasm_v128_load(r0 + x + 16)),
+            wasm_u16x8_extadd_pairwise_u8x16(wasm_v128_load(r1 + x + 16)));
+        a = wasm_u16x8_shr(wasm_i16x8_add(a, two), 2);
+        b = wasm_u16x8_shr(wasm_i16x8_add(b, two), 2);
+        wasm_v128_store(out + x / 2, wasm_u8x16_narrow_i16x8(a, b));
+    }
+#endif
+    for (; x + 1 < width; x += 2) {
+        out[x / 2] = (r0[x] + r0[x + 1] + r1[x] + r1[x + 1] + 2) >> 2;
+    }
+    if (x < width) {
+        out[x / 2] = (r0[x] + r1[x] + 1) >> 1;
+    }
+}
+
+size_t i420_size(int width, int height) {
+    size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    return (size_t)width * height + chroma * 2;
+}
+
+// Convert a frame a pair of rows at a time, so full-resolution chroma only
+// ever needs two rows of scratch space
+static int convert_i420(const uint8_t* src, size_t stride, int width,
+                        int height, RowConverter row, const void* ctx,
+                        uint8_t* out) {
+    int chroma_width = (width + 1) / 2;
+    uint8_t* plane_y = out;
+    uint8_t* plane_u = out + (size_t)width * height;
+    uint8_t* plane_v = plane_u + (size_t)chroma_width * ((height + 1) / 2);
+
+    uint8_t* scratch = malloc((size_t)width * 4);
+    if (!scratch) return 0;
+    uint8_t* u0 = scratch;
+    uint8_t* v0 = scratch + width;
+    uint8_t* u1 = scratch + width * 2;
+    uint8_t* v1 = scratch + width * 3;
+
+    for (int j = 0; j < height; j += 2) {
+        row(src + (size_t)j * stride, width, ctx,
+            plane_y + (size_t)j * width, u0, v0);
+        const uint8_t* u_below = u0;
+        const uint8_t* v_below = v0;
+        if (j + 1 < height) {
+            row(src + (size_t)(j + 1) * stride, width, ctx,
+                plane_y + (size_t)(j + 1) * width, u1, v1);
+            u_below = u1;
+            v_below = v1;
+        }
+        size_t chroma_row = (size_t)(j / 2) * chroma_width;
+        average_2x2(u0, u_below, width, plane_u + chroma_row);
+        average_2x2(v0, v_below, width, plane_v + chroma_row);
+    }
+
+    free(scratch);
+    return 1;
+}
+
+int pixel_format_size(int format) {
+    switch (format) {
+        case PIXEL_FORMAT_RGBA:
+        case PIXEL_FORMAT_BGRA:
+            return 4;
+        case PIXEL_FORMAT_RGB24:
+            return 3;
+        case PIXEL_FORMAT_INDEXED:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int pixels_to_i420(const uint8_t* src, int format, size_t stride, int width,
+                   int height, const uint8_t* palette, int palette_size,
+                   uint8_t* out) {
+    switch (format) {
+        case PIXEL_FORMAT_RGBA:
+            return convert_i420(src, stride, width, height, rgba_row, NULL, out);
+        case PIXEL_FORMAT_BGRA:
+            return convert_i420(src, stride, width, height, bgra_row, NULL, out);
+        case PIXEL_FORMAT_RGB24:
+            return convert_i420(src, stride, width, height, rgb24_row, NULL, out);
+        case PIXEL_FORMAT_INDEXED:
+            break;
+        default:
+            return 0;
+    }
+
+    uint8_t lut[256][3];
+    for (int i = 0; i < 256; i++) {
+        int r = 0, g = 0, b = 0;
+        if (palette && i < palette_size) {
+            r = palette[i * 3];
+            g = palette[i * 3 + 1];
+            b = palette[i * 3 + 2];
+        }
+        lut[i][0] = rgb_to_y(r, g, b);
+        lut[i][1] = rgb_to_u(r, g, b);
+        lut[i][2] = rgb_to_v(r, g, b);
+    }
+    return convert_i420(src, stride, width, height, indexed_row, lut, out);
+}
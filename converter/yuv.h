@@ -0,0 +1,33 @@
+#ifndef GIF2VID_YUV_H
+#define GIF2VID_YUV_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layouts of the pixel data handed to the converter
+#define PIXEL_FORMAT_RGBA 0
+#define PIXEL_FORMAT_BGRA 1     // Canvas and VideoFrame data on most platforms
+#define PIXEL_FORMAT_RGB24 2
+#define PIXEL_FORMAT_INDEXED 3  // One palette index per pixel, RGB palette
+
+// Bytes per pixel of a pixel format, or 0 if the format is unknown
+int pixel_format_size(int format);
+
+// I420 frames are a full-size Y plane followed by quarter-size U and V
+// planes (rounded up for odd dimensions), BT.601 limited range - the layout
+// of ffmpeg's yuv420p
+
+// Bytes needed for one I420 frame
+size_t i420_size(int width, int height);
+
+// Convert pixels to I420. stride is the distance between rows in bytes, so
+// a sub-rectangle of a larger surface converts in place. The palette (RGB
+// triples, as stored in a GIF) is only used for PIXEL_FORMAT_INDEXED, where
+// Y/U/V are looked up per entry; indices past its end come out black.
+// Returns 0 for an unknown format or if scratch memory could not be
+// allocated.
+int pixels_to_i420(const uint8_t* src, int format, size_t stride, int width,
+                   int height, const uint8_t* palette, int palette_size,
+                   uint8_t* out);
+
+#endif
@@ -103,7 +103,9 @@ await esbuild.build({
       setup(build) {
         // Intercept node: imports and replace with empty modules
         // This prevents esbuild from trying to bundle Node.js built-ins
-        build.onResolve({ filter: /^node:/ }, (args) => {
+        // h264-mp4-encoder is only imported as a package in Node.js; browsers
+        // load it with a script tag
+        build.onResolve({ filter: /^(node:|h264-mp4-encoder$)/ }, (args) => {
           return { path: args.path, namespace: 'node-stub' };
         });
 
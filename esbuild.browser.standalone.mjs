@@ -86,7 +86,8 @@ await esbuild.build({
       setup(build) {
         // Stub out node: imports for browser
         // These are only used in Node.js code paths that won't execute in browsers
-        build.onResolve({ filter: /^node:/ }, (args) => {
+        // h264-mp4-encoder is embedded below as a script, not imported
+        build.onResolve({ filter: /^(node:|h264-mp4-encoder$)/ }, (args) => {
           return { path: args.path, namespace: 'node-stub' };
         });
         build.onLoad({ filter: /.*/, namespace: 'node-stub' }, () => {
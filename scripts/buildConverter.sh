@@ -26,15 +26,21 @@ fi
 # Create output directory if it doesn't exist
 mkdir -p "$OUTPUT_DIR"
 
+# Both builds create their memory in JS (IMPORTED_MEMORY), so each instance
+# can be given an initial heap sized for its job rather than growing into it
+
 # Build for web (browser)
 echo ""
 echo "Building web version (browser-only)..."
-emcc "$CONVERTER_DIR/gif2vid.c" "$CONVERTER_DIR/webcodecs_muxer.c" \
+emcc "$CONVERTER_DIR/gif2vid.c" "$CONVERTER_DIR/image.c" "$CONVERTER_DIR/yuv.c" "$CONVERTER_DIR/mp4_writer.c" "$CONVERTER_DIR/analysis.c" "$CONVERTER_DIR/webcodecs_muxer.c" \
     -o "$OUTPUT_DIR/gif2vid-web.js" \
     -s WASM=1 \
     -s EXPORTED_RUNTIME_METHODS='["cwrap","ccall","getValue","setValue","UTF8ToString","HEAPU8"]' \
-    -s EXPORTED_FUNCTIONS='["_malloc","_free","_init_encoder","_add_frame","_finalize_video","_get_video_buffer","_get_video_size","_cleanup","_allocate_buffer","_free_buffer","_init_webcodecs_muxer","_set_decoder_config","_add_h264_frame","_finalize_webcodecs_mp4","_cleanup_webcodecs_muxer"]' \
+    -s EXPORTED_FUNCTIONS='["_malloc","_free","_init_encoder","_init_encoder_format","_add_frame","_add_frame_pixels","_convert_to_i420","_finalize_video","_get_video_buffer","_get_video_size","_get_header_buffer","_get_header_size","_get_frame_count","_get_frame_buffer","_get_frame_size","_get_frame_change","_track_luma_change","_i420_ssim","_i420_sse","_scale_rgba","_fit_rgba","_encode_png","_encode_jpeg","_get_image_size","_free_image","_cleanup","_allocate_buffer","_free_buffer","_init_webcodecs_muxer","_set_decoder_config","_add_h264_frame","_finalize_webcodecs_mp4","_cleanup_webcodecs_muxer"]' \
     -s ALLOW_MEMORY_GROWTH=1 \
+    -s IMPORTED_MEMORY=1 \
+    -s USE_ZLIB=1 \
+    -msimd128 \
     -s MODULARIZE=1 \
     -s EXPORT_ES6=1 \
     -s EXPORT_NAME="createGif2VidModule" \
@@ -46,12 +52,15 @@ echo "✓ Web version built: $OUTPUT_DIR/gif2vid-web.js"
 # Build for Node.js
 echo ""
 echo "Building Node.js version..."
-emcc "$CONVERTER_DIR/gif2vid.c" \
+emcc "$CONVERTER_DIR/gif2vid.c" "$CONVERTER_DIR/image.c" "$CONVERTER_DIR/yuv.c" "$CONVERTER_DIR/mp4_writer.c" "$CONVERTER_DIR/analysis.c" \
     -o "$OUTPUT_DIR/gif2vid-node.js" \
     -s WASM=1 \
     -s EXPORTED_RUNTIME_METHODS='["cwrap","ccall","getValue","setValue","UTF8ToString","HEAPU8"]' \
-    -s EXPORTED_FUNCTIONS='["_malloc","_free","_init_encoder","_add_frame","_finalize_video","_get_video_buffer","_get_video_size","_cleanup","_allocate_buffer","_free_buffer"]' \
+    -s EXPORTED_FUNCTIONS='["_malloc","_free","_init_encoder","_init_encoder_format","_add_frame","_add_frame_pixels","_convert_to_i420","_finalize_video","_get_video_buffer","_get_video_size","_get_header_buffer","_get_header_size","_get_frame_count","_get_frame_buffer","_get_frame_size","_get_frame_change","_track_luma_change","_i420_ssim","_i420_sse","_scale_rgba","_fit_rgba","_encode_png","_encode_jpeg","_get_image_size","_free_image","_cleanup","_allocate_buffer","_free_buffer"]' \
     -s ALLOW_MEMORY_GROWTH=1 \
+    -s IMPORTED_MEMORY=1 \
+    -s USE_ZLIB=1 \
+    -msimd128 \
     -s MODULARIZE=1 \
     -s EXPORT_ES6=1 \
     -s EXPORT_NAME="createGif2VidModule" \
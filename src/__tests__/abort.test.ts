@@ -0,0 +1,73 @@
+import { readFile } from 'node:fs/promises';
+import { describe, expect, it } from 'vitest';
+import {
+  createJobSignal,
+  isDeadlineAbort,
+  throwIfAborted,
+} from '../abort.js';
+import { decodeGif } from '../gif-decoder.js';
+
+// Block the thread, so no timer can fire meanwhile
+function busyWait(ms: number) {
+  const end = performance.now() + ms;
+  while (performance.now() < end) {
+    // Spin
+  }
+}
+
+describe('Cancellation', () => {
+  it('should stop decoding when the signal is aborted', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const controller = new AbortController();
+    controller.abort();
+
+    expect(() => decodeGif(gif, { signal: controller.signal })).toThrow();
+  });
+
+  it('should report deadline aborts separately from caller aborts', async () => {
+    const controller = new AbortController();
+    const signal = createJobSignal({
+      deadlineMs: 1,
+      signal: controller.signal,
+    });
+    await new Promise((resolve) => setTimeout(resolve, 20));
+
+    expect(signal?.aborted).toBe(true);
+    expect(isDeadlineAbort(signal)).toBe(true);
+
+    const cancelled = new AbortController();
+    cancelled.abort();
+    expect(isDeadlineAbort(cancelled.signal)).toBe(false);
+  });
+
+  it('should enforce deadlines without an event loop turn', () => {
+    const signal = createJobSignal({ deadlineMs: 5 });
+    busyWait(10);
+
+    expect(signal?.aborted).toBe(false); // The timer has had no chance
+    expect(() => throwIfAborted(signal)).toThrow(/timeout/);
+    expect(isDeadlineAbort(signal)).toBe(true);
+  });
+
+  it('should stop decoding a multi-frame GIF at the deadline', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    let frames = 0;
+    const signal = createJobSignal({ deadlineMs: 5 });
+
+    // decodeGif runs synchronously, so only its own deadline checks can
+    // stop it; each frame takes 2ms so the deadline passes part way through
+    expect(() =>
+      decodeGif(gif, {
+        allocate: (size) => {
+          frames++;
+          busyWait(2);
+          return new Uint8Array(size);
+        },
+        signal,
+      }),
+    ).toThrow(/timeout/);
+    expect(frames).toBeGreaterThan(0);
+    expect(frames).toBeLessThan(decodeGif(gif).frames.length);
+    expect(isDeadlineAbort(signal)).toBe(true);
+  });
+});
@@ -0,0 +1,60 @@
+import { describe, expect, it } from 'vitest';
+import { alignCropRect, autoCropFrames, DirtyRegion } from '../auto-crop.js';
+
+const WIDTH = 40;
+const HEIGHT = 30;
+
+// An RGBA frame that is black apart from the given pixels
+function frame(...pixels: Array<[number, number]>) {
+  const data = new Uint8Array(WIDTH * HEIGHT * 4);
+  for (const [x, y] of pixels) {
+    data.fill(255, (y * WIDTH + x) * 4, (y * WIDTH + x + 1) * 4);
+  }
+  return { data, delay: 100, height: HEIGHT, width: WIDTH };
+}
+
+describe('Automatic cropping', () => {
+  it('should union the changed region across frames', () => {
+    const region = new DirtyRegion(WIDTH, HEIGHT);
+    for (const f of [frame(), frame([5, 7]), frame([20, 12]), frame([33, 9])]) {
+      region.add(f);
+    }
+    expect(region.bounds()).toEqual({ height: 6, width: 29, x: 5, y: 7 });
+  });
+
+  it('should align the crop outwards within the canvas', () => {
+    const rect = { height: 6, width: 29, x: 5, y: 7 };
+    expect(alignCropRect(rect, WIDTH, HEIGHT, 'even')).toEqual({
+      height: 8,
+      width: 30,
+      x: 4,
+      y: 6,
+    });
+    expect(alignCropRect(rect, WIDTH, HEIGHT, 'macroblock')).toEqual({
+      height: 16,
+      width: 40,
+      x: 0,
+      y: 0,
+    });
+  });
+
+  it('should crop frames as views into the original pixels', () => {
+    const frames = [frame(), frame([10, 10]), frame([13, 11])];
+    const cropped = autoCropFrames(frames, WIDTH, HEIGHT, 'even');
+
+    expect(cropped.width).toBe(4);
+    expect(cropped.height).toBe(2);
+    const view = cropped.frames[1];
+    expect(view.stride).toBe(WIDTH * 4);
+    expect(view.data.buffer).toBe(frames[1].data.buffer);
+    expect(view.data[0]).toBe(255); // Pixel (10, 10) is the crop's origin
+  });
+
+  it('should keep the canvas when nothing changes', () => {
+    const frames = [frame([3, 3]), frame([3, 3])];
+    const cropped = autoCropFrames(frames, WIDTH, HEIGHT, 'even');
+    expect(cropped.frames).toBe(frames);
+    expect(cropped.width).toBe(WIDTH);
+    expect(cropped.height).toBe(HEIGHT);
+  });
+});
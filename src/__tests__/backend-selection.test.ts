@@ -0,0 +1,132 @@
+import { mkdtemp, rm, writeFile } from 'node:fs/promises';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { beforeEach, describe, expect, it } from 'vitest';
+import {
+  calibrateBackends,
+  predictBackendMs,
+  recordBackendTiming,
+  resetBackendCalibration,
+  selectBackend,
+  sizeClass,
+} from '../backend-selection.js';
+
+const tiny = { frames: 4, height: 32, width: 32 };
+const large = { frames: 200, height: 480, width: 640 };
+
+describe('Calibrated backend selection', () => {
+  beforeEach(() => resetBackendCalibration());
+
+  it('should order size classes by pixels x frames', () => {
+    expect(sizeClass(tiny)).toBe(0);
+    expect(sizeClass(large)).toBeGreaterThan(sizeClass(tiny));
+    expect(sizeClass({ ...large, frames: 100_000 })).toBe(11);
+  });
+
+  it('should use the preferred backend until calibrated', () => {
+    expect(selectBackend(tiny, ['ffmpeg', 'wasm-encoder'])).toBe('ffmpeg');
+  });
+
+  it('should route small jobs and large jobs to different backends', () => {
+    resetBackendCalibration({
+      ffmpeg: { fixedMs: 80, msPerMegapixelFrame: 10 },
+      'wasm-encoder': { fixedMs: 5, msPerMegapixelFrame: 60 },
+    });
+    const candidates = ['ffmpeg', 'wasm-encoder'] as const;
+    expect(selectBackend(tiny, [...candidates])).toBe('wasm-encoder');
+    expect(selectBackend(large, [...candidates])).toBe('ffmpeg');
+  });
+
+  it('should fit fixed and per-pixel costs from synthetic runs', async () => {
+    const runs: string[] = [];
+    const costs = await calibrateBackends(
+      ['ffmpeg', 'wasm-encoder'],
+      async (backend, { frames, height, width }) => {
+        runs.push(backend);
+        const mpf = (width * height * frames) / 1_000_000;
+        return backend === 'ffmpeg' ? 100 + 20 * mpf : 10 + 200 * mpf;
+      },
+      { cacheDir: null },
+    );
+
+    expect(runs.filter((backend) => backend === 'ffmpeg')).toHaveLength(5);
+    expect(costs.ffmpeg?.fixedMs).toBeCloseTo(100);
+    expect(costs['wasm-encoder']?.msPerMegapixelFrame).toBeCloseTo(200);
+  });
+
+  it('should leave backends that fail to encode uncalibrated', async () => {
+    const costs = await calibrateBackends(
+      ['ffmpeg', 'wasm-encoder'],
+      async (backend) => {
+        if (backend === 'ffmpeg') {
+          throw new Error('ffmpeg not found');
+        }
+        return 10;
+      },
+      { cacheDir: null },
+    );
+    expect(costs.ffmpeg).toBeUndefined();
+    expect(selectBackend(large, ['ffmpeg', 'wasm-encoder'])).toBe(
+      'wasm-encoder',
+    );
+  });
+
+  it('should leave calibration to a thread holding the lock', async () => {
+    const cacheDir = await mkdtemp(join(tmpdir(), 'gif2vid-calibration-'));
+    try {
+      const lockPath = join(cacheDir, 'backend-calibration.json.lock');
+      await writeFile(lockPath, '');
+      const runs: string[] = [];
+      const run = async (backend: string) => {
+        runs.push(backend);
+        return 10;
+      };
+
+      const costs = await calibrateBackends(['ffmpeg', 'wasm-encoder'], run, {
+        cacheDir,
+      });
+      expect(runs).toEqual([]);
+      expect(costs).toEqual({});
+
+      // Once the lock is released, the next process calibrates and caches
+      await rm(lockPath);
+      resetBackendCalibration();
+      await calibrateBackends(['ffmpeg', 'wasm-encoder'], run, { cacheDir });
+      expect(runs.length).toBeGreaterThan(0);
+
+      runs.length = 0;
+      resetBackendCalibration();
+      const cached = await calibrateBackends(['ffmpeg', 'wasm-encoder'], run, {
+        cacheDir,
+      });
+      expect(runs).toEqual([]);
+      expect(cached.ffmpeg).toBeDefined();
+    } finally {
+      await rm(cacheDir, { force: true, recursive: true });
+    }
+  });
+
+  it('should calibrate without a cache it cannot write', async () => {
+    const dir = await mkdtemp(join(tmpdir(), 'gif2vid-calibration-'));
+    try {
+      // A file where the cache directory should be makes mkdir fail
+      const cacheDir = join(dir, 'not-a-dir');
+      await writeFile(cacheDir, '');
+      const costs = await calibrateBackends(['ffmpeg'], async () => 10, {
+        cacheDir,
+      });
+      expect(costs.ffmpeg).toBeDefined();
+    } finally {
+      await rm(dir, { force: true, recursive: true });
+    }
+  });
+
+  it('should adjust costs from real job timings', () => {
+    resetBackendCalibration({
+      ffmpeg: { fixedMs: 80, msPerMegapixelFrame: 10 },
+    });
+    const before = predictBackendMs('ffmpeg', large);
+    recordBackendTiming('ffmpeg', large, 'medium', before * 3);
+    expect(predictBackendMs('ffmpeg', large)).toBeGreaterThan(before);
+  });
+});
@@ -0,0 +1,65 @@
+import { beforeEach, describe, expect, it } from 'vitest';
+import {
+  acquireBuffer,
+  getBufferPoolStats,
+  releaseBuffer,
+  resetBufferPool,
+  setBufferPoolLimit,
+} from '../buffer-pool.js';
+
+describe('Buffer pool', () => {
+  beforeEach(() => {
+    resetBufferPool();
+    setBufferPoolLimit(64 * 1024 * 1024);
+  });
+
+  it('should reuse released buffers of the same size class', () => {
+    const first = acquireBuffer(100_000);
+    expect(first.length).toBe(100_000);
+    releaseBuffer(first);
+
+    const second = acquireBuffer(120_000);
+    expect(second.buffer).toBe(first.buffer);
+    expect(second.length).toBe(120_000);
+    expect(getBufferPoolStats()).toEqual({ idleBuffers: 0, idleBytes: 0 });
+
+    // A different size class needs a buffer of its own
+    const larger = acquireBuffer(200_000);
+    expect(larger.buffer).not.toBe(first.buffer);
+  });
+
+  it('should ignore foreign and already released buffers', () => {
+    releaseBuffer(new Uint8Array(4096));
+    expect(getBufferPoolStats().idleBuffers).toBe(0);
+
+    const buffer = acquireBuffer(5000);
+    releaseBuffer(buffer);
+    releaseBuffer(buffer);
+    expect(getBufferPoolStats()).toEqual({ idleBuffers: 1, idleBytes: 8192 });
+
+    // Two live buffers never share storage
+    const a = acquireBuffer(5000);
+    const b = acquireBuffer(5000);
+    expect(a.buffer).not.toBe(b.buffer);
+  });
+
+  it('should keep idle buffers within the limit', () => {
+    setBufferPoolLimit(64 * 1024);
+    const buffers = [acquireBuffer(32 * 1024), acquireBuffer(32 * 1024)];
+    const extra = acquireBuffer(32 * 1024);
+    for (const buffer of [...buffers, extra]) {
+      releaseBuffer(buffer);
+    }
+    expect(getBufferPoolStats()).toEqual({
+      idleBuffers: 2,
+      idleBytes: 64 * 1024,
+    });
+
+    setBufferPoolLimit(40 * 1024);
+    expect(getBufferPoolStats().idleBytes).toBe(32 * 1024);
+  });
+
+  it('should hand out empty arrays for empty requests', () => {
+    expect(acquireBuffer(0).length).toBe(0);
+  });
+});
@@ -0,0 +1,182 @@
+import { readFile } from 'node:fs/promises';
+import type { Readable } from 'node:stream';
+import { fileTypeFromBuffer } from 'file-type';
+import * as omggif from 'omggif';
+import { beforeEach, describe, expect, it, vi } from 'vitest';
+import { decodeGif } from '../gif-decoder.js';
+import {
+  concatGifs,
+  convertGifBuffer,
+  convertGifBufferInto,
+  convertGifToStream,
+} from '../index.js';
+
+// With neither ffmpeg nor the WASM H.264 encoder, every conversion returns
+// the converter's own MP4, so the output does not depend on the machine
+vi.mock('../ffmpeg-registry.js', async (importOriginal) => ({
+  ...(await importOriginal<typeof import('../ffmpeg-registry.js')>()),
+  getFFmpegCapabilities: async () => ({
+    available: false,
+    encoders: [],
+    error: 'disabled in tests',
+    fastPresets: {},
+    filters: [],
+  }),
+}));
+vi.mock('../webcodecs.js', async (importOriginal) => ({
+  ...(await importOriginal<typeof import('../webcodecs.js')>()),
+  loadWasmEncoder: async () => null,
+}));
+
+interface Box {
+  end: number;
+  start: number; // Offset of the payload
+  type: string;
+}
+
+function readBoxes(buffer: Buffer, start = 0, end = buffer.length): Box[] {
+  const boxes: Box[] = [];
+  for (let offset = start; offset < end; ) {
+    let size = buffer.readUInt32BE(offset);
+    let header = 8;
+    if (size === 1) {
+      size = Number(buffer.readBigUInt64BE(offset + 8));
+      header = 16;
+    }
+    expect(size).toBeGreaterThanOrEqual(header);
+    expect(offset + size).toBeLessThanOrEqual(end);
+    boxes.push({
+      end: offset + size,
+      start: offset + header,
+      type: buffer.toString('latin1', offset + 4, offset + 8),
+    });
+    offset += size;
+  }
+  return boxes;
+}
+
+function findBox(buffer: Buffer, path: string[], within?: Box): Box {
+  let box = within;
+  for (const type of path) {
+    const found = readBoxes(buffer, box?.start, box?.end).find(
+      (child) => child.type === type,
+    );
+    if (!found) {
+      throw new Error(`No ${path.join('/')} box`);
+    }
+    box = found;
+  }
+  return box as Box;
+}
+
+/**
+ * Check the MP4's box structure and return what its single track holds
+ */
+async function inspectMp4(mp4: Uint8Array) {
+  const buffer = Buffer.from(mp4);
+  expect((await fileTypeFromBuffer(buffer))?.mime).toContain('video/');
+
+  const top = readBoxes(buffer);
+  expect(top[0].type).toBe('ftyp');
+  const mdat = findBox(buffer, ['mdat']);
+
+  const trak = findBox(buffer, ['moov', 'trak']);
+  const tkhd = findBox(buffer, ['tkhd'], trak);
+  const stsz = findBox(buffer, ['mdia', 'minf', 'stbl', 'stsz'], trak);
+  const sampleSize = buffer.readUInt32BE(stsz.start + 4);
+  const frameCount = buffer.readUInt32BE(stsz.start + 8);
+  let sampleBytes = sampleSize * frameCount;
+  if (sampleSize === 0) {
+    sampleBytes = 0;
+    for (let i = 0; i < frameCount; i++) {
+      sampleBytes += buffer.readUInt32BE(stsz.start + 12 + i * 4);
+    }
+  }
+  // Every sample is in mdat, and nothing else is
+  expect(mdat.end - mdat.start).toBe(sampleBytes);
+
+  return {
+    frameCount,
+    height: buffer.readUInt32BE(tkhd.end - 4) >>> 16,
+    width: buffer.readUInt32BE(tkhd.end - 8) >>> 16,
+  };
+}
+
+// A GIF of frameCount frames, each a different flat colour
+function flatGif(width: number, height: number, frameCount: number): Buffer {
+  const buffer = Buffer.alloc(1024 + width * height * frameCount * 2);
+  const writer = new omggif.GifWriter(buffer, width, height, { loop: 0 });
+  const palette = [0xff_00_00, 0x00_ff_00, 0x00_00_ff, 0xff_ff_ff];
+  for (let i = 0; i < frameCount; i++) {
+    const pixels = Array.from(
+      { length: width * height },
+      () => i % palette.length,
+    );
+    writer.addFrame(0, 0, width, height, pixels, { delay: 10, palette });
+  }
+  return buffer.subarray(0, writer.end());
+}
+
+beforeEach(() => {
+  // Each conversion warns that it fell back to the unoptimized MP4
+  vi.spyOn(console, 'warn').mockImplementation(() => {});
+});
+
+describe('convertGifToStream', () => {
+  it('should stream the same MP4 that convertGifBuffer returns', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+
+    const stream = (await convertGifToStream(gif)) as Readable;
+    const chunks: Buffer[] = [];
+    for await (const chunk of stream) {
+      chunks.push(chunk);
+    }
+    const streamed = Buffer.concat(chunks);
+
+    const { frameCount } = await inspectMp4(streamed);
+    expect(frameCount).toBeGreaterThan(0);
+    expect(streamed.equals(await convertGifBuffer(gif))).toBe(true);
+  });
+});
+
+describe('concatGifs', () => {
+  it('should fit GIFs of different sizes onto one canvas', async () => {
+    const first = await readFile('./tests/images/test1.gif');
+    const second = flatGif(24, 10, 3);
+    const { frames, height, width } = decodeGif(first);
+    expect([width, height]).not.toEqual([24, 10]);
+
+    const mp4 = await concatGifs([first, second]);
+
+    expect(await inspectMp4(mp4)).toEqual({
+      frameCount: frames.length + 3,
+      height,
+      width,
+    });
+  });
+});
+
+describe('convertGifBufferInto', () => {
+  it('should return the size needed and leave a small buffer alone', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const expected = await convertGifBuffer(gif);
+    const out = new Uint8Array(16).fill(0xab);
+
+    expect(await convertGifBufferInto(gif, out)).toBe(expected.length);
+    expect(out.every((byte) => byte === 0xab)).toBe(true);
+  });
+
+  it('should write the video into a buffer that is big enough', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const expected = await convertGifBuffer(gif);
+    const out = new Uint8Array(expected.length + 64).fill(0xab);
+
+    expect(await convertGifBufferInto(gif, out)).toBe(expected.length);
+    expect(Buffer.from(out.subarray(0, expected.length)).equals(expected)).toBe(
+      true,
+    );
+    expect(out.subarray(expected.length).every((byte) => byte === 0xab)).toBe(
+      true,
+    );
+  });
+});
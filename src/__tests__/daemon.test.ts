@@ -0,0 +1,183 @@
+import { Readable, Writable } from 'node:stream';
+import { describe, expect, it } from 'vitest';
+import {
+  ConversionPool,
+  encodeFrame,
+  encodeResponse,
+  RequestParser,
+  runDaemon,
+} from '../daemon.js';
+
+function encodeRequest(header: object, gif: Uint8Array): Buffer {
+  return Buffer.concat([
+    encodeFrame(Buffer.from(JSON.stringify(header))),
+    encodeFrame(gif),
+  ]);
+}
+
+describe('Daemon protocol', () => {
+  it('should parse requests split across arbitrary chunks', () => {
+    const stream = Buffer.concat([
+      encodeRequest({ id: 1, options: { fps: 30 } }, new Uint8Array([1, 2, 3])),
+      encodeRequest({ id: 'b' }, new Uint8Array([4, 5])),
+    ]);
+
+    const parser = new RequestParser();
+    const requests = [];
+    for (let i = 0; i < stream.length; i += 3) {
+      requests.push(...parser.push(stream.subarray(i, i + 3)));
+    }
+
+    expect(parser.isIdle()).toBe(true);
+    expect(requests).toHaveLength(2);
+    expect(requests[0].header).toEqual({ id: 1, options: { fps: 30 } });
+    expect(Array.from(requests[0].gif)).toEqual([1, 2, 3]);
+    expect(requests[1].header).toEqual({ id: 'b' });
+    expect(Array.from(requests[1].gif)).toEqual([4, 5]);
+  });
+
+  it('should reject headers without an id', () => {
+    const parser = new RequestParser();
+    expect(() =>
+      parser.push(encodeFrame(Buffer.from(JSON.stringify({ fps: 10 })))),
+    ).toThrow(/id/);
+  });
+
+  it('should frame responses as header and payload', () => {
+    const response = Buffer.concat(
+      encodeResponse({ id: 7, ok: true }, new Uint8Array([9, 9])),
+    );
+    const headerLength = response.readUInt32BE(0);
+    const header = JSON.parse(
+      response.subarray(4, 4 + headerLength).toString('utf8'),
+    );
+
+    expect(header).toEqual({ id: 7, ok: true });
+    expect(response.readUInt32BE(4 + headerLength)).toBe(2);
+    expect(Array.from(response.subarray(8 + headerLength))).toEqual([9, 9]);
+  });
+});
+
+describe('Daemon', () => {
+  it('should stop reading requests while output is backed up', async () => {
+    const requests = Array.from({ length: 50 }, (_, i) =>
+      encodeRequest({ id: i }, new Uint8Array([i])),
+    );
+    const received: Buffer[] = [];
+    // A reader that takes a millisecond per write
+    const output = new Writable({
+      highWaterMark: 1024,
+      write(chunk, _encoding, callback) {
+        received.push(chunk);
+        setTimeout(callback, 1);
+      },
+    });
+
+    let maxBuffered = 0;
+    await runDaemon({
+      convert: async () => {
+        await new Promise((resolve) => setTimeout(resolve, 1));
+        maxBuffered = Math.max(maxBuffered, output.writableLength);
+        return new Uint8Array(4096);
+      },
+      input: Readable.from(requests),
+      output,
+      workers: 1,
+    });
+
+    // Without backpressure all 50 responses would be queued at once
+    expect(maxBuffered).toBeLessThan(3 * 4096);
+    expect(Buffer.concat(received).length).toBeGreaterThan(50 * 4096);
+  });
+
+  it('should answer accepted requests on bad input', async () => {
+    const received: Buffer[] = [];
+    const output = new Writable({
+      write(chunk, _encoding, callback) {
+        received.push(chunk);
+        callback();
+      },
+    });
+    const input = Buffer.concat([
+      encodeRequest({ id: 1 }, new Uint8Array([7])),
+      encodeFrame(Buffer.from(JSON.stringify({ fps: 10 }))),
+    ]);
+
+    await expect(
+      runDaemon({
+        convert: async (gif) => {
+          await new Promise((resolve) => setTimeout(resolve, 10));
+          return gif;
+        },
+        input: Readable.from([input]),
+        output,
+        workers: 1,
+      }),
+    ).rejects.toThrow(/id/);
+
+    const response = Buffer.concat(received);
+    const headerLength = response.readUInt32BE(0);
+    expect(
+      JSON.parse(response.subarray(4, 4 + headerLength).toString('utf8')),
+    ).toEqual({ id: 1, ok: true });
+    expect(Array.from(response.subarray(8 + headerLength))).toEqual([7]);
+  });
+});
+
+describe('ConversionPool', () => {
+  it('should fail the job and replace a worker that exits', async () => {
+    const pool = new ConversionPool(1, {
+      restartBackoffMs: 1,
+      workerScript: new URL('./fixtures/pool-worker.mjs', import.meta.url),
+    });
+    try {
+      await expect(pool.convert(new Uint8Array([0]))).rejects.toThrow(
+        /exited with code 1/,
+      );
+      expect(Array.from(await pool.convert(new Uint8Array([1, 2])))).toEqual([
+        1, 2,
+      ]);
+    } finally {
+      await pool.close();
+    }
+  });
+
+  it('should stop restarting workers that fail to load', async () => {
+    const pool = new ConversionPool(1, {
+      maxRestarts: 2,
+      restartBackoffMs: 1,
+      workerScript: new URL('./fixtures/broken-worker.mjs', import.meta.url),
+    });
+    try {
+      const jobs = [1, 2, 3, 4].map((i) =>
+        pool.convert(new Uint8Array([i])).then(
+          () => 'converted',
+          (error: Error) => error.message,
+        ),
+      );
+      const results = await Promise.all(jobs);
+      expect(results.every((message) => message !== 'converted')).toBe(true);
+      expect(results.at(-1)).toMatch(/keep exiting/);
+      await expect(pool.convert(new Uint8Array([5]))).rejects.toThrow(
+        /keep exiting/,
+      );
+    } finally {
+      await pool.close();
+    }
+  });
+
+  it('should reject queued and later jobs once closed', async () => {
+    const pool = new ConversionPool(1, {
+      workerScript: new URL('./fixtures/pool-worker.mjs', import.meta.url),
+    });
+    const running = pool.convert(new Uint8Array([1])).catch(() => {});
+    const queued = expect(pool.convert(new Uint8Array([2]))).rejects.toThrow(
+      /closed/,
+    );
+    await pool.close();
+
+    await queued;
+    await expect(pool.convert(new Uint8Array([3]))).rejects.toThrow(/closed/);
+    await running;
+  });
+});
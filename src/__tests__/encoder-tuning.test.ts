@@ -0,0 +1,91 @@
+import { beforeEach, describe, expect, it } from 'vitest';
+import {
+  estimateEncodeMs,
+  recordEncodeTiming,
+  reducedBitrateKbps,
+  resetEncoderCalibration,
+  sampleFrameRuns,
+  searchCrfForSsim,
+  selectEncoderSettings,
+  targetBitrateKbps,
+} from '../encoder-tuning.js';
+
+const workload = { frames: 100, height: 480, width: 640 };
+
+describe('Latency-budgeted encoder settings', () => {
+  beforeEach(() => resetEncoderCalibration());
+
+  it('should pick faster presets for tighter budgets', () => {
+    expect(selectEncoderSettings(workload, 60_000).preset).toBe('slow');
+    expect(selectEncoderSettings(workload, 300).preset).toBe('veryfast');
+  });
+
+  it('should fall back to crf and scale when nothing fits', () => {
+    const settings = selectEncoderSettings(workload, 70);
+    expect(settings.preset).toBe('ultrafast');
+    expect(settings.crf).toBeGreaterThan(23);
+    expect(settings.scale).toBeLessThan(1);
+  });
+
+  it('should calibrate estimates from measured timings', () => {
+    const before = estimateEncodeMs(workload, 'medium');
+    const settings = { crf: 23, preset: 'medium' as const, scale: 1 };
+    // Report the machine as much slower than the baseline
+    recordEncodeTiming(workload, settings, before * 4);
+    expect(estimateEncodeMs(workload, 'medium')).toBeGreaterThan(before);
+  });
+});
+
+describe('Size-targeted rate control', () => {
+  it('should leave room for the container and a safety margin', () => {
+    const maxBytes = 1_000_000;
+    const durationMs = 10_000;
+    const kbps = targetBitrateKbps(maxBytes, durationMs, 100);
+    const videoBytes = (kbps * durationMs) / 8;
+
+    expect(videoBytes).toBeLessThan(maxBytes - 2048);
+    expect(videoBytes).toBeGreaterThan(maxBytes * 0.9);
+  });
+
+  it('should reject limits that cannot fit the video', () => {
+    expect(() => targetBitrateKbps(4096, 60_000)).toThrow(/too small/);
+  });
+
+  it('should cut the bitrate by more than the overshoot on retries', () => {
+    // 20% over the limit
+    const kbps = reducedBitrateKbps(1000, 1_200_000, 1_000_000);
+    expect(kbps).toBeLessThan(1000 / 1.2);
+    expect(kbps).toBeGreaterThan(1000 / 1.2 - 100);
+  });
+});
+
+describe('Quality-targeted crf', () => {
+  // SSIM falling linearly from 1 at crf 0
+  const measure = async (crf: number) => 1 - crf / 1000;
+
+  it('should pick the highest crf that meets the target', async () => {
+    const measured: number[] = [];
+    const crf = await searchCrfForSsim(0.97, async (crf) => {
+      measured.push(crf);
+      return measure(crf);
+    });
+    expect(crf).toBe(30);
+    expect(measured.length).toBeLessThanOrEqual(6);
+  });
+
+  it('should use the lowest crf when nothing meets the target', async () => {
+    expect(await searchCrfForSsim(0.999, measure)).toBe(12);
+  });
+
+  it('should reject targets outside 0-1', async () => {
+    await expect(searchCrfForSsim(1.5, measure)).rejects.toThrow(/between/);
+  });
+
+  it('should sample runs of consecutive frames across the video', () => {
+    expect(sampleFrameRuns(5)).toEqual([0, 1, 2, 3, 4]);
+    const sample = sampleFrameRuns(100);
+    expect(sample).toHaveLength(24);
+    expect(sample.slice(0, 8)).toEqual([0, 1, 2, 3, 4, 5, 6, 7]);
+    expect(sample.at(-1)).toBe(99);
+  });
+});
@@ -0,0 +1,48 @@
+import { readFile } from 'node:fs/promises';
+import * as omggif from 'omggif';
+import { describe, expect, it } from 'vitest';
+import {
+  decodeCompositedFrame,
+  frameIndexAt,
+  GifCompositor,
+} from '../gif-decoder.js';
+
+describe('Frame extraction', () => {
+  it('should match compositing every frame from the start', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const reader = new omggif.GifReader(gif);
+    const target = reader.numFrames() - 1;
+
+    const compositor = new GifCompositor(reader.width, reader.height);
+    let expected = compositor.canvas;
+    for (let i = 0; i <= target; i++) {
+      expected = compositor.draw(reader, i);
+    }
+
+    const frame = decodeCompositedFrame(gif, { index: target });
+    expect(frame.width).toBe(reader.width);
+    expect(frame.height).toBe(reader.height);
+    expect(Buffer.from(frame.data).equals(expected)).toBe(true);
+  });
+
+  it('should select frames by time using the frame delays', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const reader = new omggif.GifReader(gif);
+    const firstDelay = (reader.frameInfo(0).delay || 10) * 10;
+
+    expect(frameIndexAt(reader, 0)).toBe(0);
+    expect(frameIndexAt(reader, firstDelay)).toBe(
+      Math.min(1, reader.numFrames() - 1),
+    );
+    expect(frameIndexAt(reader, Number.MAX_SAFE_INTEGER)).toBe(
+      reader.numFrames() - 1,
+    );
+  });
+
+  it('should reject out of range frames', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    expect(() => decodeCompositedFrame(gif, { index: 100_000 })).toThrow(
+      /out of range/,
+    );
+  });
+});
@@ -0,0 +1,92 @@
+import { chmod, mkdtemp, readFile, rm, writeFile } from 'node:fs/promises';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import { afterEach, describe, expect, it } from 'vitest';
+import {
+  getFFmpegCapabilities,
+  parseEncoders,
+  parseFilters,
+  parseVersion,
+  resetFFmpegCapabilities,
+} from '../ffmpeg-registry.js';
+
+// Output captured from `ffmpeg -hide_banner -version` etc. (ffmpeg 6.1)
+const fixtures = fileURLToPath(new URL('./fixtures', import.meta.url));
+const captured = (name: string) =>
+  readFile(join(fixtures, `ffmpeg-${name}.txt`), 'utf8');
+
+describe('ffmpeg capability parsing', () => {
+  it('should read video encoders below the legend only', async () => {
+    expect(parseEncoders(await captured('encoders'))).toEqual([
+      'a64multi',
+      'libaom-av1',
+      'libsvtav1',
+      'libx264',
+      'libx264rgb',
+      'h264_vaapi',
+      'libx265',
+    ]);
+  });
+
+  it('should read filters but not the flag legend', async () => {
+    expect(parseFilters(await captured('filters'))).toEqual([
+      'abench',
+      'crop',
+      'fps',
+      'scale',
+      'buffer',
+      'nullsink',
+      'split',
+    ]);
+  });
+
+  it('should read the version', async () => {
+    expect(parseVersion(await captured('version'))).toBe('6.1.1-3ubuntu5');
+    expect(parseVersion('')).toBe('unknown');
+  });
+});
+
+describe.skipIf(process.platform === 'win32')('ffmpeg registry', () => {
+  const path = process.env.PATH;
+  afterEach(() => {
+    process.env.PATH = path;
+    resetFFmpegCapabilities();
+  });
+
+  it('should honour the cacheDir of each caller', async () => {
+    const dir = await mkdtemp(join(tmpdir(), 'gif2vid-registry-'));
+    try {
+      // An ffmpeg that prints the captured output for each probe
+      const binary = join(dir, 'ffmpeg');
+      await writeFile(
+        binary,
+        [
+          '#!/bin/sh',
+          `exec cat "${fixtures}/ffmpeg$2.txt"`, // $2 is -version etc.
+        ].join('\n'),
+      );
+      await chmod(binary, 0o755);
+      process.env.PATH = dir;
+      resetFFmpegCapabilities();
+
+      const uncached = await getFFmpegCapabilities({ cacheDir: null });
+      expect(uncached).toMatchObject({
+        available: true,
+        fastPresets: { libx264: ['ultrafast', 'superfast', 'veryfast'] },
+        path: binary,
+        version: '6.1.1-3ubuntu5',
+      });
+
+      const cacheDir = join(dir, 'cache');
+      const cached = await getFFmpegCapabilities({ cacheDir });
+      expect(cached.encoders).toEqual(uncached.encoders);
+      const stored = JSON.parse(
+        await readFile(join(cacheDir, 'ffmpeg-capabilities.json'), 'utf8'),
+      );
+      expect(Object.values(stored.entries)).toEqual([cached]);
+    } finally {
+      await rm(dir, { force: true, recursive: true });
+    }
+  });
+});
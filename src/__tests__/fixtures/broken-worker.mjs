@@ -0,0 +1,5 @@
+/**
+ * A conversion pool worker for daemon.test.ts that fails as it loads, like
+ * a worker whose script or WASM is missing
+ */
+throw new Error('Worker failed to load');
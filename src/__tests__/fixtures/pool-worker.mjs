@@ -0,0 +1,12 @@
+/**
+ * A conversion pool worker for daemon.test.ts. It echoes each GIF back, and
+ * exits without raising an error when the first byte is 0.
+ */
+import { parentPort } from 'node:worker_threads';
+
+parentPort.on('message', ({ gif }) => {
+  if (gif[0] === 0) {
+    process.exit(1);
+  }
+  parentPort.postMessage({ data: gif, ok: true });
+});
@@ -0,0 +1,22 @@
+/**
+ * A spool worker process for spool.test.ts. Its converter reverses the bytes
+ * and logs each job it runs, one line per job, to the given file.
+ *
+ * Usage: node spool-worker.ts <spool dir> <log file>
+ */
+import { appendFile } from 'node:fs/promises';
+import { runSpoolWorker } from '../../spool.ts';
+
+const [dir, log] = process.argv.slice(2);
+
+const result = await runSpoolWorker(dir, {
+  concurrency: 2,
+  convert: async (gif) => {
+    await appendFile(log, `${Buffer.from(gif).toString()}\n`);
+    await new Promise((resolve) => setTimeout(resolve, 5));
+    return new Uint8Array(gif).reverse();
+  },
+  drain: true,
+  pollMs: 5,
+});
+process.send?.(result);
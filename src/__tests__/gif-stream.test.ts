@@ -0,0 +1,64 @@
+import { readFile } from 'node:fs/promises';
+import { Readable } from 'node:stream';
+import { describe, expect, it } from 'vitest';
+import { decodeGif } from '../gif-decoder.js';
+import { decodeGifStream, GifStreamDecoder } from '../gif-stream.js';
+
+describe('Streaming GIF decoder', () => {
+  it('should decode the same frames as the buffer decoder', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const expected = decodeGif(gif);
+
+    // Feed the file in awkward chunk sizes to split every block
+    const decoder = new GifStreamDecoder();
+    const frames = [];
+    for (let i = 0; i < gif.length; i += 7) {
+      decoder.push(gif.subarray(i, i + 7));
+      let frame = decoder.next();
+      while (frame) {
+        frames.push(frame);
+        frame = decoder.next();
+      }
+    }
+    decoder.finish();
+
+    expect(decoder.width).toBe(expected.width);
+    expect(decoder.height).toBe(expected.height);
+    expect(frames).toHaveLength(expected.frames.length);
+    for (let i = 0; i < frames.length; i++) {
+      expect(frames[i].delay).toBe(expected.frames[i].delay);
+      expect(Buffer.from(frames[i].data).equals(expected.frames[i].data)).toBe(
+        true,
+      );
+    }
+  });
+
+  it('should decode from Node and web streams', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const expected = decodeGif(gif).frames.length;
+
+    let count = 0;
+    for await (const _frame of decodeGifStream(Readable.from([gif]))) {
+      count++;
+    }
+    expect(count).toBe(expected);
+
+    count = 0;
+    const web = new Blob([gif]).stream();
+    for await (const _frame of decodeGifStream(web)) {
+      count++;
+    }
+    expect(count).toBe(expected);
+  });
+
+  it('should reject streams that end mid-block', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const truncated = Readable.from([gif.subarray(0, gif.length - 20)]);
+
+    await expect(async () => {
+      for await (const _frame of decodeGifStream(truncated)) {
+        // Drain
+      }
+    }).rejects.toThrow(/middle of a block/);
+  });
+});
@@ -0,0 +1,33 @@
+import { describe, expect, it } from 'vitest';
+import { keyframeTimesMs, planKeyframes } from '../keyframes.js';
+
+describe('Keyframe placement', () => {
+  const policy = { maxInterval: 10, minInterval: 3, sceneChange: 0.4 };
+
+  it('should place keyframes at scene changes, not on a fixed interval', () => {
+    const changes = [1, 0, 0, 0, 0.9, 0.05, 0, 0, 0];
+    expect(planKeyframes(changes, policy)).toEqual([0, 4]);
+  });
+
+  it('should hold scene changes back until the minimum interval', () => {
+    const changes = [1, 0.9, 0.9, 0.9, 0, 0];
+    expect(planKeyframes(changes, policy)).toEqual([0, 3]);
+  });
+
+  it('should cap the interval on static content', () => {
+    const changes = new Array(25).fill(0);
+    expect(planKeyframes(changes, policy)).toEqual([0, 10, 20]);
+  });
+
+  it('should convert keyframe indices to frame start times', () => {
+    const frames = [{ delay: 50 }, { delay: 0 }, { delay: 30 }, { delay: 40 }];
+    expect(keyframeTimesMs(frames, [1, 0, 0, 1], policy)).toEqual([0, 180]);
+  });
+
+  it('should leave placement to the encoder without analysis', () => {
+    const frames = [{ delay: 50 }, { delay: 50 }];
+    expect(keyframeTimesMs(frames, undefined)).toBeUndefined();
+    expect(keyframeTimesMs(frames, [null, null])).toBeUndefined();
+    expect(keyframeTimesMs(frames, [1])).toBeUndefined();
+  });
+});
@@ -0,0 +1,174 @@
+import { fork } from 'node:child_process';
+import {
+  mkdtemp,
+  readdir,
+  readFile,
+  rename,
+  rm,
+  utimes,
+  writeFile,
+} from 'node:fs/promises';
+import { tmpdir } from 'node:os';
+import { join } from 'node:path';
+import { fileURLToPath } from 'node:url';
+import { afterEach, beforeEach, describe, expect, it } from 'vitest';
+import {
+  enqueueSpoolJob,
+  getSpoolStatus,
+  requeueExpiredLeases,
+  runSpoolWorker,
+  type SpoolConverter,
+  type SpoolWorkerResult,
+} from '../spool.js';
+
+const WORKER = fileURLToPath(
+  new URL('./fixtures/spool-worker.ts', import.meta.url),
+);
+
+// Runs fixtures/spool-worker.ts in its own process, logging jobs to logPath
+function forkWorker(dir: string, logPath: string) {
+  return new Promise<SpoolWorkerResult>((resolve, reject) => {
+    let result: SpoolWorkerResult | undefined;
+    const child = fork(WORKER, [dir, logPath], {
+      execArgv: ['--experimental-strip-types', '--no-warnings'],
+    });
+    child.on('message', (message) => {
+      result = message as SpoolWorkerResult;
+    });
+    child.on('error', reject);
+    child.on('exit', (code) => {
+      if (code === 0 && result) {
+        resolve(result);
+      } else {
+        reject(new Error(`Spool worker exited with code ${code}`));
+      }
+    });
+  });
+}
+
+// Stands in for the WASM converter: "converts" by reversing the bytes
+function fakeConverter(calls: string[], delayMs = 5): SpoolConverter {
+  return async (gif) => {
+    calls.push(Buffer.from(gif).toString());
+    await new Promise((resolve) => setTimeout(resolve, delayMs));
+    return new Uint8Array(gif).reverse();
+  };
+}
+
+describe('Spool queue', () => {
+  let dir: string;
+
+  beforeEach(async () => {
+    dir = await mkdtemp(join(tmpdir(), 'gif2vid-spool-'));
+  });
+
+  afterEach(async () => {
+    await rm(dir, { force: true, recursive: true });
+  });
+
+  it('should run each job once across worker processes', async () => {
+    const ids: string[] = [];
+    for (let i = 0; i < 24; i++) {
+      ids.push(await enqueueSpoolJob(dir, Buffer.from(`gif-${i}`)));
+    }
+
+    const logPaths = Array.from({ length: 4 }, (_, i) =>
+      join(dir, `worker-${i}.log`),
+    );
+    const results = await Promise.all(
+      logPaths.map((logPath) => forkWorker(dir, logPath)),
+    );
+
+    const calls: string[] = [];
+    for (const logPath of logPaths) {
+      const log = await readFile(logPath, 'utf8').catch(() => '');
+      calls.push(...log.split('\n').filter(Boolean));
+    }
+    expect(results.reduce((sum, r) => sum + r.completed, 0)).toBe(24);
+    expect(calls.sort()).toEqual(
+      Array.from({ length: 24 }, (_, i) => `gif-${i}`).sort(),
+    );
+    expect(await getSpoolStatus(dir)).toEqual({
+      done: 24,
+      failed: 0,
+      leased: 0,
+      queued: 0,
+    });
+    const output = await readFile(join(dir, 'out', `${ids[3]}.mp4`));
+    expect(output.toString()).toBe('3-fig');
+    expect(
+      (await readdir(join(dir, 'out'))).filter((f) => f.endsWith('.tmp')),
+    ).toEqual([]);
+    expect(await readdir(join(dir, 'jobs'))).toEqual([]);
+  });
+
+  it('should re-queue leases that stop heartbeating', async () => {
+    const id = await enqueueSpoolJob(dir, Buffer.from('gif'), { fps: 12 });
+
+    // A worker that crashed after claiming the job
+    const leasePath = join(dir, 'leases', `${id}~crashed.json`);
+    await rename(join(dir, 'queue', `${id}.json`), leasePath);
+    expect(await requeueExpiredLeases(dir, 60_000)).toBe(0);
+
+    const past = new Date(Date.now() - 10_000);
+    await utimes(leasePath, past, past);
+    expect(await requeueExpiredLeases(dir, 1_000)).toBe(1);
+
+    const calls: string[] = [];
+    const result = await runSpoolWorker(dir, {
+      convert: fakeConverter(calls),
+      drain: true,
+      leaseMs: 1_000,
+      pollMs: 5,
+    });
+    expect(result).toEqual({ completed: 1, failed: 0 });
+
+    const manifest = JSON.parse(
+      await readFile(join(dir, 'done', `${id}.json`), 'utf8'),
+    );
+    expect(manifest).toEqual({ attempts: 1, id, options: { fps: 12 } });
+  });
+
+  it('should move jobs that fail to convert to failed/', async () => {
+    const id = await enqueueSpoolJob(dir, Buffer.from('not a gif'));
+
+    const result = await runSpoolWorker(dir, {
+      convert: async () => {
+        throw new Error('Invalid GIF');
+      },
+      drain: true,
+      pollMs: 5,
+    });
+    expect(result).toEqual({ completed: 0, failed: 1 });
+
+    const manifest = JSON.parse(
+      await readFile(join(dir, 'failed', `${id}.json`), 'utf8'),
+    );
+    expect(manifest.error).toBe('Invalid GIF');
+    expect(await getSpoolStatus(dir)).toMatchObject({ leased: 0, queued: 0 });
+    expect(await readdir(join(dir, 'jobs'))).toEqual([]);
+  });
+
+  it('should fail jobs whose leases keep expiring', async () => {
+    const id = await enqueueSpoolJob(dir, Buffer.from('gif'));
+    const queuedPath = join(dir, 'queue', `${id}.json`);
+    const manifest = JSON.parse(await readFile(queuedPath, 'utf8'));
+    await writeFile(queuedPath, JSON.stringify({ ...manifest, attempts: 3 }));
+
+    const calls: string[] = [];
+    const result = await runSpoolWorker(dir, {
+      convert: fakeConverter(calls),
+      drain: true,
+      maxAttempts: 3,
+      pollMs: 5,
+    });
+    expect(result).toEqual({ completed: 0, failed: 1 });
+    expect(calls).toEqual([]);
+  });
+
+  it('should reject ids that are unsafe as file names', async () => {
+    await expect(
+      enqueueSpoolJob(dir, Buffer.from('gif'), {}, '../escape'),
+    ).rejects.toThrow(/Invalid spool job id/);
+  });
+});
@@ -0,0 +1,97 @@
+import { describe, expect, it } from 'vitest';
+import type { EncoderTrialResult } from '../index.js';
+import {
+  expandSweepGrid,
+  formatSweepReport,
+  paretoFrontier,
+  summarizeSweep,
+  type SweepGrid,
+} from '../sweep.js';
+
+function result(
+  crf: number,
+  bytes: number,
+  encodeMs: number,
+  ssim: number,
+): EncoderTrialResult {
+  return {
+    backend: 'ffmpeg',
+    bytes,
+    codec: 'h264',
+    crf,
+    encodeMs,
+    preset: 'medium',
+    psnr: 40,
+    scale: 1,
+    ssim,
+  };
+}
+
+describe('Encoder sweep', () => {
+  it('should only expand settings the installed backends can run', () => {
+    const grid: SweepGrid = {
+      codecs: ['h264', 'av1'],
+      crfs: [20, 30],
+      presets: ['fast'],
+      scales: [1, 0.5],
+    };
+    const trials = expandSweepGrid(grid, {
+      codecs: new Set(['h264']),
+      wasmEncoder: true,
+    });
+
+    // 2 crfs x 2 scales through ffmpeg, plus the WASM encoder at scale 1
+    expect(trials).toHaveLength(6);
+    expect(trials.every((trial) => trial.codec === 'h264')).toBe(true);
+    expect(
+      trials
+        .filter((trial) => trial.backend === 'wasm-encoder')
+        .map((trial) => trial.scale),
+    ).toEqual([1, 1]);
+  });
+
+  it('should keep only points no other point dominates', () => {
+    const small = result(30, 100, 50, 0.9);
+    const fast = result(26, 200, 10, 0.95);
+    const sharp = result(18, 400, 60, 0.99);
+    const dominated = result(23, 300, 70, 0.94);
+    const tie = result(27, 200, 10, 0.95);
+
+    expect(paretoFrontier([small, fast, sharp, dominated, tie])).toEqual([
+      small,
+      fast,
+      sharp,
+      tie,
+    ]);
+  });
+
+  it('should total each setting over the corpus', () => {
+    const summary = summarizeSweep([
+      [result(20, 300, 40, 0.98), result(30, 100, 20, 0.9)],
+      [result(20, 500, 60, 0.96), result(30, 200, 30, 0.8)],
+    ]);
+
+    expect(summary[0]).toMatchObject({
+      bytes: 800,
+      crf: 20,
+      encodeMs: 100,
+      minSsim: 0.96,
+      pareto: true,
+    });
+    expect(summary[0].ssim).toBeCloseTo(0.97);
+    expect(summary[1]).toMatchObject({ bytes: 300, pareto: true });
+
+    const report = formatSweepReport({
+      failed: [],
+      files: ['a', 'b'],
+      summary,
+    });
+    expect(report.split('\n')[0]).toBe('2 GIFs, 2 settings');
+    // Smallest first
+    expect(report).toMatch(/\| \* \| ffmpeg \| h264 \| medium \| 30 \|/);
+  });
+
+  it('should summarise an empty corpus as no settings', () => {
+    expect(summarizeSweep([])).toEqual([]);
+  });
+});
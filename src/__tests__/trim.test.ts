@@ -0,0 +1,41 @@
+import { readFile } from 'node:fs/promises';
+import { describe, expect, it } from 'vitest';
+import { decodeGif } from '../gif-decoder.js';
+
+describe('Time range trimming', () => {
+  it('should return only the frames in range with clipped delays', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    const full = decodeGif(gif);
+    const totalMs = full.frames.reduce((sum, frame) => sum + frame.delay, 0);
+
+    const startMs = Math.floor(totalMs / 4);
+    const endMs = Math.floor((totalMs * 3) / 4);
+    const clip = decodeGif(gif, { endMs, startMs });
+
+    expect(clip.frames.length).toBeGreaterThan(0);
+    expect(clip.frames.length).toBeLessThanOrEqual(full.frames.length);
+    expect(clip.frames.reduce((sum, frame) => sum + frame.delay, 0)).toBe(
+      endMs - startMs,
+    );
+
+    // The last frame in range is composited exactly as in a full decode
+    let time = 0;
+    let lastIndex = 0;
+    for (let i = 0; i < full.frames.length && time < endMs; i++) {
+      lastIndex = i;
+      time += full.frames[i].delay;
+    }
+    expect(
+      Buffer.from(clip.frames[clip.frames.length - 1].data).equals(
+        full.frames[lastIndex].data,
+      ),
+    ).toBe(true);
+  });
+
+  it('should reject ranges with no frames', async () => {
+    const gif = await readFile('./tests/images/test1.gif');
+    expect(() => decodeGif(gif, { startMs: Number.MAX_SAFE_INTEGER })).toThrow(
+      /No frames/,
+    );
+  });
+});
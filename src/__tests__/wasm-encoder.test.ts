@@ -0,0 +1,12 @@
+import { describe, expect, it } from 'vitest';
+import { cropI420, i420Size } from '../wasm-module.js';
+
+describe('In-process H.264 input', () => {
+  it('should crop odd I420 frames to even dimensions plane by plane', () => {
+    // 3x3 frame: 9 luma samples, then 2x2 chroma planes
+    const frame = new Uint8Array(i420Size(3, 3)).map((_, index) => index);
+    const cropped = cropI420(frame, 3, 3, 2, 2, new Uint8Array(i420Size(2, 2)));
+
+    expect([...cropped]).toEqual([0, 1, 3, 4, 9, 13]);
+  });
+});
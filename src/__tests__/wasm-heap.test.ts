@@ -0,0 +1,76 @@
+import { describe, expect, it } from 'vitest';
+import {
+  acquireWasmModule,
+  getWasmHeapStats,
+  releaseWasmModule,
+  setWasmHeapPolicy,
+  type WasmModule,
+} from '../wasm-module.js';
+
+const MB = 1024 * 1024;
+
+// Pooling only looks at the heap, so a stand-in instance is enough
+function fakeModule(heapBytes: number): WasmModule {
+  return { HEAPU8: new Uint8Array(heapBytes) } as unknown as WasmModule;
+}
+
+describe('WASM heap pool', () => {
+  it('should hand out the smallest idle instance that fits', async () => {
+    const small = fakeModule(16 * MB);
+    const large = fakeModule(64 * MB);
+    const larger = fakeModule(128 * MB);
+    releaseWasmModule(larger);
+    releaseWasmModule(small);
+    releaseWasmModule(large);
+
+    expect(await acquireWasmModule(40 * MB)).toBe(large);
+    expect(await acquireWasmModule(MB)).toBe(small);
+    expect(await acquireWasmModule(100 * MB)).toBe(larger);
+  });
+
+  it('should recycle instances whose heap grew past the threshold', () => {
+    setWasmHeapPolicy({ recycleBytes: 32 * MB });
+    const before = getWasmHeapStats();
+
+    releaseWasmModule(fakeModule(48 * MB));
+    releaseWasmModule(fakeModule(8 * MB));
+
+    const after = getWasmHeapStats();
+    expect(after.recycledInstances).toBe(before.recycledInstances + 1);
+    expect(after.idleInstances).toBe(before.idleInstances + 1);
+    expect(after.highWaterBytes).toBeGreaterThanOrEqual(48 * MB);
+  });
+
+  it('should drop instances left idle past the idle timeout', () => {
+    releaseWasmModule(fakeModule(8 * MB));
+    expect(getWasmHeapStats().idleInstances).toBeGreaterThan(0);
+
+    setWasmHeapPolicy({ idleMs: -1 });
+    expect(getWasmHeapStats().idleInstances).toBe(0);
+    expect(getWasmHeapStats().idleHeapBytes).toBe(0);
+  });
+
+  it('should drop idle instances without further pool traffic', async () => {
+    setWasmHeapPolicy({ idleMs: 20 });
+    releaseWasmModule(fakeModule(8 * MB));
+    await new Promise((resolve) => setTimeout(resolve, 60));
+
+    // A long timeout now would keep the instance, had the timer not run
+    setWasmHeapPolicy({ idleMs: 60_000 });
+    expect(getWasmHeapStats().idleInstances).toBe(0);
+  });
+
+  it('should cap the heap held by idle instances', async () => {
+    setWasmHeapPolicy({ idleMs: 60_000, maxIdleBytes: 40 * MB });
+    const oldest = fakeModule(16 * MB);
+    releaseWasmModule(oldest);
+    releaseWasmModule(fakeModule(16 * MB));
+    releaseWasmModule(fakeModule(16 * MB));
+
+    expect(getWasmHeapStats()).toMatchObject({
+      idleHeapBytes: 32 * MB,
+      idleInstances: 2,
+    });
+    expect(await acquireWasmModule(MB)).not.toBe(oldest);
+  });
+});
@@ -0,0 +1,76 @@
+/**
+ * Cancellation helpers shared by every stage of the conversion pipeline
+ * Works in both Node.js and browser environments
+ */
+
+export interface CancellationOptions {
+  deadlineMs?: number; // Abort the conversion after this many milliseconds
+  signal?: AbortSignal; // Abort the conversion when this signal fires
+}
+
+interface Deadline {
+  at: number; // performance.now() time
+  expire: () => void;
+}
+
+// Deadlines of job signals. The timeout only fires when the event loop gets
+// a turn, which decoding and muxing loops do not give it, so throwIfAborted
+// also compares the clock against the deadline itself.
+const deadlines = new WeakMap<AbortSignal, Deadline>();
+
+/**
+ * Combine a caller's signal and deadline into a single signal for one job
+ * Returns undefined when the job cannot be cancelled.
+ */
+export function createJobSignal(
+  options: CancellationOptions,
+): AbortSignal | undefined {
+  const { deadlineMs, signal } = options;
+  if (deadlineMs === undefined) {
+    return signal;
+  }
+
+  const timeoutMs = Math.max(0, deadlineMs);
+  const expired = new AbortController();
+  const sources = [AbortSignal.timeout(timeoutMs), expired.signal];
+  const jobSignal = AbortSignal.any(signal ? [signal, ...sources] : sources);
+  deadlines.set(jobSignal, {
+    at: performance.now() + timeoutMs,
+    // The same reason AbortSignal.timeout gives, for isDeadlineAbort
+    expire: () =>
+      expired.abort(
+        new DOMException(
+          'The operation was aborted due to timeout',
+          'TimeoutError',
+        ),
+      ),
+  });
+  return jobSignal;
+}
+
+/**
+ * Throw the signal's abort reason if it has fired, or if its job deadline
+ * has passed
+ */
+export function throwIfAborted(signal?: AbortSignal): void {
+  if (signal && !signal.aborted) {
+    const deadline = deadlines.get(signal);
+    if (deadline && performance.now() >= deadline.at) {
+      deadline.expire();
+    }
+  }
+  if (signal?.aborted) {
+    throw signal.reason ?? new Error('Conversion aborted');
+  }
+}
+
+/**
+ * True when the signal fired because its deadline passed
+ * (AbortSignal.timeout aborts with a DOMException named TimeoutError)
+ */
+export function isDeadlineAbort(signal?: AbortSignal): boolean {
+  return (
+    !!signal?.aborted &&
+    (signal.reason as Error | undefined)?.name === 'TimeoutError'
+  );
+}
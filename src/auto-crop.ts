@@ -0,0 +1,200 @@
+/**
+ * Static border detection and cropping
+ * The region that changes over the animation is the union of every pixel
+ * that differs from the frame before it. Margins outside it never change,
+ * so the canvas is cropped to that region before encoding. Frames are
+ * cropped as views with the original stride, and the converter only copies
+ * the rows and columns it reads. Works in both Node.js and browser
+ * environments.
+ */
+
+import { pixelSize, type PixelFrame } from './wasm-module.js';
+
+// 'even' keeps 4:2:0 chroma aligned; 'macroblock' aligns to the 16x16
+// blocks H.264 codes, so no partial block is spent on the edge
+export type CropAlignment = 'even' | 'macroblock';
+
+export interface CropRect {
+  height: number;
+  width: number;
+  x: number;
+  y: number;
+}
+
+/**
+ * Accumulates the region that changes between consecutive frames
+ */
+export class DirtyRegion {
+  private readonly height: number;
+  private previous: PixelFrame | undefined;
+  private readonly width: number;
+  private x0: number;
+  private x1 = 0;
+  private y0: number;
+  private y1 = 0;
+
+  constructor(width: number, height: number) {
+    this.width = width;
+    this.height = height;
+    this.x0 = width;
+    this.y0 = height;
+  }
+
+  add(frame: PixelFrame): void {
+    const previous = this.previous;
+    this.previous = frame;
+    if (!previous) {
+      return;
+    }
+    if (
+      (previous.format ?? 'rgba') !== (frame.format ?? 'rgba') ||
+      previous.palette !== frame.palette
+    ) {
+      // Nothing can be told apart without converting; treat it all as changed
+      this.include(0, 0, this.width, this.height);
+      return;
+    }
+
+    const size = pixelSize(frame.format);
+    const rowBytes = this.width * size;
+    const a = previous.data;
+    const b = frame.data;
+    const strideA = previous.stride ?? previous.width * size;
+    const strideB = frame.stride ?? frame.width * size;
+
+    for (let y = 0; y < this.height; y++) {
+      const rowA = y * strideA;
+      const rowB = y * strideB;
+
+      if (y < this.y0 || y >= this.y1) {
+        // Outside the region so far: find the first and last change
+        let left = 0;
+        while (left < rowBytes && a[rowA + left] === b[rowB + left]) {
+          left++;
+        }
+        if (left === rowBytes) {
+          continue;
+        }
+        let right = rowBytes - 1;
+        while (a[rowA + right] === b[rowB + right]) {
+          right--;
+        }
+        this.include(
+          Math.floor(left / size),
+          y,
+          Math.floor(right / size) + 1,
+          y + 1,
+        );
+        continue;
+      }
+
+      // Inside it, only the columns either side can widen the region
+      const leftEnd = this.x0 * size;
+      for (let i = 0; i < leftEnd; i++) {
+        if (a[rowA + i] !== b[rowB + i]) {
+          this.x0 = Math.floor(i / size);
+          break;
+        }
+      }
+      const rightStart = this.x1 * size;
+      for (let i = rowBytes - 1; i >= rightStart; i--) {
+        if (a[rowA + i] !== b[rowB + i]) {
+          this.x1 = Math.floor(i / size) + 1;
+          break;
+        }
+      }
+    }
+  }
+
+  /**
+   * The region that changed, or undefined if no frame differed from the one
+   * before it
+   */
+  bounds(): CropRect | undefined {
+    if (this.x0 >= this.x1 || this.y0 >= this.y1) {
+      return undefined;
+    }
+    return {
+      height: this.y1 - this.y0,
+      width: this.x1 - this.x0,
+      x: this.x0,
+      y: this.y0,
+    };
+  }
+
+  private include(x0: number, y0: number, x1: number, y1: number): void {
+    this.x0 = Math.min(this.x0, x0);
+    this.y0 = Math.min(this.y0, y0);
+    this.x1 = Math.max(this.x1, x1);
+    this.y1 = Math.max(this.y1, y1);
+  }
+}
+
+/**
+ * Grow a rectangle outwards to the alignment, staying inside the canvas
+ */
+export function alignCropRect(
+  rect: CropRect,
+  canvasWidth: number,
+  canvasHeight: number,
+  alignment: CropAlignment,
+): CropRect {
+  const unit = alignment === 'macroblock' ? 16 : 2;
+  const x = Math.floor(rect.x / unit) * unit;
+  const y = Math.floor(rect.y / unit) * unit;
+  const right = Math.min(
+    canvasWidth,
+    Math.ceil((rect.x + rect.width) / unit) * unit,
+  );
+  const bottom = Math.min(
+    canvasHeight,
+    Math.ceil((rect.y + rect.height) / unit) * unit,
+  );
+  return { height: bottom - y, width: right - x, x, y };
+}
+
+/**
+ * View a rectangle of a frame without copying it
+ */
+export function cropFrame<T extends PixelFrame>(frame: T, rect: CropRect): T {
+  const size = pixelSize(frame.format);
+  const stride = frame.stride ?? frame.width * size;
+  const offset = rect.y * stride + rect.x * size;
+  return {
+    ...frame,
+    data: frame.data.subarray(offset),
+    height: rect.height,
+    stride,
+    width: rect.width,
+  };
+}
+
+/**
+ * Crop frames to the region that changes across them. The canvas is kept
+ * when nothing changes, since then no margin can be told from content.
+ */
+export function autoCropFrames<T extends PixelFrame>(
+  frames: T[],
+  width: number,
+  height: number,
+  alignment: CropAlignment,
+): { frames: T[]; height: number; width: number } {
+  const region = new DirtyRegion(width, height);
+  for (const frame of frames) {
+    region.add(frame);
+  }
+
+  const bounds = region.bounds();
+  if (!bounds) {
+    return { frames, height, width };
+  }
+  const rect = alignCropRect(bounds, width, height, alignment);
+  if (rect.width === width && rect.height === height) {
+    return { frames, height, width };
+  }
+  return {
+    frames: frames.map((frame) => cropFrame(frame, rect)),
+    height: rect.height,
+    width: rect.width,
+  };
+}
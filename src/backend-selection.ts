@@ -0,0 +1,400 @@
+/**
+ * Throughput-calibrated choice of optimization backend
+ * Each available backend is timed on small synthetic encodes, giving it a
+ * fixed cost per job and a cost per megapixel-frame. Jobs are routed by
+ * size class (pixels x frames) to the backend predicted to finish first:
+ * small jobs favour an in-process encoder over spawning ffmpeg, large ones
+ * the faster native encoder. Calibration runs once per process and, in
+ * Node.js, is persisted to disk; a lock file next to the cache lets only one
+ * thread or process on the machine calibrate at a time, while the others
+ * keep to the order of preference until its results appear. Works in both
+ * Node.js and browser environments.
+ */
+
+import {
+  type EncodeWorkload,
+  presetCostFactor,
+  type X264Preset,
+} from './encoder-tuning.js';
+
+export type OptimizationBackend = 'ffmpeg' | 'wasm-encoder';
+
+export interface BackendCost {
+  fixedMs: number; // Start-up cost of a job (process spawn, encoder setup)
+  msPerMegapixelFrame: number; // At the 'medium' preset
+}
+
+export type BackendCosts = Partial<Record<OptimizationBackend, BackendCost>>;
+
+// Encodes a synthetic workload with a backend and returns the milliseconds
+// the optimization step took
+export type CalibrationRunner = (
+  backend: OptimizationBackend,
+  workload: EncodeWorkload,
+) => Promise<number>;
+
+export interface CalibrationOptions {
+  cacheDir?: string | null; // Where to persist results; null disables
+  cacheKey?: string; // Identifies the backends' versions on this machine
+}
+
+// A tiny encode measures the fixed cost, a larger one the throughput
+const CALIBRATION_WORKLOADS: EncodeWorkload[] = [
+  { frames: 4, height: 32, width: 32 },
+  { frames: 16, height: 256, width: 256 },
+];
+
+// Class 0 holds jobs up to 1/64 megapixel-frame; each class is 4x larger
+const SIZE_CLASS_COUNT = 12;
+const SMALLEST_CLASS_MPF = 1 / 64;
+
+// How far one real job moves the calibrated costs
+const TIMING_WEIGHT = 0.2;
+
+const CACHE_FILE = 'backend-calibration.json';
+const CACHE_VERSION = 1;
+
+// A calibration lock older than this was left by a crashed calibrator.
+// While another calibrator holds it, the cache is checked again this often.
+const LOCK_STALE_MS = 5 * 60_000;
+const LOCK_RETRY_MS = 10_000;
+
+let backendCosts: BackendCosts = {};
+let calibrationEnabled = false;
+let calibrationPromise: Promise<BackendCosts> | null = null;
+let calibratedBackends = '';
+let retryCalibrationAt = Infinity;
+
+/**
+ * Total pixels that go through the encoder for a workload, in megapixels
+ */
+function megapixelFrames({ frames, height, width }: EncodeWorkload): number {
+  return (width * height * frames) / 1_000_000;
+}
+
+/**
+ * Size class of a workload, by pixels x frames
+ */
+export function sizeClass(workload: EncodeWorkload): number {
+  const ratio = megapixelFrames(workload) / SMALLEST_CLASS_MPF;
+  const index = ratio > 1 ? Math.ceil(Math.log(ratio) / Math.log(4)) : 0;
+  return Math.min(SIZE_CLASS_COUNT - 1, index);
+}
+
+/**
+ * Predicted milliseconds for a backend to encode mpf megapixel-frames
+ */
+function predictMs(
+  backend: OptimizationBackend,
+  mpf: number,
+  preset: X264Preset,
+): number {
+  const cost = backendCosts[backend];
+  if (!cost) {
+    return Infinity;
+  }
+  const work = mpf * presetCostFactor(preset);
+  return cost.fixedMs + work * cost.msPerMegapixelFrame;
+}
+
+/**
+ * Predicted milliseconds for a backend to optimize a workload, or Infinity
+ * if the backend has not been calibrated
+ */
+export function predictBackendMs(
+  backend: OptimizationBackend,
+  workload: EncodeWorkload,
+  preset: X264Preset = 'medium',
+): number {
+  return predictMs(backend, megapixelFrames(workload), preset);
+}
+
+/**
+ * Fastest backend for the workload's size class
+ * Candidates are in order of preference, and the first is used until the
+ * backends are calibrated. Within a class every job takes the same route,
+ * judged at the middle of the class.
+ */
+export function selectBackend(
+  workload: EncodeWorkload,
+  candidates: OptimizationBackend[],
+  preset: X264Preset = 'medium',
+): OptimizationBackend {
+  const mpf = SMALLEST_CLASS_MPF * 4 ** (sizeClass(workload) - 0.5);
+
+  let best = candidates[0];
+  let bestMs = predictMs(best, mpf, preset);
+  for (const candidate of candidates.slice(1)) {
+    const ms = predictMs(candidate, mpf, preset);
+    if (ms < bestMs) {
+      best = candidate;
+      bestMs = ms;
+    }
+  }
+  return best;
+}
+
+/**
+ * Time each backend on the calibration workloads and fit its costs
+ * Every backend is warmed up first so that module loading and first-run
+ * compilation are not counted, and each workload keeps its faster run.
+ */
+async function measureBackends(
+  backends: OptimizationBackend[],
+  run: CalibrationRunner,
+): Promise<BackendCosts> {
+  const costs: BackendCosts = {};
+  const [small, large] = CALIBRATION_WORKLOADS;
+  for (const backend of backends) {
+    try {
+      await run(backend, small);
+      const timeOf = async (workload: EncodeWorkload) =>
+        Math.min(await run(backend, workload), await run(backend, workload));
+      const smallMs = await timeOf(small);
+      const largeMs = await timeOf(large);
+
+      const perMpf = Math.max(
+        0,
+        (largeMs - smallMs) /
+          (megapixelFrames(large) - megapixelFrames(small)),
+      );
+      costs[backend] = {
+        fixedMs: Math.max(0, smallMs - perMpf * megapixelFrames(small)),
+        msPerMegapixelFrame: perMpf,
+      };
+    } catch {
+      // A backend that cannot encode is left uncalibrated, so never chosen
+      // over one that can
+    }
+  }
+  return costs;
+}
+
+/**
+ * Take the calibration lock, clearing one left by a crashed calibrator
+ * Returns a release function, or null if another calibrator holds it.
+ */
+async function acquireCalibrationLock(
+  lockPath: string,
+): Promise<(() => Promise<void>) | null> {
+  const { open, stat, unlink } = await import('node:fs/promises');
+  for (let attempt = 0; attempt < 2; attempt++) {
+    try {
+      const handle = await open(lockPath, 'wx');
+      await handle.close();
+      return () => unlink(lockPath).catch(() => {});
+    } catch (error) {
+      if ((error as NodeJS.ErrnoException).code !== 'EEXIST') {
+        throw error;
+      }
+    }
+    try {
+      const { mtimeMs } = await stat(lockPath);
+      if (Date.now() - mtimeMs < LOCK_STALE_MS) {
+        return null;
+      }
+      await unlink(lockPath);
+    } catch {
+      // Released meanwhile; try again
+    }
+  }
+  return null;
+}
+
+/**
+ * Load calibrated costs from disk, or measure and store them
+ * Returns null when another thread or process is calibrating.
+ */
+async function loadCosts(
+  backends: OptimizationBackend[],
+  run: CalibrationRunner,
+  options: CalibrationOptions,
+): Promise<BackendCosts | null> {
+  if (typeof window !== 'undefined' || options.cacheDir === null) {
+    return measureBackends(backends, run);
+  }
+
+  const { mkdir, readFile, rename, writeFile } = await import(
+    'node:fs/promises'
+  );
+  const { randomBytes } = await import('node:crypto');
+  const { join } = await import('node:path');
+  const { defaultCacheDir } = await import('./ffmpeg-registry.js');
+
+  const cacheDir = options.cacheDir ?? (await defaultCacheDir());
+  const cachePath = join(cacheDir, CACHE_FILE);
+  const key = `${backends.join(',')}:${options.cacheKey ?? ''}`;
+
+  const readCache = async (): Promise<Record<string, BackendCosts>> => {
+    try {
+      const stored = JSON.parse(await readFile(cachePath, 'utf8'));
+      if (stored.version === CACHE_VERSION) {
+        return stored.entries;
+      }
+    } catch {
+      // Missing or corrupt cache - calibrate again
+    }
+    return {};
+  };
+
+  const cached = (await readCache())[key];
+  if (cached) {
+    return cached;
+  }
+
+  // A cache dir that cannot be written (read-only HOME, say) is treated
+  // like cacheDir: null - measure, just without persisting or locking
+  let release: (() => Promise<void>) | null;
+  try {
+    await mkdir(cacheDir, { recursive: true });
+    release = await acquireCalibrationLock(`${cachePath}.lock`);
+  } catch {
+    return measureBackends(backends, run);
+  }
+  if (!release) {
+    return null;
+  }
+  try {
+    const costs = await measureBackends(backends, run);
+    try {
+      // Write then rename so concurrent writers never see a partial file;
+      // threads share a pid, so the temporary name needs more than that
+      const suffix = `${process.pid}-${randomBytes(4).toString('hex')}`;
+      const tempPath = `${cachePath}.${suffix}.tmp`;
+      await writeFile(
+        tempPath,
+        JSON.stringify({
+          entries: { ...(await readCache()), [key]: costs },
+          version: CACHE_VERSION,
+        }),
+      );
+      await rename(tempPath, cachePath);
+    } catch {
+      // Persisting is an optimisation only
+    }
+    return costs;
+  } finally {
+    await release();
+  }
+}
+
+/**
+ * Calibrate the given backends (at most once per process for the same set)
+ * If another thread or process is already calibrating them, resolves with
+ * the current (possibly empty) costs and looks for its results on a call
+ * LOCK_RETRY_MS later.
+ */
+export function calibrateBackends(
+  backends: OptimizationBackend[],
+  run: CalibrationRunner,
+  options: CalibrationOptions = {},
+): Promise<BackendCosts> {
+  const id = backends.join(',');
+  if (
+    !calibrationPromise ||
+    calibratedBackends !== id ||
+    Date.now() >= retryCalibrationAt
+  ) {
+    calibratedBackends = id;
+    retryCalibrationAt = Infinity;
+    const promise = loadCosts(backends, run, options).then(
+      (costs) => {
+        if (!costs) {
+          retryCalibrationAt = Date.now() + LOCK_RETRY_MS;
+          return backendCosts;
+        }
+        backendCosts = costs;
+        return costs;
+      },
+      (error) => {
+        // Let the next call try again rather than repeat this failure
+        if (calibrationPromise === promise) {
+          calibrationPromise = null;
+        }
+        throw error;
+      },
+    );
+    calibrationPromise = promise;
+  }
+  return calibrationPromise;
+}
+
+/**
+ * Feed a real job's time back into its backend's costs. Both terms move
+ * together, keeping the calibrated split between fixed and per-pixel cost.
+ */
+export function recordBackendTiming(
+  backend: OptimizationBackend,
+  workload: EncodeWorkload,
+  preset: X264Preset,
+  elapsedMs: number,
+): void {
+  const cost = backendCosts[backend];
+  const predictedMs = predictBackendMs(backend, workload, preset);
+  if (!cost || !(predictedMs > 0) || !(elapsedMs > 0)) {
+    return;
+  }
+
+  // One slow job (a busy machine, a cold cache) should not flip routes
+  const ratio = Math.min(4, Math.max(0.25, elapsedMs / predictedMs));
+  const scale = 1 + (ratio - 1) * TIMING_WEIGHT;
+  backendCosts[backend] = {
+    fixedMs: cost.fixedMs * scale,
+    msPerMegapixelFrame: cost.msPerMegapixelFrame * scale,
+  };
+}
+
+/**
+ * Synthetic RGBA frames for a calibration workload: a gradient with a
+ * moving block, so encoders see both flat areas and motion
+ */
+export function syntheticFrames({
+  frames,
+  height,
+  width,
+}: EncodeWorkload): Array<{
+  data: Uint8Array;
+  delay: number;
+  height: number;
+  width: number;
+}> {
+  const block = Math.max(2, Math.floor(Math.min(width, height) / 4));
+  return Array.from({ length: frames }, (_, index) => {
+    const data = new Uint8Array(width * height * 4);
+    const offset = (index * 3) % Math.max(1, width - block);
+    for (let y = 0; y < height; y++) {
+      for (let x = 0; x < width; x++) {
+        const i = (y * width + x) * 4;
+        const inBlock = x >= offset && x < offset + block && y < block;
+        data[i] = inBlock ? 255 : (x * 255) / width;
+        data[i + 1] = inBlock ? 40 : (y * 255) / height;
+        data[i + 2] = 128;
+        data[i + 3] = 255;
+      }
+    }
+    return { data, delay: 100, height, width };
+  });
+}
+
+/**
+ * Allow jobs to start the background calibration encodes. Off by default,
+ * so that a one-shot conversion does not keep its process alive timing
+ * backends; long-running processes such as the daemon turn it on.
+ */
+export function setBackendCalibration(enabled: boolean): void {
+  calibrationEnabled = enabled;
+}
+
+export function isBackendCalibrationEnabled(): boolean {
+  return calibrationEnabled;
+}
+
+/**
+ * Forget calibration (for tests)
+ */
+export function resetBackendCalibration(costs: BackendCosts = {}): void {
+  backendCosts = costs;
+  calibrationPromise = null;
+  calibratedBackends = '';
+  retryCalibrationAt = Infinity;
+}
@@ -0,0 +1,109 @@
+/**
+ * Pool of reusable byte buffers for per-conversion scratch space
+ * Buffers are kept in power-of-two size classes, so a steady stream of
+ * similar conversions stops allocating backing stores once the pool is
+ * warm. Only buffers the pool handed out are taken back. Works in both
+ * Node.js and browser environments.
+ */
+
+export interface BufferPoolStats {
+  idleBuffers: number;
+  idleBytes: number;
+}
+
+// Smallest size class (4KB); smaller requests share it
+const MIN_CLASS = 12;
+
+let maxIdleBytes = 64 * 1024 * 1024;
+let idleBytes = 0;
+const freeLists = new Map<number, ArrayBuffer[]>();
+const owned = new WeakSet<ArrayBuffer>();
+const idle = new WeakSet<ArrayBuffer>();
+
+/**
+ * Size class holding buffers of at least size bytes
+ */
+function sizeClass(size: number): number {
+  return Math.max(MIN_CLASS, Math.ceil(Math.log2(size)));
+}
+
+/**
+ * Take a buffer of size bytes from the pool, allocating one if none of its
+ * size class is idle. Its contents are undefined.
+ */
+export function acquireBuffer(size: number): Uint8Array {
+  if (size <= 0) {
+    return new Uint8Array(0);
+  }
+  const cls = sizeClass(size);
+  let buffer = freeLists.get(cls)?.pop();
+  if (buffer) {
+    idle.delete(buffer);
+    idleBytes -= buffer.byteLength;
+  } else {
+    buffer = new ArrayBuffer(2 ** cls);
+    owned.add(buffer);
+  }
+  return new Uint8Array(buffer, 0, size);
+}
+
+/**
+ * Hand a buffer from acquireBuffer back to the pool. The caller must not
+ * use it afterwards. Buffers the pool did not allocate, and buffers that
+ * would take the pool over its limit, are left to the garbage collector.
+ */
+export function releaseBuffer(view: Uint8Array): void {
+  const buffer = view.buffer as ArrayBuffer;
+  if (!owned.has(buffer) || idle.has(buffer)) {
+    return;
+  }
+  if (idleBytes + buffer.byteLength > maxIdleBytes) {
+    return;
+  }
+  const cls = Math.log2(buffer.byteLength);
+  let list = freeLists.get(cls);
+  if (!list) {
+    list = [];
+    freeLists.set(cls, list);
+  }
+  list.push(buffer);
+  idle.add(buffer);
+  idleBytes += buffer.byteLength;
+}
+
+/**
+ * Change how many bytes of idle buffers the pool may hold, dropping idle
+ * buffers over the new limit
+ */
+export function setBufferPoolLimit(bytes: number): void {
+  maxIdleBytes = Math.max(0, bytes);
+  for (const [cls, list] of [...freeLists].sort(([a], [b]) => b - a)) {
+    while (idleBytes > maxIdleBytes && list.length > 0) {
+      const buffer = list.pop() as ArrayBuffer;
+      idle.delete(buffer);
+      idleBytes -= buffer.byteLength;
+    }
+    if (list.length === 0) {
+      freeLists.delete(cls);
+    }
+  }
+}
+
+/**
+ * What the pool is holding
+ */
+export function getBufferPoolStats(): BufferPoolStats {
+  let idleBuffers = 0;
+  for (const list of freeLists.values()) {
+    idleBuffers += list.length;
+  }
+  return { idleBuffers, idleBytes };
+}
+
+/**
+ * Drop every idle buffer (for tests)
+ */
+export function resetBufferPool(): void {
+  freeLists.clear();
+  idleBytes = 0;
+}
@@ -8,10 +8,13 @@
  *   gif2vid input.gif ./output-folder/
  *   gif2vid input.gif output  # Will create output.mp4
  *   npx gif2vid input.gif output.mp4
+ *   gif2vid --daemon [--workers 4]  # Framed requests on stdin, see daemon.ts
+ *   gif2vid --spool ./queue [--workers 4]  # Spool queue worker, see spool.ts
+ *   gif2vid --sweep ./corpus  # Encoder settings report, see sweep.ts
  */
 import { stat } from 'node:fs/promises';
 import { resolve } from 'node:path';
-import { printCompatInfo } from './ffmpeg.js';
+import { printCompatInfo, type VideoCodec } from './ffmpeg.js';
 import { convertFile } from './index.js';
 
 const args = process.argv.slice(2);
@@ -22,6 +25,102 @@ if (args.includes('--compat')) {
   process.exit(0);
 }
 
+const workersIndex = args.indexOf('--workers');
+const workers =
+  workersIndex !== -1 && args[workersIndex + 1]
+    ? parseInt(args[workersIndex + 1], 10)
+    : undefined;
+if (workers !== undefined && !(workers > 0)) {
+  console.error('--workers must be a positive number');
+  process.exit(1);
+}
+
+// Handle --daemon flag
+if (args.includes('--daemon')) {
+  const { runDaemon } = await import('./daemon.js');
+  try {
+    await runDaemon({ workers });
+    process.exit(0);
+  } catch (error) {
+    console.error('gif2vid daemon failed:', (error as Error).message);
+    process.exit(1);
+  }
+}
+
+// Handle --spool flag
+const spoolIndex = args.indexOf('--spool');
+if (spoolIndex !== -1) {
+  const dir = args[spoolIndex + 1];
+  if (!dir) {
+    console.error('--spool requires a directory');
+    process.exit(1);
+  }
+  const { runSpoolWorker } = await import('./spool.js');
+
+  // Stop claiming jobs on Ctrl+C / SIGTERM and finish the ones in flight
+  const controller = new AbortController();
+  process.once('SIGINT', () => controller.abort());
+  process.once('SIGTERM', () => controller.abort());
+  try {
+    const { completed, failed } = await runSpoolWorker(resolve(dir), {
+      concurrency: workers,
+      signal: controller.signal,
+    });
+    console.error(`gif2vid spool: ${completed} converted, ${failed} failed`);
+    process.exit(0);
+  } catch (error) {
+    console.error('gif2vid spool worker failed:', (error as Error).message);
+    process.exit(1);
+  }
+}
+
+// Handle --sweep flag
+const sweepIndex = args.indexOf('--sweep');
+if (sweepIndex !== -1) {
+  const path = args[sweepIndex + 1];
+  if (!path) {
+    console.error('--sweep requires a GIF or a directory of GIFs');
+    process.exit(1);
+  }
+  const { formatSweepReport, runEncoderSweep } = await import('./sweep.js');
+
+  // Comma-separated grid axes, e.g. --crfs 20,26,32
+  const list = (flag: string) => {
+    const index = args.indexOf(flag);
+    return index !== -1 && args[index + 1]
+      ? args[index + 1].split(',')
+      : undefined;
+  };
+  const numbers = (flag: string) => {
+    const values = list(flag)?.map(Number);
+    if (values?.some((n) => !Number.isFinite(n))) {
+      console.error(`${flag} takes comma-separated numbers`);
+      process.exit(1);
+    }
+    return values;
+  };
+
+  try {
+    const result = await runEncoderSweep([resolve(path)], {
+      codecs: list('--codecs') as VideoCodec[] | undefined,
+      crfs: numbers('--crfs'),
+      onError: (file, error) => console.error(`✗ ${file}: ${error.message}`),
+      onFile: (file) => console.error(`✓ ${file}`),
+      presets: list('--presets'),
+      scales: numbers('--scales'),
+    });
+    console.log(
+      args.includes('--json')
+        ? JSON.stringify(result, null, 2)
+        : formatSweepReport(result),
+    );
+    process.exit(0);
+  } catch (error) {
+    console.error('gif2vid sweep failed:', (error as Error).message);
+    process.exit(1);
+  }
+}
+
 // Handle --help flag
 if (args.length < 2 || args.includes('--help') || args.includes('-h')) {
   console.log('gif2vid - Convert GIF animations to MP4 videos');
@@ -35,12 +134,37 @@ if (args.length < 2 || args.includes('--help') || args.includes('-h')) {
   console.log('  gif2vid input.gif ./output-folder/');
   console.log('  gif2vid input.gif output  # Creates output.mp4');
   console.log('  gif2vid input.gif output.mp4 --fps 30  # Custom FPS');
+  console.log(
+    '  gif2vid --daemon --workers 4  # Serve framed requests on stdin/stdout',
+  );
+  console.log(
+    '  gif2vid --spool ./queue  # Take jobs from a shared spool directory',
+  );
+  console.log(
+    '  gif2vid --sweep ./corpus  # Compare encoder settings on some GIFs',
+  );
   console.log('');
   console.log('Options:');
   console.log('  --fps <number>     Frames per second (default: 10)');
   console.log(
     '  --compat           Check compatibility and available features',
   );
+  console.log(
+    '  --daemon           Run as a persistent daemon (framed stdin/stdout)',
+  );
+  console.log(
+    '  --spool <dir>      Run as a worker for a spool queue directory',
+  );
+  console.log(
+    '  --workers <number> Threads for --daemon / --spool (default: CPUs - 1)',
+  );
+  console.log(
+    '  --sweep <path>     Measure encoder settings on a GIF or directory',
+  );
+  console.log(
+    '    --codecs, --presets, --crfs, --scales  Comma-separated values',
+  );
+  console.log('    --json           Print the results as JSON');
   console.log('  --help, -h         Show this help message');
   console.log('');
   console.log('Note:');
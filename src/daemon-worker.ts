@@ -0,0 +1,40 @@
+/**
+ * Worker thread entry for the daemon's conversion pool
+ * Each worker keeps its own warm WASM instances between jobs.
+ */
+
+import { parentPort } from 'node:worker_threads';
+import {
+  convertGifBuffer,
+  type ConversionOptions,
+  setBackendCalibration,
+} from './index.js';
+
+if (!parentPort) {
+  throw new Error('daemon-worker must be run as a worker thread');
+}
+
+// Workers live long enough for calibrating the backends to pay off
+setBackendCalibration(true);
+
+const port = parentPort;
+
+port.on(
+  'message',
+  async ({ gif, options }: { gif: Uint8Array; options: ConversionOptions }) => {
+    try {
+      const mp4 = await convertGifBuffer(gif, options);
+
+      // Node Buffers may be views into a shared pool slab, which must not be
+      // transferred; copy those into a buffer of their own first.
+      const data =
+        mp4.byteOffset === 0 && mp4.byteLength === mp4.buffer.byteLength
+          ? new Uint8Array(mp4.buffer, 0, mp4.byteLength)
+          : new Uint8Array(mp4);
+
+      port.postMessage({ data, ok: true }, [data.buffer as ArrayBuffer]);
+    } catch (error) {
+      port.postMessage({ error: (error as Error).message, ok: false });
+    }
+  },
+);
@@ -0,0 +1,470 @@
+/**
+ * Persistent conversion daemon for non-JS callers
+ * Only available in Node.js
+ *
+ * Requests and responses are exchanged over stdin/stdout as pairs of
+ * length-prefixed frames. Every frame is a 4-byte big-endian length followed
+ * by that many bytes:
+ *
+ *   request:  [header: JSON { id, options? }] [payload: GIF bytes]
+ *   response: [header: JSON { id, ok, error? }] [payload: MP4 bytes]
+ *
+ * Responses are written as soon as their job finishes, so they may arrive in
+ * a different order than the requests. Callers match them up by `id`.
+ * A failed job gets `ok: false`, an `error` message and an empty payload.
+ */
+
+import { once } from 'node:events';
+import { availableParallelism } from 'node:os';
+import { Worker } from 'node:worker_threads';
+import type { ConversionOptions } from './index.js';
+
+// Guard against a desynchronised stream being read as a huge allocation
+const MAX_HEADER_BYTES = 1024 * 1024;
+const MAX_PAYLOAD_BYTES = 1024 * 1024 * 1024;
+
+// Stop reading requests while accepted GIFs awaiting a response exceed this,
+// or there are more than this many jobs per worker (one running, one queued)
+const MAX_IN_FLIGHT_BYTES = 256 * 1024 * 1024;
+const MAX_IN_FLIGHT_PER_WORKER = 2;
+
+export interface DaemonRequestHeader {
+  id: number | string;
+  options?: ConversionOptions;
+}
+
+export interface DaemonResponseHeader {
+  error?: string;
+  id: number | string;
+  ok: boolean;
+}
+
+export interface DaemonRequest {
+  gif: Uint8Array;
+  header: DaemonRequestHeader;
+}
+
+export type DaemonConverter = (
+  gif: Uint8Array,
+  options: ConversionOptions,
+) => Promise<Uint8Array>;
+
+export interface DaemonOptions {
+  convert?: DaemonConverter; // Default: a pool of conversion worker threads
+  input?: NodeJS.ReadableStream;
+  output?: NodeJS.WritableStream;
+  workers?: number;
+}
+
+/**
+ * Encode a single length-prefixed frame
+ */
+export function encodeFrame(payload: Uint8Array): Buffer {
+  const frame = Buffer.allocUnsafe(4 + payload.length);
+  frame.writeUInt32BE(payload.length, 0);
+  frame.set(payload, 4);
+  return frame;
+}
+
+/**
+ * Encode a response as a header frame followed by a payload frame
+ */
+export function encodeResponse(
+  header: DaemonResponseHeader,
+  payload: Uint8Array = new Uint8Array(0),
+): Buffer[] {
+  const headerFrame = encodeFrame(Buffer.from(JSON.stringify(header)));
+  const lengthPrefix = Buffer.allocUnsafe(4);
+  lengthPrefix.writeUInt32BE(payload.length, 0);
+  // The payload is passed through as-is to avoid copying large videos
+  return [
+    headerFrame,
+    lengthPrefix,
+    Buffer.from(payload.buffer, payload.byteOffset, payload.length),
+  ];
+}
+
+/**
+ * Incremental parser for the request stream
+ * Feed it chunks as they arrive; complete requests are returned in order.
+ * A malformed frame ends parsing: push() throws, unless it completed
+ * requests before reaching it, in which case it returns those and the error
+ * is left in `failure` (and thrown by the next push).
+ */
+export class RequestParser {
+  failure: Error | null = null;
+  private chunks: Buffer[] = [];
+  private buffered = 0;
+  private header: DaemonRequestHeader | null = null;
+
+  push(chunk: Buffer): DaemonRequest[] {
+    if (this.failure) {
+      throw this.failure;
+    }
+    this.chunks.push(chunk);
+    this.buffered += chunk.length;
+
+    const requests: DaemonRequest[] = [];
+    try {
+      for (;;) {
+        const frame = this.readFrame(
+          this.header ? MAX_PAYLOAD_BYTES : MAX_HEADER_BYTES,
+        );
+        if (!frame) {
+          break;
+        }
+
+        if (!this.header) {
+          this.header = parseRequestHeader(frame);
+        } else {
+          requests.push({ gif: frame, header: this.header });
+          this.header = null;
+        }
+      }
+    } catch (error) {
+      this.failure = error as Error;
+      if (requests.length === 0) {
+        throw error;
+      }
+    }
+    return requests;
+  }
+
+  /**
+   * True when no partially received request is pending
+   */
+  isIdle(): boolean {
+    return this.buffered === 0 && !this.header;
+  }
+
+  private readFrame(maxLength: number): Uint8Array | null {
+    if (this.buffered < 4) {
+      return null;
+    }
+
+    const prefix = this.peek(4);
+    const length = prefix.readUInt32BE(0);
+    if (length > maxLength) {
+      throw new Error(
+        `Frame of ${length} bytes exceeds the ${maxLength} byte limit`,
+      );
+    }
+    if (this.buffered < 4 + length) {
+      return null;
+    }
+
+    const frame = this.take(4 + length);
+    // Copy into a standalone buffer so it can be transferred to a worker
+    return new Uint8Array(frame.subarray(4));
+  }
+
+  private peek(length: number): Buffer {
+    if (this.chunks[0].length >= length) {
+      return this.chunks[0];
+    }
+    const joined = Buffer.concat(this.chunks);
+    this.chunks = [joined];
+    return joined;
+  }
+
+  private take(length: number): Buffer {
+    const joined =
+      this.chunks[0].length >= length
+        ? this.chunks[0]
+        : Buffer.concat(this.chunks);
+    const taken = joined.subarray(0, length);
+    const rest = joined.subarray(length);
+    this.chunks = rest.length > 0 ? [rest] : [];
+    this.buffered -= length;
+    return taken;
+  }
+}
+
+function parseRequestHeader(frame: Uint8Array): DaemonRequestHeader {
+  let header: unknown;
+  try {
+    header = JSON.parse(Buffer.from(frame).toString('utf8'));
+  } catch {
+    throw new Error('Request header is not valid JSON');
+  }
+  if (
+    !header ||
+    typeof header !== 'object' ||
+    !('id' in header) ||
+    (typeof header.id !== 'string' && typeof header.id !== 'number')
+  ) {
+    throw new Error('Request header must be an object with an "id"');
+  }
+  return header as DaemonRequestHeader;
+}
+
+interface PoolJob {
+  gif: Uint8Array;
+  options: ConversionOptions;
+  reject: (error: Error) => void;
+  resolve: (mp4: Uint8Array) => void;
+}
+
+interface PoolWorker {
+  job: PoolJob | null;
+  worker: Worker;
+}
+
+export interface ConversionPoolOptions {
+  maxRestarts?: number; // Crashes in a row before giving up (default: 5)
+  restartBackoffMs?: number; // Delay before the first restart, doubling after
+  workerScript?: string | URL; // Worker entry (default: daemon-worker.js)
+}
+
+// Restarts back off from 100ms, doubling up to 30 seconds
+const RESTART_BACKOFF_MS = 100;
+const MAX_RESTART_BACKOFF_MS = 30_000;
+const MAX_RESTARTS = 5;
+
+/**
+ * Fixed-size pool of worker threads, each holding warm WASM instances
+ * A worker that dies is replaced after a backoff that doubles with each
+ * crash in a row. Once maxRestarts crashes pass without a job finishing,
+ * as when the worker script fails to load, the pool stops restarting and
+ * rejects its queued and later jobs.
+ */
+export class ConversionPool {
+  private closing = false;
+  private crashes = 0;
+  private failure: Error | null = null;
+  private maxRestarts: number;
+  private queue: PoolJob[] = [];
+  private restartBackoffMs: number;
+  private restartTimers = new Set<NodeJS.Timeout>();
+  private workers: PoolWorker[] = [];
+  private workerScript: string | URL;
+
+  constructor(size: number, options: ConversionPoolOptions = {}) {
+    this.maxRestarts = options.maxRestarts ?? MAX_RESTARTS;
+    this.restartBackoffMs = options.restartBackoffMs ?? RESTART_BACKOFF_MS;
+    this.workerScript =
+      options.workerScript ?? new URL('./daemon-worker.js', import.meta.url);
+    for (let i = 0; i < size; i++) {
+      this.workers.push(this.spawn());
+    }
+  }
+
+  convert(
+    gif: Uint8Array,
+    options: ConversionOptions = {},
+  ): Promise<Uint8Array> {
+    if (this.closing) {
+      return Promise.reject(new Error('Conversion pool is closed'));
+    }
+    if (this.failure) {
+      return Promise.reject(this.failure);
+    }
+    return new Promise((resolve, reject) => {
+      this.queue.push({ gif, options, reject, resolve });
+      this.dispatch();
+    });
+  }
+
+  async close(): Promise<void> {
+    this.closing = true;
+    for (const timer of this.restartTimers) {
+      clearTimeout(timer);
+    }
+    this.restartTimers.clear();
+    this.rejectQueue(new Error('Conversion pool is closed'));
+    await Promise.all(this.workers.map(({ worker }) => worker.terminate()));
+    this.workers = [];
+  }
+
+  private spawn(): PoolWorker {
+    const entry: PoolWorker = {
+      job: null,
+      worker: new Worker(this.workerScript),
+    };
+
+    entry.worker.on(
+      'message',
+      (message: { data?: Uint8Array; error?: string; ok: boolean }) => {
+        // A worker that finishes a job works, whatever happened before
+        this.crashes = 0;
+        const job = entry.job;
+        entry.job = null;
+        if (job) {
+          if (message.ok && message.data) {
+            job.resolve(message.data);
+          } else {
+            job.reject(new Error(message.error || 'Conversion failed'));
+          }
+        }
+        this.dispatch();
+      },
+    );
+
+    // A crash raises 'error' and then 'exit'; a worker killed by the
+    // runtime or by process.exit() in native code only raises 'exit'
+    entry.worker.on('error', (error) => this.retire(entry, error));
+    entry.worker.on('exit', (code) =>
+      this.retire(
+        entry,
+        new Error(`Conversion worker exited with code ${code}`),
+      ),
+    );
+
+    return entry;
+  }
+
+  // Fail the in-flight job of a dead worker and, after a backoff, give its
+  // slot to a new one
+  private retire(entry: PoolWorker, error: Error): void {
+    const index = this.workers.indexOf(entry);
+    if (index === -1) {
+      return;
+    }
+    this.workers.splice(index, 1);
+    entry.job?.reject(error);
+    entry.job = null;
+    if (this.closing || this.failure) {
+      return;
+    }
+
+    this.crashes++;
+    if (this.crashes > this.maxRestarts) {
+      this.failure = new Error(
+        `Conversion workers keep exiting: ${error.message}`,
+      );
+      this.rejectQueue(this.failure);
+      return;
+    }
+
+    const delay = Math.min(
+      MAX_RESTART_BACKOFF_MS,
+      this.restartBackoffMs * 2 ** (this.crashes - 1),
+    );
+    const timer = setTimeout(() => {
+      this.restartTimers.delete(timer);
+      if (!this.closing && !this.failure) {
+        this.workers.push(this.spawn());
+        this.dispatch();
+      }
+    }, delay);
+    this.restartTimers.add(timer);
+  }
+
+  private rejectQueue(error: Error): void {
+    for (const job of this.queue.splice(0)) {
+      job.reject(error);
+    }
+  }
+
+  private dispatch(): void {
+    for (const entry of this.workers) {
+      if (this.queue.length === 0) {
+        return;
+      }
+      if (!entry.job) {
+        const job = this.queue.shift() as PoolJob;
+        entry.job = job;
+        entry.worker.postMessage({ gif: job.gif, options: job.options }, [
+          job.gif.buffer as ArrayBuffer,
+        ]);
+      }
+    }
+  }
+}
+
+/**
+ * Run the daemon until the input stream ends
+ * Input is only read while the workers and output keep up: while a response
+ * waits for output to drain, or too many requests are awaiting responses,
+ * reading pauses. Responses held in memory are therefore bounded by the
+ * jobs in flight rather than by how fast requests arrive.
+ */
+export async function runDaemon(options: DaemonOptions = {}): Promise<void> {
+  const {
+    input = process.stdin,
+    output = process.stdout,
+    workers = Math.max(1, availableParallelism() - 1),
+  } = options;
+
+  let convert = options.convert;
+  let pool: ConversionPool | null = null;
+  if (!convert) {
+    const conversionPool = new ConversionPool(workers);
+    convert = (gif, jobOptions) => conversionPool.convert(gif, jobOptions);
+    pool = conversionPool;
+  }
+  const runConversion = convert;
+
+  const parser = new RequestParser();
+  const inFlight = new Set<Promise<void>>();
+  let inFlightBytes = 0;
+  let drained: Promise<void> | null = null;
+
+  const respond = (header: DaemonResponseHeader, payload?: Uint8Array) => {
+    let flushed = true;
+    for (const part of encodeResponse(header, payload)) {
+      flushed = output.write(part);
+    }
+    if (!flushed && !drained) {
+      drained = once(output, 'drain').then(() => {
+        drained = null;
+      });
+    }
+  };
+
+  // Wait until output drains and in-flight requests are under the limit
+  const maxInFlight = Math.max(1, workers) * MAX_IN_FLIGHT_PER_WORKER;
+  const backpressure = async () => {
+    while (
+      drained ||
+      inFlightBytes > MAX_IN_FLIGHT_BYTES ||
+      inFlight.size >= maxInFlight
+    ) {
+      await (drained ?? Promise.race(inFlight));
+    }
+  };
+
+  try {
+    try {
+      for await (const chunk of input) {
+        const requests = parser.push(
+          typeof chunk === 'string' ? Buffer.from(chunk) : (chunk as Buffer),
+        );
+
+        for (const { gif, header } of requests) {
+          const bytes = gif.length;
+          inFlightBytes += bytes;
+          const job = runConversion(gif, header.options ?? {})
+            .then(
+              (mp4) => respond({ id: header.id, ok: true }, mp4),
+              (error: Error) =>
+                respond({ error: error.message, id: header.id, ok: false }),
+            )
+            .finally(() => {
+              inFlightBytes -= bytes;
+              inFlight.delete(job);
+            });
+          inFlight.add(job);
+        }
+        if (parser.failure) {
+          throw parser.failure;
+        }
+
+        await backpressure();
+      }
+    } catch (error) {
+      // Answer the requests already accepted before giving up on the stream
+      await Promise.all(inFlight);
+      throw error;
+    }
+
+    if (!parser.isIdle()) {
+      console.error('gif2vid daemon: input ended mid-request');
+    }
+
+    await Promise.all(inFlight);
+    await drained;
+  } finally {
+    await pool?.close();
+  }
+}
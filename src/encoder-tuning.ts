@@ -0,0 +1,287 @@
+/**
+ * Latency-budgeted encoder settings
+ * Picks the x264 preset (and, if needed, crf and scale) expected to finish
+ * within a time budget, using a speed table calibrated from this machine's
+ * own encode timings. Works in both Node.js and browser environments.
+ */
+
+export const X264_PRESETS = [
+  'ultrafast',
+  'superfast',
+  'veryfast',
+  'faster',
+  'fast',
+  'medium',
+  'slow',
+  'slower',
+  'veryslow',
+] as const;
+
+export type X264Preset = (typeof X264_PRESETS)[number];
+
+export interface EncoderSettings {
+  crf: number;
+  preset: X264Preset;
+  scale: number; // 1 = full size, 0.5 = half width and height
+}
+
+export interface EncodeWorkload {
+  frames: number;
+  height: number;
+  width: number;
+}
+
+// Baseline throughput in megapixel-frames per second for GIF-like content
+// on a typical 4-core machine. Only the relative shape matters long term;
+// the absolute level is corrected by recordEncodeTiming.
+const BASELINE_SPEED: Record<X264Preset, number> = {
+  fast: 80,
+  faster: 110,
+  medium: 60,
+  slow: 30,
+  slower: 12,
+  superfast: 250,
+  ultrafast: 400,
+  veryfast: 160,
+  veryslow: 5,
+};
+
+// h264-mp4-encoder speed (0 = best quality, 10 = fastest) for each preset
+const WASM_ENCODER_SPEED: Record<X264Preset, number> = {
+  fast: 6,
+  faster: 7,
+  medium: 5,
+  slow: 4,
+  slower: 2,
+  superfast: 9,
+  ultrafast: 10,
+  veryfast: 8,
+  veryslow: 0,
+};
+
+// Fixed cost of an encode (process spawn, temp files, container setup)
+const FIXED_OVERHEAD_MS = 60;
+
+// Budgets never select anything slower than this; the slower presets cost
+// several times more for little size benefit on GIF content
+const SLOWEST_BUDGETED_PRESET: X264Preset = 'slow';
+
+const DEFAULT_CRF = 23;
+const MAX_CRF_BUMP = 6;
+const MIN_SCALE = 0.25;
+
+// Size-targeted encodes aim slightly under the limit; below the minimum
+// bitrate the output would be unwatchable
+const RATE_CONTROL_MARGIN = 0.96;
+const MIN_BITRATE_KBPS = 8;
+
+// Encodes of a size-targeted video before giving up on fitting maxBytes
+export const MAX_SIZE_ATTEMPTS = 3;
+
+// Quality-targeted encodes search this crf range, each probe encoding a
+// few short runs of frames so the search cost does not grow with the GIF
+const SSIM_CRF_MIN = 12;
+const SSIM_CRF_MAX = 45;
+const SSIM_SAMPLE_RUNS = 3;
+const SSIM_SAMPLE_RUN_FRAMES = 8;
+
+// Smoothing factor for the per-machine calibration
+const CALIBRATION_WEIGHT = 0.3;
+
+let machineSpeedFactor = 1;
+
+/**
+ * Total pixels that go through the encoder for a workload, in megapixels
+ */
+function megapixelFrames({ frames, height, width }: EncodeWorkload): number {
+  return (width * height * frames) / 1_000_000;
+}
+
+/**
+ * Predict how long an encode will take with the given preset and scale
+ */
+export function estimateEncodeMs(
+  workload: EncodeWorkload,
+  preset: X264Preset,
+  scale: number = 1,
+): number {
+  const work = megapixelFrames(workload) * scale * scale;
+  const speed = BASELINE_SPEED[preset] * machineSpeedFactor;
+  return FIXED_OVERHEAD_MS + (work / speed) * 1000;
+}
+
+/**
+ * Feed a measured encode time back into the speed table
+ */
+export function recordEncodeTiming(
+  workload: EncodeWorkload,
+  settings: EncoderSettings,
+  elapsedMs: number,
+): void {
+  const work = megapixelFrames(workload) * settings.scale * settings.scale;
+  const encodeMs = elapsedMs - FIXED_OVERHEAD_MS;
+  // Tiny jobs are dominated by overhead and say little about throughput
+  if (work < 0.5 || encodeMs <= 0) {
+    return;
+  }
+
+  const observedFactor =
+    work / (encodeMs / 1000) / BASELINE_SPEED[settings.preset];
+  machineSpeedFactor =
+    machineSpeedFactor * (1 - CALIBRATION_WEIGHT) +
+    observedFactor * CALIBRATION_WEIGHT;
+}
+
+/**
+ * Choose encoder settings expected to complete within latencyBudgetMs
+ * The slowest (best compressing) preset that fits is used. When even
+ * ultrafast misses the budget, crf is raised and then the output is scaled
+ * down until the estimate fits.
+ */
+export function selectEncoderSettings(
+  workload: EncodeWorkload,
+  latencyBudgetMs: number,
+  baseCrf: number = DEFAULT_CRF,
+): EncoderSettings {
+  const slowestIndex = X264_PRESETS.indexOf(SLOWEST_BUDGETED_PRESET);
+  for (let i = slowestIndex; i >= 0; i--) {
+    const preset = X264_PRESETS[i];
+    if (estimateEncodeMs(workload, preset) <= latencyBudgetMs) {
+      return { crf: baseCrf, preset, scale: 1 };
+    }
+  }
+
+  // Nothing fits at full size: take the fastest preset, trade some quality
+  // for rate-control headroom and shrink the frame area to fit the budget
+  const preset = X264_PRESETS[0];
+  const fullSizeMs = estimateEncodeMs(workload, preset) - FIXED_OVERHEAD_MS;
+  const availableMs = Math.max(1, latencyBudgetMs - FIXED_OVERHEAD_MS);
+  const scale = Math.max(
+    MIN_SCALE,
+    Math.min(1, Math.sqrt(availableMs / fullSizeMs)),
+  );
+
+  return {
+    crf: Math.min(51, baseCrf + MAX_CRF_BUMP),
+    preset,
+    scale: Math.floor(scale * 100) / 100,
+  };
+}
+
+/**
+ * Video bitrate that keeps an encode of the given duration under maxBytes
+ * Leaves room for the MP4 container (moov tables grow with the frame count)
+ * and a small margin for rate control inaccuracy.
+ */
+export function targetBitrateKbps(
+  maxBytes: number,
+  durationMs: number,
+  frameCount: number = 0,
+): number {
+  const containerBytes = 2048 + frameCount * 16;
+  const videoBits = (maxBytes - containerBytes) * 8 * RATE_CONTROL_MARGIN;
+  const kbps = videoBits / durationMs; // bits per millisecond = kbit/s
+  if (!(kbps >= MIN_BITRATE_KBPS)) {
+    throw new Error(
+      `maxBytes of ${maxBytes} is too small for a ${durationMs}ms video`,
+    );
+  }
+  return kbps;
+}
+
+/**
+ * Bitrate for re-encoding a video that came out at size bytes, over maxBytes
+ * Scales by the overshoot, with a margin since rate control is approximate.
+ */
+export function reducedBitrateKbps(
+  bitrateKbps: number,
+  size: number,
+  maxBytes: number,
+): number {
+  return bitrateKbps * (maxBytes / size) * 0.95;
+}
+
+/**
+ * Error for a size-targeted encode that still came out over maxBytes
+ */
+export function overMaxBytesError(size: number, maxBytes: number): Error {
+  return new Error(
+    `Encoded video is ${size} bytes, over maxBytes of ${maxBytes} ` +
+      `after ${MAX_SIZE_ATTEMPTS} attempts`,
+  );
+}
+
+/**
+ * Highest crf in [SSIM_CRF_MIN, SSIM_CRF_MAX] whose measured SSIM meets
+ * targetSsim, by binary search (SSIM falls as crf rises), or SSIM_CRF_MIN
+ * when none does
+ */
+export async function searchCrfForSsim(
+  targetSsim: number,
+  measureSsim: (crf: number) => Promise<number>,
+): Promise<number> {
+  if (!(targetSsim > 0 && targetSsim < 1)) {
+    throw new Error(`targetSsim must be between 0 and 1: ${targetSsim}`);
+  }
+  let best = SSIM_CRF_MIN;
+  let low = SSIM_CRF_MIN;
+  let high = SSIM_CRF_MAX;
+  while (low <= high) {
+    const crf = Math.floor((low + high) / 2);
+    if ((await measureSsim(crf)) >= targetSsim) {
+      best = crf;
+      low = crf + 1;
+    } else {
+      high = crf - 1;
+    }
+  }
+  return best;
+}
+
+/**
+ * Indices of the frames to measure a crf on: runs of consecutive frames
+ * spread over count frames, so inter-frame prediction works as in the full
+ * encode, or every frame when there are few
+ */
+export function sampleFrameRuns(count: number): number[] {
+  if (count <= SSIM_SAMPLE_RUNS * SSIM_SAMPLE_RUN_FRAMES) {
+    return Array.from({ length: count }, (_, i) => i);
+  }
+  const indices: number[] = [];
+  const stride = (count - SSIM_SAMPLE_RUN_FRAMES) / (SSIM_SAMPLE_RUNS - 1);
+  for (let run = 0; run < SSIM_SAMPLE_RUNS; run++) {
+    const start = Math.round(run * stride);
+    for (let i = 0; i < SSIM_SAMPLE_RUN_FRAMES; i++) {
+      indices.push(start + i);
+    }
+  }
+  return indices;
+}
+
+/**
+ * Relative encode cost of a preset, 1 for 'medium'
+ */
+export function presetCostFactor(preset: X264Preset): number {
+  return BASELINE_SPEED.medium / BASELINE_SPEED[preset];
+}
+
+/**
+ * Map an x264 preset onto the h264-mp4-encoder speed scale
+ */
+export function wasmEncoderSpeed(preset: X264Preset): number {
+  return WASM_ENCODER_SPEED[preset];
+}
+
+/**
+ * True when the string names an x264 preset
+ */
+export function isX264Preset(preset: string): preset is X264Preset {
+  return (X264_PRESETS as ReadonlyArray<string>).includes(preset);
+}
+
+/**
+ * Reset calibration (for tests)
+ */
+export function resetEncoderCalibration(): void {
+  machineSpeedFactor = 1;
+}
@@ -0,0 +1,261 @@
+/**
+ * Cached registry of what the local ffmpeg binary can do
+ * ffmpeg is probed once per process; results are also persisted to disk,
+ * keyed by the binary's path, size and mtime, so new processes skip the
+ * probe until ffmpeg is upgraded. Only available in Node.js.
+ */
+
+export interface FFmpegCapabilities {
+  available: boolean;
+  encoders: string[]; // Video encoders from `ffmpeg -encoders`
+  error?: string;
+  fastPresets: Record<string, string[]>; // Software-only fast presets per encoder
+  filters: string[]; // Filters from `ffmpeg -filters`
+  path?: string;
+  version?: string;
+}
+
+export interface RegistryOptions {
+  cacheDir?: string | null; // Where to persist probe results; null disables
+}
+
+// Fast presets of the software encoders we know how to drive. None of these
+// need hardware acceleration, so they are safe to pick on any machine.
+const FAST_PRESETS: Record<string, string[]> = {
+  'libaom-av1': ['8', '7', '6'],
+  libsvtav1: ['12', '11', '10'],
+  libx264: ['ultrafast', 'superfast', 'veryfast'],
+  libx265: ['ultrafast', 'superfast', 'veryfast'],
+};
+
+const CACHE_FILE = 'ffmpeg-capabilities.json';
+const CACHE_VERSION = 1;
+
+// One probe per cache setting, so a caller's cacheDir is never ignored
+const registry = new Map<
+  string | null | undefined,
+  Promise<FFmpegCapabilities>
+>();
+
+/**
+ * Default on-disk cache location (XDG cache dir or ~/.cache)
+ */
+export async function defaultCacheDir(): Promise<string> {
+  const { homedir } = await import('node:os');
+  const { join } = await import('node:path');
+  return join(
+    process.env.XDG_CACHE_HOME || join(homedir(), '.cache'),
+    'gif2vid',
+  );
+}
+
+/**
+ * Find the ffmpeg binary on PATH without spawning a shell
+ */
+async function findFFmpeg(): Promise<string | null> {
+  const { access, constants } = await import('node:fs/promises');
+  const { delimiter, join } = await import('node:path');
+
+  const names = process.platform === 'win32' ? ['ffmpeg.exe'] : ['ffmpeg'];
+  for (const dir of (process.env.PATH || '').split(delimiter)) {
+    if (!dir) {
+      continue;
+    }
+    for (const name of names) {
+      const candidate = join(dir, name);
+      try {
+        await access(candidate, constants.X_OK);
+        return candidate;
+      } catch {
+        // Not here, keep looking
+      }
+    }
+  }
+  return null;
+}
+
+/**
+ * Parse the name column of `ffmpeg -encoders` / `ffmpeg -filters` output
+ * Listings that have a ` ------` line explain their flags above it, in lines
+ * shaped like entries (` V..... = Video`), so only what follows is read.
+ */
+function parseListing(stdout: string, pattern: RegExp): string[] {
+  const lines = stdout.split('\n');
+  const separator = lines.findIndex((line) => /^\s*-+\s*$/.test(line));
+  const names: string[] = [];
+  for (const line of lines.slice(separator + 1)) {
+    const match = line.match(pattern);
+    if (match) {
+      names.push(match[1]);
+    }
+  }
+  return names;
+}
+
+/**
+ * Video encoder names from `ffmpeg -encoders`
+ * Lines look like: " V....D libx264    libx264 H.264 / AVC ..."
+ */
+export function parseEncoders(stdout: string): string[] {
+  return parseListing(stdout, /^\s*V[A-Z.]{5}\s+(\S+)/);
+}
+
+/**
+ * Filter names from `ffmpeg -filters`
+ * Lines look like: " ... scale    V->V    Scale the input video size ..."
+ */
+export function parseFilters(stdout: string): string[] {
+  return parseListing(stdout, /^\s*[A-Z.]{2,3}\s+(\S+)\s+\S+->\S+/);
+}
+
+/**
+ * Version string from `ffmpeg -version`
+ */
+export function parseVersion(stdout: string): string {
+  const match = stdout.match(/ffmpeg version (\S+)/);
+  return match ? match[1] : 'unknown';
+}
+
+/**
+ * Run the probe commands against an ffmpeg binary
+ */
+async function probe(path: string): Promise<FFmpegCapabilities> {
+  const { execFile } = await import('node:child_process');
+  const { promisify } = await import('node:util');
+  const execFileAsync = promisify(execFile);
+
+  const run = (args: string[]) =>
+    execFileAsync(path, ['-hide_banner', ...args], {
+      maxBuffer: 16 * 1024 * 1024,
+    }).then(({ stdout }) => stdout);
+
+  const [versionOut, encodersOut, filtersOut] = await Promise.all([
+    run(['-version']),
+    run(['-encoders']),
+    run(['-filters']),
+  ]);
+
+  const encoders = parseEncoders(encodersOut);
+  const filters = parseFilters(filtersOut);
+
+  const fastPresets: Record<string, string[]> = {};
+  for (const encoder of encoders) {
+    if (FAST_PRESETS[encoder]) {
+      fastPresets[encoder] = FAST_PRESETS[encoder];
+    }
+  }
+
+  return {
+    available: true,
+    encoders,
+    fastPresets,
+    filters,
+    path,
+    version: parseVersion(versionOut),
+  };
+}
+
+/**
+ * Probe ffmpeg, or load a previous probe of the same binary from disk
+ */
+async function loadCapabilities(
+  cacheDir: string | null,
+): Promise<FFmpegCapabilities> {
+  const { mkdir, readFile, rename, stat, writeFile } = await import(
+    'node:fs/promises'
+  );
+  const { randomBytes } = await import('node:crypto');
+  const { join } = await import('node:path');
+
+  const path = await findFFmpeg();
+  if (!path) {
+    return {
+      available: false,
+      encoders: [],
+      error: 'ffmpeg not found on PATH',
+      fastPresets: {},
+      filters: [],
+    };
+  }
+
+  const { mtimeMs, size } = await stat(path);
+  const key = `${path}:${size}:${mtimeMs}`;
+  const cachePath = cacheDir ? join(cacheDir, CACHE_FILE) : null;
+
+  let cache: Record<string, FFmpegCapabilities> = {};
+  if (cachePath) {
+    try {
+      const stored = JSON.parse(await readFile(cachePath, 'utf8'));
+      if (stored.version === CACHE_VERSION) {
+        cache = stored.entries;
+        if (cache[key]) {
+          return cache[key];
+        }
+      }
+    } catch {
+      // Missing or corrupt cache - probe again
+    }
+  }
+
+  const capabilities = await probe(path);
+
+  if (cacheDir && cachePath) {
+    try {
+      await mkdir(cacheDir, { recursive: true });
+      // Write then rename so concurrent writers never see a partial file;
+      // threads share a pid, so the temporary name needs more than that
+      const suffix = `${process.pid}-${randomBytes(4).toString('hex')}`;
+      const tempPath = `${cachePath}.${suffix}.tmp`;
+      await writeFile(
+        tempPath,
+        JSON.stringify({
+          entries: { ...cache, [key]: capabilities },
+          version: CACHE_VERSION,
+        }),
+      );
+      await rename(tempPath, cachePath);
+    } catch {
+      // Persisting is an optimisation only
+    }
+  }
+
+  return capabilities;
+}
+
+/**
+ * Get the capabilities of the local ffmpeg (probed at most once per process
+ * for each cacheDir)
+ */
+export function getFFmpegCapabilities(
+  options: RegistryOptions = {},
+): Promise<FFmpegCapabilities> {
+  let capabilities = registry.get(options.cacheDir);
+  if (!capabilities) {
+    capabilities = (async () => {
+      const cacheDir =
+        options.cacheDir === undefined
+          ? await defaultCacheDir()
+          : options.cacheDir;
+      try {
+        return await loadCapabilities(cacheDir);
+      } catch (error) {
+        return {
+          available: false,
+          encoders: [],
+          error: (error as Error).message,
+          fastPresets: {},
+          filters: [],
+        };
+      }
+    })();
+    registry.set(options.cacheDir, capabilities);
+  }
+  return capabilities;
+}
+
+/**
+ * Forget the in-process probe results (e.g. after installing ffmpeg)
+ */
+export function resetFFmpegCapabilities(): void {
+  registry.clear();
+}
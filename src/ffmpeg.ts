@@ -3,13 +3,27 @@
  * This module is automatically used in Node.js environments when available
  */
 
-import { exec } from 'node:child_process';
+import { execFile, spawn } from 'node:child_process';
+import { randomUUID } from 'node:crypto';
+import { once } from 'node:events';
 import { unlink, writeFile } from 'node:fs/promises';
 import { tmpdir } from 'node:os';
 import { join } from 'node:path';
+import type { Writable } from 'node:stream';
 import { promisify } from 'node:util';
+import { throwIfAborted } from './abort.js';
+import {
+  MAX_SIZE_ATTEMPTS,
+  overMaxBytesError,
+  reducedBitrateKbps,
+  targetBitrateKbps,
+} from './encoder-tuning.js';
+import { getFFmpegCapabilities } from './ffmpeg-registry.js';
+import { i420Size } from './wasm-module.js';
 
-const execAsync = promisify(exec);
+const execFileAsync = promisify(execFile);
+
+export type VideoCodec = 'av1' | 'h264' | 'hevc';
 
 export interface FFmpegInfo {
   available: boolean;
@@ -19,20 +33,158 @@ export interface FFmpegInfo {
 
 /**
  * Check if ffmpeg is available on the system
+ * Served from the capability registry, so ffmpeg is probed once per process
  */
 export async function checkFFmpeg(): Promise<FFmpegInfo> {
-  try {
-    const { stdout } = await execAsync('ffmpeg -version');
-    const versionMatch = stdout.match(/ffmpeg version ([^\s]+)/);
-    return {
-      available: true,
-      version: versionMatch ? versionMatch[1] : 'unknown',
-    };
-  } catch (error) {
-    return {
-      available: false,
-      error: (error as Error).message,
-    };
+  const { available, error, version } = await getFFmpegCapabilities();
+  return available ? { available, version } : { available, error };
+}
+
+// Encoders for each codec, in order of preference
+const CODEC_ENCODERS: Record<VideoCodec, string[]> = {
+  av1: ['libsvtav1', 'libaom-av1'],
+  h264: ['libx264'],
+  hevc: ['libx265'],
+};
+
+// Codec to try next when no encoder for a codec is installed
+const CODEC_FALLBACK: Record<VideoCodec, VideoCodec | null> = {
+  av1: 'hevc',
+  h264: null,
+  hevc: 'h264',
+};
+
+// Newer codecs reach the same visual quality at a higher crf than x264
+const CRF_OFFSET: Record<string, number> = {
+  'libaom-av1': 12,
+  libsvtav1: 12,
+  libx264: 0,
+  libx265: 5,
+};
+
+// x264 preset names mapped onto the AV1 encoders' numeric speed scales
+const AV1_SPEED: Record<string, { aom: number; svt: number }> = {
+  fast: { aom: 6, svt: 8 },
+  faster: { aom: 7, svt: 9 },
+  medium: { aom: 5, svt: 7 },
+  slow: { aom: 4, svt: 5 },
+  slower: { aom: 3, svt: 4 },
+  superfast: { aom: 8, svt: 11 },
+  ultrafast: { aom: 8, svt: 12 },
+  veryfast: { aom: 8, svt: 10 },
+  veryslow: { aom: 2, svt: 2 },
+};
+
+/**
+ * List the video encoders compiled into the local ffmpeg
+ */
+export async function listFFmpegEncoders(): Promise<Set<string>> {
+  return new Set((await getFFmpegCapabilities()).encoders);
+}
+
+/**
+ * Find the best available encoder for a codec, walking down the codec
+ * ladder (av1 -> hevc -> h264) when the requested codec is not installed
+ */
+export async function resolveVideoCodec(
+  codec: VideoCodec = 'h264',
+): Promise<{ codec: VideoCodec; encoder: string }> {
+  if (!Object.hasOwn(CODEC_ENCODERS, codec)) {
+    throw new Error(`Unknown codec: ${codec}`);
+  }
+  const encoders = await listFFmpegEncoders();
+
+  for (let candidate: VideoCodec | null = codec; candidate; ) {
+    const encoder = CODEC_ENCODERS[candidate].find((name) =>
+      encoders.has(name),
+    );
+    if (encoder) {
+      return { codec: candidate, encoder };
+    }
+    candidate = CODEC_FALLBACK[candidate];
+  }
+
+  // Encoder probing failed or found nothing; libx264 is the historical default
+  return { codec: 'h264', encoder: 'libx264' };
+}
+
+/**
+ * Rate control for a single ffmpeg run: constant quality, or a target
+ * bitrate either capped by the VBV buffer or split over two passes
+ */
+type RateControl =
+  | { crf: number }
+  | { bitrateKbps: number; pass?: 1 | 2; passLogFile?: string };
+
+/**
+ * Build the encoder arguments for ffmpeg, including MP4 sample entry tagging
+ */
+function encoderArgs(
+  encoder: string,
+  preset: string,
+  rate: RateControl,
+): string[] {
+  const speed = AV1_SPEED[preset] ?? AV1_SPEED.medium;
+
+  let rateArgs: string[];
+  if ('crf' in rate) {
+    const quality = Math.min(
+      63,
+      Math.round(rate.crf) + (CRF_OFFSET[encoder] ?? 0),
+    );
+    rateArgs = ['-crf', `${quality}`]; // Quality level (lower = better)
+    if (encoder === 'libaom-av1') {
+      rateArgs.push('-b:v', '0'); // Constant quality mode
+    }
+  } else {
+    const kbps = Math.floor(rate.bitrateKbps);
+    rateArgs = ['-b:v', `${kbps}k`];
+    if (rate.pass) {
+      rateArgs.push(
+        '-pass',
+        `${rate.pass}`,
+        '-passlogfile',
+        rate.passLogFile ?? '',
+      );
+    } else {
+      // Without a first pass, cap the peak rate so the total cannot overshoot
+      rateArgs.push('-maxrate', `${kbps}k`, '-bufsize', `${kbps * 2}k`);
+    }
+  }
+
+  switch (encoder) {
+    case 'libx265':
+      return [
+        '-c:v',
+        'libx265',
+        '-preset',
+        preset,
+        ...rateArgs,
+        '-x265-params',
+        'log-level=error',
+        '-tag:v',
+        'hvc1', // Apple players require hvc1 rather than hev1
+      ];
+    case 'libsvtav1':
+      return ['-c:v', 'libsvtav1', '-preset', `${speed.svt}`, ...rateArgs];
+    case 'libaom-av1':
+      return [
+        '-c:v',
+        'libaom-av1',
+        '-cpu-used',
+        `${speed.aom}`,
+        ...rateArgs,
+        '-row-mt',
+        '1',
+      ];
+    default:
+      return [
+        '-c:v',
+        'libx264', // H.264 codec
+        '-preset',
+        preset, // Encoding speed/compression tradeoff
+        ...rateArgs,
+      ];
   }
 }
 
@@ -51,15 +203,35 @@ export async function printCompatInfo(): Promise<void> {
   const ffmpegInfo = await checkFFmpeg();
   if (ffmpegInfo.available) {
     console.log(`  ✓ ffmpeg: AVAILABLE (version ${ffmpegInfo.version})`);
+    const { path } = await getFFmpegCapabilities();
+    console.log(`    - Binary: ${path}`);
     console.log('    - Automatically used for H.264 compression');
     console.log('    - Typical size reduction: 70-99%');
     console.log('    - Best quality and smallest file sizes');
+
+    const codecs: string[] = [];
+    for (const codec of Object.keys(CODEC_ENCODERS) as VideoCodec[]) {
+      const resolved = await resolveVideoCodec(codec);
+      if (resolved.codec === codec) {
+        codecs.push(`${codec} (${resolved.encoder})`);
+      }
+    }
+    console.log(`    - Output codecs: ${codecs.join(', ') || 'none found'}`);
   } else {
     console.log('  ✗ ffmpeg: NOT FOUND');
     console.log('    - Install: brew install ffmpeg (macOS)');
     console.log('    - Install: apt-get install ffmpeg (Ubuntu/Debian)');
     console.log('    - Install: choco install ffmpeg (Windows)');
-    console.log('    - Without ffmpeg, files will be larger (WASM fallback)');
+  }
+
+  const { loadWasmEncoder } = await import('./webcodecs.js');
+  const wasmEncoder = (await loadWasmEncoder()) !== null;
+  if (wasmEncoder) {
+    console.log('  ✓ h264-mp4-encoder: AVAILABLE (in-process WASM)');
+    console.log('    - H.264 compression without ffmpeg');
+    console.log('    - Used instead of ffmpeg when it is faster for a job');
+  } else {
+    console.log('  ✗ h264-mp4-encoder: COULD NOT BE LOADED');
   }
 
   console.log('\nRecommendation:');
@@ -67,66 +239,64 @@ export async function printCompatInfo(): Promise<void> {
     console.log(
       '  All features are available! Automatic optimization enabled.',
     );
+  } else if (wasmEncoder) {
+    console.log('  Output is compressed with the in-process H.264 encoder.');
+    console.log(
+      '  Install ffmpeg for smaller files and HEVC/AV1 output codecs.',
+    );
   } else {
     console.log('  Install ffmpeg to enable automatic optimization.');
     console.log('  Basic conversion still works without it (larger files).');
   }
 }
 
+export interface OptimizeOptions {
+  codec?: VideoCodec; // Output codec, falls back when unavailable (default: 'h264')
+  crf?: number; // Constant Rate Factor (0-51, lower = better quality, default: 23)
+  preset?: string; // Encoding speed preset (default: 'medium')
+  durationMs?: number; // Video duration, required with maxBytes
+  frameCount?: number; // Number of frames, used to estimate container size
+  keyframeTimesMs?: number[]; // Place keyframes at exactly these times
+  maxBytes?: number; // Target file size limit, enables bitrate rate control
+  scale?: number; // Output size relative to the input (default: 1)
+  signal?: AbortSignal; // Kills the ffmpeg process when aborted
+}
+
+// Uncompressed I420 frames, as stored by the converter's I420 video format
+export interface RawVideoFormat {
+  frameDurationMs: number; // Every frame is shown for this long
+  height: number;
+  width: number;
+}
+
+// Where an ffmpeg run reads its video from
+interface VideoInput {
+  args: string[]; // ffmpeg input arguments, ending with -i and its source
+  frames?: Uint8Array[]; // Written to ffmpeg's stdin on every run
+}
+
 /**
  * Optimize an MP4 buffer using ffmpeg
  */
 export async function optimizeMP4(
   inputBuffer: Buffer,
-  options: {
-    crf?: number; // Constant Rate Factor (0-51, lower = better quality, default: 23)
-    preset?: string; // Encoding speed preset (default: 'medium')
-  } = {},
+  options: OptimizeOptions = {},
 ): Promise<Buffer> {
-  const { crf = 23, preset = 'medium' } = options;
+  const { readFile } = await import('node:fs/promises');
 
-  // Check if ffmpeg is available
-  const ffmpegInfo = await checkFFmpeg();
-  if (!ffmpegInfo.available) {
-    throw new Error(
-      'ffmpeg is not available. Install ffmpeg to enable automatic optimization.\n' +
-        'See installation instructions: https://ffmpeg.org/download.html',
-    );
-  }
-
-  // Create temporary files
-  const tempDir = tmpdir();
-  const inputPath = join(tempDir, `gif2vid-input-${Date.now()}.mp4`);
-  const outputPath = join(tempDir, `gif2vid-output-${Date.now()}.mp4`);
+  // Create temporary files, unique per job since a daemon runs several at once
+  const id = randomUUID();
+  const inputPath = join(tmpdir(), `gif2vid-input-${id}.mp4`);
+  const outputPath = join(tmpdir(), `gif2vid-output-${id}.mp4`);
 
   try {
     // Write input buffer to temp file
-    await writeFile(inputPath, inputBuffer);
-
-    // Run ffmpeg optimization
-    // Using H.264 with appropriate settings for small file size and good quality
-    // The scale filter ensures dimensions are divisible by 2 (required for H.264)
-    const ffmpegCommand = [
-      'ffmpeg',
-      '-i',
-      inputPath,
-      '-vf "scale=trunc(iw/2)*2:trunc(ih/2)*2"', // Ensure even dimensions
-      '-c:v libx264', // H.264 codec
-      `-preset ${preset}`, // Encoding speed/compression tradeoff
-      `-crf ${crf}`, // Quality level (lower = better)
-      '-pix_fmt yuv420p', // Pixel format for compatibility
-      '-movflags +faststart', // Enable streaming/fast start
-      '-y', // Overwrite output file
-      outputPath,
-    ].join(' ');
+    await writeFile(inputPath, inputBuffer, { signal: options.signal });
 
-    await execAsync(ffmpegCommand);
+    await optimizeMP4File(inputPath, outputPath, options);
 
     // Read optimized file
-    const { readFile } = await import('node:fs/promises');
-    const optimizedBuffer = await readFile(outputPath);
-
-    return optimizedBuffer;
+    return await readFile(outputPath, { signal: options.signal });
   } finally {
     // Clean up temporary files
     try {
@@ -142,6 +312,424 @@ export async function optimizeMP4(
   }
 }
 
+/**
+ * Optimize an MP4 file using ffmpeg, writing the result to outputPath
+ * Neither file is read into memory, so this is the cheapest route when the
+ * input is already on disk.
+ */
+export function optimizeMP4File(
+  inputPath: string,
+  outputPath: string,
+  options: OptimizeOptions = {},
+): Promise<void> {
+  return optimizeVideo(
+    { args: ['-i', inputPath] },
+    outputPath,
+    options,
+  );
+}
+
+/**
+ * Encode constant frame rate I420 frames with ffmpeg, writing the result to
+ * outputPath. The frames are piped in as yuv420p rawvideo, which is what the
+ * encoders consume, so ffmpeg neither reads a container nor converts colour.
+ */
+export function optimizeRawVideo(
+  frames: Uint8Array[],
+  format: RawVideoFormat,
+  outputPath: string,
+  options: OptimizeOptions = {},
+): Promise<void> {
+  return optimizeVideo(rawVideoInput(frames, format), outputPath, options);
+}
+
+/**
+ * ffmpeg input reading constant frame rate I420 frames from stdin
+ */
+function rawVideoInput(
+  frames: Uint8Array[],
+  format: RawVideoFormat,
+): VideoInput {
+  const { frameDurationMs, height, width } = format;
+  // These become ffmpeg arguments, so only plain integers are accepted
+  const valid = [frameDurationMs, height, width].every(
+    (n) => Number.isInteger(n) && n > 0,
+  );
+  if (!valid) {
+    throw new Error(
+      `Invalid raw video format: ${width}x${height}, ${frameDurationMs}ms`,
+    );
+  }
+
+  return {
+    args: [
+      '-f',
+      'rawvideo',
+      '-pix_fmt',
+      'yuv420p',
+      '-video_size',
+      `${width}x${height}`,
+      '-framerate',
+      `1000/${frameDurationMs}`,
+      '-i',
+      'pipe:0',
+    ],
+    frames,
+  };
+}
+
+/**
+ * Encode video piped in on stdin and stream the result as fragmented MP4
+ * With a format the chunks are I420 frames, as for optimizeRawVideo;
+ * without one they are an MP4 whose moov precedes its samples, such as the
+ * converter's header and frames. Fragments need no seeking back, so ffmpeg
+ * writes each one to stdout as soon as it is encoded, and write is awaited
+ * before more is read. maxBytes is not supported: hitting a size can take
+ * a second encode.
+ */
+export async function optimizeToStream(
+  chunks: Uint8Array[],
+  format: RawVideoFormat | null,
+  write: (chunk: Uint8Array) => Promise<void>,
+  options: OptimizeOptions = {},
+): Promise<void> {
+  const { codec, crf = 23, signal } = options;
+  if (options.maxBytes !== undefined) {
+    throw new Error('maxBytes cannot be used with streamed output');
+  }
+  const ffmpegPath = await checkEncoderSettings(options);
+  const { encoder } = await resolveVideoCodec(codec);
+
+  const input = format
+    ? rawVideoInput(chunks, format)
+    : { args: ['-f', 'mov', '-i', 'pipe:0'], frames: chunks };
+  const fragmentedOutput = [
+    // An empty moov up front, then a fragment per keyframe or second
+    '-movflags',
+    'frag_keyframe+empty_moov+default_base_moof',
+    '-frag_duration',
+    '1000000',
+    '-f',
+    'mp4',
+    'pipe:1',
+  ];
+  const args = buildArgs(
+    input,
+    encoder,
+    { crf },
+    fragmentedOutput,
+    options,
+  );
+
+  throwIfAborted(signal);
+  const child = spawn(ffmpegPath, args, { signal });
+  let stderr = '';
+  child.stderr.setEncoding('utf8');
+  child.stderr.on('data', (text: string) => {
+    stderr = (stderr + text).slice(-4096);
+  });
+  const exited = once(child, 'close');
+  exited.catch(() => {}); // Awaited once stdout has been read
+
+  const writing = writeFrames(child.stdin, chunks);
+  try {
+    for await (const chunk of child.stdout) {
+      await write(chunk);
+    }
+  } catch (error) {
+    child.kill();
+    throw error;
+  } finally {
+    await writing;
+  }
+
+  const [code] = await exited;
+  if (code !== 0) {
+    throw new Error(`ffmpeg exited with code ${code}: ${stderr.trim()}`);
+  }
+}
+
+/**
+ * Decode a video file to width x height I420 frames, scaling it if it is
+ * another size, and pass them to onFrame in order. Frames are neither
+ * dropped nor repeated, so they line up with the samples that were encoded.
+ * Each frame is only valid during its call. Returns the number of frames.
+ */
+export async function decodeToI420(
+  inputPath: string,
+  width: number,
+  height: number,
+  onFrame: (frame: Uint8Array, index: number) => void,
+  signal?: AbortSignal,
+): Promise<number> {
+  if (![width, height].every((n) => Number.isInteger(n) && n > 0)) {
+    throw new Error(`Invalid decode size: ${width}x${height}`);
+  }
+  const { available, path } = await getFFmpegCapabilities();
+  if (!available || !path) {
+    throw new Error('ffmpeg is not available to decode the video');
+  }
+
+  const args = [
+    '-hide_banner',
+    '-loglevel',
+    'error',
+    '-i',
+    inputPath,
+    '-vf',
+    `scale=${width}:${height}`,
+    '-fps_mode',
+    'passthrough',
+    '-f',
+    'rawvideo',
+    '-pix_fmt',
+    'yuv420p',
+    'pipe:1',
+  ];
+
+  throwIfAborted(signal);
+  const child = spawn(path, args, { signal });
+  let stderr = '';
+  child.stderr.setEncoding('utf8');
+  child.stderr.on('data', (text: string) => {
+    stderr = (stderr + text).slice(-4096);
+  });
+  const exited = once(child, 'close');
+  exited.catch(() => {}); // Awaited once stdout has been read
+
+  // Reassemble frames from however stdout happens to be chunked
+  const frameSize = i420Size(width, height);
+  const frame = new Uint8Array(frameSize);
+  let filled = 0;
+  let count = 0;
+  for await (const chunk of child.stdout as AsyncIterable<Uint8Array>) {
+    let offset = 0;
+    while (offset < chunk.length) {
+      const n = Math.min(frameSize - filled, chunk.length - offset);
+      frame.set(chunk.subarray(offset, offset + n), filled);
+      filled += n;
+      offset += n;
+      if (filled === frameSize) {
+        onFrame(frame, count++);
+        filled = 0;
+      }
+    }
+  }
+
+  const [code] = await exited;
+  if (code !== 0) {
+    throw new Error(`ffmpeg exited with code ${code}: ${stderr.trim()}`);
+  }
+  return count;
+}
+
+/**
+ * Arguments that place keyframes at the given times
+ * x264 would otherwise add its own scene cuts on top, so its detection is
+ * turned off; its keyframe interval cap still applies.
+ */
+function keyframeArgs(
+  encoder: string,
+  timesMs: number[] | undefined,
+): string[] {
+  if (!timesMs || timesMs.length === 0) {
+    return [];
+  }
+  const times = timesMs.map((t) => (t / 1000).toFixed(3)).join(',');
+  return [
+    '-force_key_frames',
+    times,
+    ...(encoder === 'libx264' ? ['-sc_threshold', '0'] : []),
+  ];
+}
+
+/**
+ * Write frames to ffmpeg's stdin, waiting whenever the pipe is full
+ * Write errors mean ffmpeg exited early; its exit status reports why.
+ */
+async function writeFrames(
+  stdin: Writable | null,
+  frames: Uint8Array[],
+): Promise<void> {
+  if (!stdin) {
+    return;
+  }
+  stdin.on('error', () => {});
+  try {
+    for (const frame of frames) {
+      if (!stdin.write(frame)) {
+        await Promise.race([once(stdin, 'drain'), once(stdin, 'close')]);
+      }
+    }
+  } catch {
+    // Reported by the ffmpeg process instead
+  } finally {
+    stdin.end();
+  }
+}
+
+/**
+ * Check settings that end up in ffmpeg's arguments, and that ffmpeg is
+ * installed. Returns the path of the ffmpeg binary.
+ */
+async function checkEncoderSettings(
+  options: OptimizeOptions,
+): Promise<string> {
+  const { crf = 23, keyframeTimesMs, preset = 'medium' } = options;
+
+  // Options may come from untrusted input (e.g. the daemon) and end up in
+  // ffmpeg's arguments, so only known presets and numeric values are passed on
+  if (!Object.hasOwn(AV1_SPEED, preset) || !Number.isFinite(crf)) {
+    throw new Error(`Invalid encoder settings: preset ${preset}, crf ${crf}`);
+  }
+  if (keyframeTimesMs?.some((t) => !(Number.isFinite(t) && t >= 0))) {
+    throw new Error('Invalid keyframe times');
+  }
+
+  // Check if ffmpeg is available
+  const { available, path } = await getFFmpegCapabilities();
+  if (!available || !path) {
+    throw new Error(
+      'ffmpeg is not available. Install ffmpeg to enable automatic optimization.\n' +
+        'See installation instructions: https://ffmpeg.org/download.html',
+    );
+  }
+  return path;
+}
+
+/**
+ * Build the ffmpeg arguments for one encode of an input
+ * The scale filter ensures dimensions are divisible by 2 (required for
+ * 4:2:0) and passes even-sized I420 input through without a swscale pass.
+ */
+function buildArgs(
+  input: VideoInput,
+  encoder: string,
+  rate: RateControl,
+  output: string[],
+  options: OptimizeOptions,
+): string[] {
+  const { keyframeTimesMs, preset = 'medium', scale = 1 } = options;
+  const safeScale = Number.isFinite(scale) && scale > 0 ? scale : 1;
+  return [
+    '-hide_banner',
+    '-loglevel',
+    'error', // Keep stderr well under execFile's maxBuffer
+    ...input.args,
+    '-vf',
+    safeScale === 1
+      ? 'scale=trunc(iw/2)*2:trunc(ih/2)*2' // Ensure even dimensions
+      : `scale=trunc(iw*${safeScale}/2)*2:trunc(ih*${safeScale}/2)*2`,
+    ...encoderArgs(encoder, preset, rate),
+    ...keyframeArgs(encoder, keyframeTimesMs),
+    '-pix_fmt',
+    'yuv420p', // Pixel format for compatibility
+    ...output,
+  ];
+}
+
+/**
+ * Run the optimization for one input, retrying when over maxBytes
+ * Throws, leaving no output, if the video cannot be brought under maxBytes.
+ */
+async function optimizeVideo(
+  input: VideoInput,
+  outputPath: string,
+  options: OptimizeOptions,
+): Promise<void> {
+  const { codec, crf = 23, durationMs, frameCount = 0, maxBytes, signal } =
+    options;
+
+  const ffmpegPath = await checkEncoderSettings(options);
+
+  if (maxBytes !== undefined && !(durationMs && durationMs > 0)) {
+    throw new Error('maxBytes requires the video duration (durationMs)');
+  }
+
+  const { encoder } = await resolveVideoCodec(codec);
+
+  const passLogFile = join(tmpdir(), `gif2vid-pass-${randomUUID()}`);
+
+  try {
+    // Run ffmpeg optimization
+    // Using the chosen codec with settings for small file size and good quality
+    const runFFmpeg = async (rate: RateControl, output: string[]) => {
+      const args = buildArgs(input, encoder, rate, output, options);
+
+      throwIfAborted(signal);
+      const running = execFileAsync(ffmpegPath, args, { signal });
+      if (input.frames) {
+        // Wait on both so an early exit is not left as an unhandled rejection
+        await Promise.all([
+          running,
+          writeFrames(running.child.stdin, input.frames),
+        ]);
+      } else {
+        await running;
+      }
+    };
+
+    const mp4Output = [
+      '-movflags',
+      '+faststart', // Enable streaming/fast start
+      '-y', // Overwrite output file
+      outputPath,
+    ];
+
+    if (maxBytes === undefined) {
+      await runFFmpeg({ crf }, mp4Output);
+    } else {
+      const { stat } = await import('node:fs/promises');
+      let bitrateKbps = targetBitrateKbps(
+        maxBytes,
+        durationMs ?? 0,
+        frameCount,
+      );
+
+      // Two passes let x264 distribute bits to hit the size accurately;
+      // other encoders get a single pass with a VBV cap
+      const encode = async () => {
+        if (encoder === 'libx264') {
+          await runFFmpeg({ bitrateKbps, pass: 1, passLogFile }, [
+            '-an',
+            '-f',
+            'null',
+            '-y',
+            '-',
+          ]);
+          await runFFmpeg({ bitrateKbps, pass: 2, passLogFile }, mp4Output);
+        } else {
+          await runFFmpeg({ bitrateKbps }, mp4Output);
+        }
+      };
+
+      await encode();
+
+      // Rate control is approximate; while the result overshoots, retry
+      // with the bitrate scaled down by the overshoot
+      let { size } = await stat(outputPath);
+      for (let attempt = 1; size > maxBytes; attempt++) {
+        if (attempt >= MAX_SIZE_ATTEMPTS) {
+          await unlink(outputPath).catch(() => {});
+          throw overMaxBytesError(size, maxBytes);
+        }
+        bitrateKbps = reducedBitrateKbps(bitrateKbps, size, maxBytes);
+        await encode();
+        ({ size } = await stat(outputPath));
+      }
+    }
+  } finally {
+    // x264 two-pass stats files
+    for (const suffix of ['-0.log', '-0.log.mbtree']) {
+      try {
+        await unlink(`${passLogFile}${suffix}`);
+      } catch {
+        // Ignore cleanup errors
+      }
+    }
+  }
+}
+
 /**
  * Get file size reduction percentage
  */
@@ -3,6 +3,7 @@
  * This module works in both Node.js and browser environments
  */
 import * as omggif from 'omggif';
+import { throwIfAborted } from './abort.js';
 
 const GifReader = omggif.GifReader;
 
@@ -13,58 +14,314 @@ export interface GifFrame {
   height: number;
 }
 
+export interface DecodeOptions {
+  allocate?: (size: number) => Uint8Array; // Storage for each frame's pixels
+  endMs?: number; // Stop decoding at this point in the animation
+  signal?: AbortSignal; // Checked between frames
+  startMs?: number; // Only return frames shown from this point on
+}
+
 export interface DecodedGif {
   frames: GifFrame[];
   width: number;
   height: number;
 }
 
+export interface FrameSelector {
+  index?: number; // Frame number, counting from 0
+  timeMs?: number; // Frame shown at this point in the animation
+}
+
+type FrameInfo = ReturnType<omggif.GifReader['frameInfo']>;
+
+// GIF disposal methods (what happens to a frame's area after it is shown)
+const DISPOSE_TO_BACKGROUND = 2;
+const DISPOSE_TO_PREVIOUS = 3;
+
 /**
- * Decode a GIF buffer into frames
+ * Frame delay in milliseconds, treating a zero delay as 100ms
  */
-export function decodeGif(
+export function frameDelayMs(
+  reader: omggif.GifReader,
+  index: number,
+): number {
+  return (reader.frameInfo(index).delay || 10) * 10; // Centiseconds to ms
+}
+
+/**
+ * How long a decoded frame is shown, treating a zero delay as 100ms as the
+ * converter does when it stores the frame
+ */
+export function frameDurationMs(frame: { delay: number }): number {
+  return frame.delay > 0 ? frame.delay : 100;
+}
+
+/**
+ * Find the frame shown at timeMs using only the frame headers
+ * Times past the end of the animation select the last frame.
+ */
+export function frameIndexAt(reader: omggif.GifReader, timeMs: number): number {
+  const numFrames = reader.numFrames();
+  let elapsed = 0;
+  for (let i = 0; i < numFrames; i++) {
+    elapsed += frameDelayMs(reader, i);
+    if (timeMs < elapsed) {
+      return i;
+    }
+  }
+  return numFrames - 1;
+}
+
+/**
+ * How long a frame starting at startTime is visible within a time range
+ * Returns 0 for frames entirely outside the range.
+ */
+export function visibleDuration(
+  startTime: number,
+  delay: number,
+  range: DecodeOptions,
+): number {
+  const { endMs = Infinity, startMs = 0 } = range;
+  return Math.max(
+    0,
+    Math.min(startTime + delay, endMs) - Math.max(startTime, startMs),
+  );
+}
+
+/**
+ * Composites frames onto a canvas the way a GIF viewer would, honouring
+ * each frame's disposal method and transparency
+ */
+export class GifCompositor {
+  readonly canvas: Uint8Array;
+  readonly height: number;
+  readonly width: number;
+
+  private pending: FrameInfo | null = null; // Last frame, not yet disposed
+  private saved: Uint8Array | null = null; // Canvas to restore after pending
+
+  constructor(width: number, height: number) {
+    this.canvas = new Uint8Array(width * height * 4);
+    this.height = height;
+    this.width = width;
+  }
+
+  /**
+   * Draw a frame over what is currently shown
+   * The returned canvas is reused for later frames; copy it to keep it.
+   */
+  draw(reader: omggif.GifReader, index: number): Uint8Array {
+    this.disposePending();
+    const info = reader.frameInfo(index);
+    if (info.disposal === DISPOSE_TO_PREVIOUS) {
+      this.saved = this.canvas.slice();
+    }
+    reader.decodeAndBlitFrameRGBA(index, this.canvas);
+    this.pending = info;
+    return this.canvas;
+  }
+
+  /**
+   * Account for a frame without decoding it, when its pixels cannot show
+   * through to any later frame. Returns false if the frame must be drawn.
+   */
+  skip(reader: omggif.GifReader, index: number): boolean {
+    const info = reader.frameInfo(index);
+    if (info.disposal === DISPOSE_TO_BACKGROUND) {
+      // Its area is cleared afterwards whatever it contained
+      this.disposePending();
+      this.pending = info;
+      return true;
+    }
+    if (info.disposal === DISPOSE_TO_PREVIOUS) {
+      // The canvas is put back exactly as it was
+      this.disposePending();
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Apply the disposal method of the last frame drawn
+   */
+  private disposePending(): void {
+    const info = this.pending;
+    this.pending = null;
+    if (!info) {
+      return;
+    }
+
+    if (info.disposal === DISPOSE_TO_BACKGROUND) {
+      // Browsers clear to transparent rather than the background colour
+      const { height, width } = this;
+      const right = Math.min(width, info.x + info.width);
+      const bottom = Math.min(height, info.y + info.height);
+      for (let y = info.y; y < bottom; y++) {
+        this.canvas.fill(0, (y * width + info.x) * 4, (y * width + right) * 4);
+      }
+    } else if (info.disposal === DISPOSE_TO_PREVIOUS && this.saved) {
+      this.canvas.set(this.saved);
+      this.saved = null;
+    }
+  }
+}
+
+/**
+ * The earliest frame that compositing up to target has to start from
+ * Frames before a fully opaque full-canvas frame, or before a full-canvas
+ * frame that is disposed to background, never show through.
+ */
+export function compositeStart(
+  reader: omggif.GifReader,
+  target: number,
+): number {
+  const covers = (info: FrameInfo) =>
+    info.x === 0 &&
+    info.y === 0 &&
+    info.width === reader.width &&
+    info.height === reader.height;
+
+  for (let i = target; i > 0; i--) {
+    const info = reader.frameInfo(i);
+    // omggif reports frames without a transparent colour as null
+    if (covers(info) && (info.transparent_index as number | null) === null) {
+      return i;
+    }
+    const previous = reader.frameInfo(i - 1);
+    if (covers(previous) && previous.disposal === DISPOSE_TO_BACKGROUND) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Decode the fully composited image of a single frame
+ * Only frames that can affect the result are decoded: compositing starts at
+ * the last point where the canvas is known to be blank or fully covered,
+ * and frames whose pixels are disposed before the target are skipped.
+ */
+export function decodeCompositedFrame(
   gifBuffer: Uint8Array | ArrayBuffer | any,
-): DecodedGif {
-  // Convert to Uint8Array if needed
-  let uint8Array: Uint8Array;
+  selector: FrameSelector = {},
+): GifFrame {
+  const reader = new GifReader(toUint8Array(gifBuffer));
+  const numFrames = reader.numFrames();
+  if (numFrames === 0) {
+    throw new Error('GIF contains no frames');
+  }
+
+  const target =
+    selector.timeMs !== undefined
+      ? frameIndexAt(reader, Math.max(0, selector.timeMs))
+      : (selector.index ?? 0);
+  if (!Number.isInteger(target) || target < 0 || target >= numFrames) {
+    throw new Error(
+      `Frame index ${target} is out of range (GIF has ${numFrames} frames)`,
+    );
+  }
+
+  const compositor = new GifCompositor(reader.width, reader.height);
+  for (let i = compositeStart(reader, target); i < target; i++) {
+    if (!compositor.skip(reader, i)) {
+      compositor.draw(reader, i);
+    }
+  }
+
+  return {
+    data: compositor.draw(reader, target),
+    delay: frameDelayMs(reader, target),
+    height: reader.height,
+    width: reader.width,
+  };
+}
+
+/**
+ * Convert the supported GIF input types to a Uint8Array
+ */
+function toUint8Array(gifBuffer: Uint8Array | ArrayBuffer | any): Uint8Array {
   if (gifBuffer instanceof Uint8Array) {
-    uint8Array = gifBuffer;
+    return gifBuffer;
   } else if (gifBuffer instanceof ArrayBuffer) {
-    uint8Array = new Uint8Array(gifBuffer);
+    return new Uint8Array(gifBuffer);
   } else if (typeof Buffer !== 'undefined' && gifBuffer instanceof Buffer) {
-    uint8Array = new Uint8Array(gifBuffer);
+    return new Uint8Array(gifBuffer);
   } else if (gifBuffer.buffer instanceof ArrayBuffer) {
     // Handle TypedArray views
-    uint8Array = new Uint8Array(
+    return new Uint8Array(
       gifBuffer.buffer,
       gifBuffer.byteOffset,
       gifBuffer.byteLength,
     );
-  } else {
-    uint8Array = gifBuffer;
   }
+  return gifBuffer;
+}
+
+/**
+ * Decode a GIF buffer into composited frames
+ * With startMs/endMs only the frames shown in that range are returned, with
+ * their delays clipped to it. Frames after the range are never decoded and
+ * frames before it only when they show through to the first frame returned.
+ */
+export function decodeGif(
+  gifBuffer: Uint8Array | ArrayBuffer | any,
+  options: DecodeOptions = {},
+): DecodedGif {
+  const { allocate, endMs, signal, startMs } = options;
 
   // Parse GIF
-  const reader = new GifReader(uint8Array);
+  const reader = new GifReader(toUint8Array(gifBuffer));
   const frames: GifFrame[] = [];
 
   const width = reader.width;
   const height = reader.height;
   const numFrames = reader.numFrames();
 
-  // Decode each frame
-  for (let i = 0; i < numFrames; i++) {
-    const frameInfo = reader.frameInfo(i);
+  // Find the frames in range from the frame headers alone
+  let first = -1;
+  let last = -1;
+  const durations: number[] = [];
+  for (let i = 0, time = 0; i < numFrames; i++) {
+    const delay = frameDelayMs(reader, i);
+    if (endMs !== undefined && time >= endMs) {
+      break;
+    }
+    durations[i] = visibleDuration(time, delay, options);
+    if (durations[i] > 0) {
+      first = first < 0 ? i : first;
+      last = i;
+    }
+    time += delay;
+  }
 
-    // Allocate RGBA buffer for the frame
-    const pixelData = new Uint8Array(width * height * 4);
+  if (first < 0) {
+    if (numFrames > 0 && (startMs !== undefined || endMs !== undefined)) {
+      const end = endMs === undefined ? 'the end' : `${endMs}ms`;
+      throw new Error(`No frames between ${startMs ?? 0}ms and ${end}`);
+    }
+    return { frames, height, width };
+  }
 
-    // Decode frame into RGBA buffer
-    reader.decodeAndBlitFrameRGBA(i, pixelData);
+  // Bring the canvas up to date for the first frame in range
+  const compositor = new GifCompositor(width, height);
+  for (let i = compositeStart(reader, first); i < first; i++) {
+    throwIfAborted(signal);
+    if (!compositor.skip(reader, i)) {
+      compositor.draw(reader, i);
+    }
+  }
 
+  // Decode each frame
+  for (let i = first; i <= last; i++) {
+    throwIfAborted(signal);
+    const canvas = compositor.draw(reader, i);
+    const data = allocate
+      ? allocate(canvas.length)
+      : new Uint8Array(canvas.length);
+    data.set(canvas);
     frames.push({
-      data: pixelData,
-      delay: (frameInfo.delay || 10) * 10, // Convert centiseconds to milliseconds
+      data,
+      delay: durations[i],
       height,
       width,
     });
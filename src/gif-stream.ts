@@ -0,0 +1,336 @@
+/**
+ * Incremental GIF decoding from streams
+ * Blocks are parsed as bytes arrive and each frame is decoded as soon as its
+ * image data is complete, so decoding overlaps the download.
+ * Works in both Node.js and browser environments.
+ */
+import * as omggif from 'omggif';
+import { throwIfAborted } from './abort.js';
+import {
+  type DecodeOptions,
+  frameDelayMs,
+  GifCompositor,
+  type GifFrame,
+  visibleDuration,
+} from './gif-decoder.js';
+
+const GifReader = omggif.GifReader;
+
+// Node Readable streams are async iterables of Buffers; web streams are read
+// through their reader, since not every browser makes them iterable
+export type GifByteStream =
+  | AsyncIterable<Uint8Array>
+  | ReadableStream<Uint8Array>;
+
+const TRAILER = new Uint8Array([0x3b]);
+
+/**
+ * Push-based GIF parser
+ * push() appends bytes, next() returns the next complete frame or null when
+ * more bytes are needed. Frames are composited, and with startMs/endMs only
+ * those shown in that range are returned.
+ */
+export class GifStreamDecoder {
+  height = 0;
+  width = 0;
+
+  private buffer = new Uint8Array(64 * 1024);
+  private compositor: GifCompositor | null = null;
+  private done = false;
+  private elapsed = 0; // Start time of the next frame
+  private end = 0; // Bytes held in buffer
+  private graphicControl: Uint8Array | null = null; // Last GCE, as omggif keeps it
+  private head: Uint8Array | null = null; // Header, screen descriptor, palette
+  private offset = 0; // Start of the next unparsed block
+  private range: DecodeOptions;
+  private scan = 0; // Resume point for the sub-block scan of the current block
+
+  constructor(range: DecodeOptions = {}) {
+    this.range = range;
+  }
+
+  /**
+   * True once the trailer, or the end of the requested range, was reached
+   */
+  isDone(): boolean {
+    return this.done;
+  }
+
+  /**
+   * Append bytes received from the stream
+   */
+  push(chunk: Uint8Array): void {
+    if (this.done) {
+      return; // Anything after the trailer is ignored, as omggif does
+    }
+
+    if (this.end + chunk.length > this.buffer.length) {
+      // Drop parsed bytes first, then grow if the pending block still won't fit
+      const pending = this.buffer.subarray(this.offset, this.end);
+      const needed = pending.length + chunk.length;
+      const target =
+        needed > this.buffer.length
+          ? new Uint8Array(Math.max(needed, this.buffer.length * 2))
+          : this.buffer;
+      target.set(pending);
+      this.buffer = target;
+      this.scan -= this.offset;
+      this.end = pending.length;
+      this.offset = 0;
+    }
+
+    this.buffer.set(chunk, this.end);
+    this.end += chunk.length;
+  }
+
+  /**
+   * Parse up to the next complete frame and decode it
+   */
+  next(): GifFrame | null {
+    while (!this.done) {
+      const result = this.parseBlock();
+      if (result === null) {
+        return null;
+      }
+      if (result !== true) {
+        return result;
+      }
+    }
+    return null;
+  }
+
+  /**
+   * Check that the stream ended on a block boundary
+   */
+  finish(): void {
+    if (!this.head) {
+      throw new Error('GIF stream ended before the header');
+    }
+    if (!this.done && this.offset < this.end) {
+      throw new Error('GIF stream ended in the middle of a block');
+    }
+  }
+
+  /**
+   * Parse one block. Returns a frame for image blocks, true for other
+   * blocks, or null when the block is not complete yet.
+   */
+  private parseBlock(): GifFrame | true | null {
+    const buf = this.buffer;
+    const p = this.offset;
+    const available = this.end - p;
+
+    if (!this.head) {
+      if (available < 13) {
+        return null;
+      }
+      const signature = String.fromCharCode(...buf.subarray(p, p + 6));
+      if (signature !== 'GIF87a' && signature !== 'GIF89a') {
+        throw new Error('Invalid GIF 87a/89a header.');
+      }
+      const packed = buf[p + 10];
+      const paletteSize = packed & 0x80 ? 3 << ((packed & 0x7) + 1) : 0;
+      if (available < 13 + paletteSize) {
+        return null;
+      }
+      this.width = buf[p + 6] | (buf[p + 7] << 8);
+      this.height = buf[p + 8] | (buf[p + 9] << 8);
+      this.head = buf.slice(p, p + 13 + paletteSize);
+      this.compositor = new GifCompositor(this.width, this.height);
+      this.consume(13 + paletteSize);
+      return true;
+    }
+
+    if (available < 1) {
+      return null;
+    }
+
+    switch (buf[p]) {
+      case 0x21: {
+        // Extension: label, then data sub-blocks
+        const blockEnd = this.subBlocksEnd(p + 2);
+        if (blockEnd < 0) {
+          return null;
+        }
+        if (buf[p + 1] === 0xf9) {
+          this.graphicControl = buf.slice(p, blockEnd);
+        }
+        this.consume(blockEnd - p);
+        return true;
+      }
+      case 0x2c: {
+        // Image descriptor, optional local palette, LZW code size, sub-blocks
+        if (available < 10) {
+          return null;
+        }
+        const packed = buf[p + 9];
+        const paletteSize = packed & 0x80 ? 3 << ((packed & 0x7) + 1) : 0;
+        const blockEnd = this.subBlocksEnd(p + 10 + paletteSize + 1);
+        if (blockEnd < 0) {
+          return null;
+        }
+        const frame = this.decodeImage(buf.subarray(p, blockEnd));
+        this.consume(blockEnd - p);
+        return frame;
+      }
+      case 0x3b:
+        this.done = true;
+        this.consume(1);
+        return true;
+      default:
+        throw new Error(`Unknown GIF block: 0x${buf[p].toString(16)}`);
+    }
+  }
+
+  /**
+   * Find the end of a run of data sub-blocks starting at start, or -1 if the
+   * terminator has not arrived yet. Scanning resumes where it left off, so a
+   * large frame trickling in is only scanned once.
+   */
+  private subBlocksEnd(start: number): number {
+    let q = Math.max(start, this.scan);
+    while (q < this.end) {
+      const size = this.buffer[q];
+      if (size === 0) {
+        return q + 1;
+      }
+      q += size + 1;
+    }
+    this.scan = q;
+    return -1;
+  }
+
+  /**
+   * Advance past a parsed block
+   */
+  private consume(length: number): void {
+    this.offset += length;
+    this.scan = this.offset;
+  }
+
+  /**
+   * Decode a complete image block by wrapping it in a single-frame GIF
+   * omggif only works on whole files, so the frame is given the stream's
+   * header and palette, plus the graphic control block in effect.
+   * Returns true for frames outside the requested range.
+   */
+  private decodeImage(image: Uint8Array): GifFrame | true {
+    const head = this.head as Uint8Array;
+    const control = this.graphicControl ?? new Uint8Array(0);
+    const gif = new Uint8Array(
+      head.length + control.length + image.length + TRAILER.length,
+    );
+    gif.set(head, 0);
+    gif.set(control, head.length);
+    gif.set(image, head.length + control.length);
+    gif.set(TRAILER, gif.length - TRAILER.length);
+
+    // Reading the frame header does not touch the LZW data
+    const reader = new GifReader(gif);
+    const compositor = this.compositor as GifCompositor;
+    const startTime = this.elapsed;
+    const delay = frameDelayMs(reader, 0);
+    this.elapsed += delay;
+
+    const { endMs } = this.range;
+    if (endMs !== undefined && startTime >= endMs) {
+      // Nothing after the range needs parsing
+      this.done = true;
+      return true;
+    }
+
+    const duration = visibleDuration(startTime, delay, this.range);
+    if (duration === 0) {
+      // Before the range: only what it leaves on the canvas matters
+      if (!compositor.skip(reader, 0)) {
+        compositor.draw(reader, 0);
+      }
+      return true;
+    }
+
+    return {
+      data: compositor.draw(reader, 0).slice(),
+      delay: duration,
+      height: this.height,
+      width: this.width,
+    };
+  }
+}
+
+/**
+ * Read chunks from a Node Readable, web ReadableStream or async iterable
+ * Aborting cancels the underlying stream so a stalled upload does not keep
+ * the conversion waiting past its deadline.
+ */
+async function* readChunks(
+  input: GifByteStream,
+  signal?: AbortSignal,
+): AsyncGenerator<Uint8Array> {
+  throwIfAborted(signal);
+
+  if ('getReader' in input) {
+    const reader = input.getReader();
+    const onAbort = () => {
+      reader.cancel(signal?.reason).catch(() => {});
+    };
+    signal?.addEventListener('abort', onAbort, { once: true });
+    let finished = false;
+    try {
+      while (true) {
+        const { done, value } = await reader.read();
+        throwIfAborted(signal);
+        if (done) {
+          finished = true;
+          return;
+        }
+        yield value;
+      }
+    } finally {
+      signal?.removeEventListener('abort', onAbort);
+      // Stopped early (e.g. past endMs): the rest of the stream is not needed
+      if (!finished) {
+        await reader.cancel().catch(() => {});
+      }
+      reader.releaseLock();
+    }
+  }
+
+  // Node Readable streams end iteration with an error when destroyed
+  const destroyable = input as { destroy?: (error?: unknown) => void };
+  const onAbort = () => destroyable.destroy?.(signal?.reason);
+  signal?.addEventListener('abort', onAbort, { once: true });
+  try {
+    for await (const chunk of input) {
+      throwIfAborted(signal);
+      yield chunk;
+    }
+  } finally {
+    signal?.removeEventListener('abort', onAbort);
+  }
+}
+
+/**
+ * Decode a GIF from a stream, yielding each frame as soon as it is complete
+ */
+export async function* decodeGifStream(
+  input: GifByteStream,
+  options: DecodeOptions = {},
+): AsyncGenerator<GifFrame> {
+  const { signal } = options;
+  const decoder = new GifStreamDecoder(options);
+
+  for await (const chunk of readChunks(input, signal)) {
+    decoder.push(chunk);
+    let frame = decoder.next();
+    while (frame) {
+      throwIfAborted(signal);
+      yield frame;
+      frame = decoder.next();
+    }
+    if (decoder.isDone()) {
+      break; // Stops reading the rest of the input
+    }
+  }
+
+  decoder.finish();
+}
@@ -1,23 +1,113 @@
-import { decodeGif } from './gif-decoder.js';
+import type { Readable } from 'node:stream';
+import type { ReadableStream as NodeReadableStream } from 'node:stream/web';
+import { createJobSignal, isDeadlineAbort, throwIfAborted } from './abort.js';
+import { autoCropFrames, type CropAlignment } from './auto-crop.js';
+import { acquireBuffer, releaseBuffer } from './buffer-pool.js';
+import {
+  calibrateBackends,
+  isBackendCalibrationEnabled,
+  type OptimizationBackend,
+  recordBackendTiming,
+  selectBackend,
+  syntheticFrames,
+} from './backend-selection.js';
+import {
+  type EncodeWorkload,
+  type EncoderSettings,
+  isX264Preset,
+  MAX_SIZE_ATTEMPTS,
+  overMaxBytesError,
+  recordEncodeTiming,
+  reducedBitrateKbps,
+  sampleFrameRuns,
+  searchCrfForSsim,
+  selectEncoderSettings,
+  targetBitrateKbps,
+  wasmEncoderSpeed,
+} from './encoder-tuning.js';
+import type { OptimizeOptions, VideoCodec } from './ffmpeg.js';
+import {
+  decodeCompositedFrame,
+  decodeGif,
+  type DecodeOptions,
+  frameDurationMs,
+  type FrameSelector,
+  type GifFrame,
+  visibleDuration,
+} from './gif-decoder.js';
+import { decodeGifStream, type GifByteStream } from './gif-stream.js';
+import { keyframeTimesMs } from './keyframes.js';
+import { createQualityMeter } from './quality.js';
+import {
+  acquireWasmModule,
+  cropI420,
+  i420Size,
+  type PixelFormat,
+  type PixelFrame,
+  releaseWasmModule,
+  type WasmModule,
+  withHeapFrame,
+} from './wasm-module.js';
+import type { WasmEncoderOptions } from './webcodecs.js';
 
-interface WasmModule {
-  _free: (ptr: number) => void;
-  _malloc: (size: number) => number;
-  cwrap: (
-    name: string,
-    returnType: string | null,
-    argTypes: string[],
-  ) => (...args: unknown[]) => unknown;
-  getValue: (ptr: number, type: string) => number;
-  HEAPU8: Uint8Array;
-}
+export type { CropAlignment } from './auto-crop.js';
+export type { BufferPoolStats } from './buffer-pool.js';
+export type { GifByteStream } from './gif-stream.js';
+export type {
+  PixelFormat,
+  WasmHeapPolicy,
+  WasmHeapStats,
+} from './wasm-module.js';
+export { setBackendCalibration } from './backend-selection.js';
+export { getBufferPoolStats, setBufferPoolLimit } from './buffer-pool.js';
+export { getWasmHeapStats, setWasmHeapPolicy } from './wasm-module.js';
 
 export interface ConversionOptions {
+  autoCrop?: boolean | CropAlignment; // Crop static borders (true = 'even')
+  codec?: VideoCodec; // 'h264' | 'hevc' | 'av1' via ffmpeg, falls back when unavailable
+  crf?: number; // Quality for compressed output (0-51, lower = better, default: 23)
+  deadlineMs?: number; // Abort the conversion after this many milliseconds
+  endMs?: number; // Trim the animation to end at this time
   fps?: number;
   height?: number;
+  latencyBudgetMs?: number; // Pick the encoder preset expected to finish in time
+  maxBytes?: number; // Keep the compressed output under this many bytes
+  partialOnDeadline?: boolean; // On a missed deadline, return the unoptimized MP4
+  preset?: string; // x264 preset (default: 'medium', ignored with latencyBudgetMs)
+  signal?: AbortSignal; // Abort the conversion when this signal fires
+  startMs?: number; // Trim the animation to start at this time
+  targetSsim?: number; // Use the highest crf whose SSIM meets this (0-1), via ffmpeg
   width?: number;
 }
 
+export interface ConcatOptions
+  extends Omit<ConversionOptions, 'autoCrop' | 'endMs' | 'startMs'> {
+  // How GIFs of another size fill the canvas: 'contain' letterboxes them,
+  // keeping their aspect ratio, 'fill' stretches them (default: 'contain')
+  fit?: 'contain' | 'fill';
+}
+
+export interface EncoderTrial {
+  backend: OptimizationBackend; // 'wasm-encoder' only takes h264 at scale 1
+  codec: VideoCodec;
+  crf: number;
+  preset: string;
+  scale: number; // Output size relative to the GIF
+}
+
+export interface EncoderTrialResult extends EncoderTrial {
+  bytes: number;
+  encodeMs: number;
+  psnr: number; // dB against the GIF's frames, over all planes
+  ssim: number; // Mean against the GIF's frames, 0-1
+}
+
+export interface ExtractFrameOptions extends FrameSelector {
+  format?: 'jpeg' | 'png'; // Output image format (default: 'png')
+  quality?: number; // JPEG quality, 1-100 (default: 85)
+  width?: number; // Scale to this width, keeping the aspect ratio
+}
+
 export interface FrameInput {
   data: ImageData;
   delayMs: number;
@@ -25,25 +115,54 @@ export interface FrameInput {
 
 interface ImageData {
   data: Uint8Array | Uint8ClampedArray | Buffer;
+  format?: PixelFormat; // Layout of data (default: 'rgba', as in a canvas)
+  height: number;
+  palette?: Uint8Array; // RGB triples, required for 'indexed'
+  stride?: number; // Bytes from one row to the next (default: packed rows)
+  width: number;
+}
+
+// Pixel layouts the converter can store frames in (see gif2vid.c)
+const VIDEO_FORMAT_RGB24 = 0;
+const VIDEO_FORMAT_I420 = 1;
+
+// convertGifToStream hands out chunks of at most 256KB and pauses the
+// conversion while 1MB is waiting to be read
+const STREAM_CHUNK_BYTES = 256 * 1024;
+const STREAM_BUFFER_BYTES = 1024 * 1024;
+
+interface EncoderFrame extends PixelFrame {
+  delay: number;
+}
+
+// The converter's I420 frames for a job, wherever they currently are
+interface ReferenceFrames {
+  delays: number[];
+  frameAt: (index: number) => Promise<Uint8Array>;
   height: number;
   width: number;
 }
 
 /**
- * Get WASM module path for current environment
+ * Heap the converter needs to store frameCount frames, with room for the
+ * frame being added and the MP4 header
  */
-async function getWasmModulePath(): Promise<string> {
-  if (typeof window === 'undefined') {
-    // Node.js environment - use node-specific build
-    const { join } = await import('node:path');
-    return join(import.meta.dirname, '../converter/wasm/gif2vid-node.js');
-  } else {
-    // Browser environment - use web-specific build
-    const scriptUrl = new URL(import.meta.url);
-    return new URL('../../converter/wasm/gif2vid-web.js', scriptUrl).href;
-  }
+function converterHeapBytes(
+  width: number,
+  height: number,
+  frameCount: number,
+  format: number,
+): number {
+  const frameBytes =
+    format === VIDEO_FORMAT_I420 ? i420Size(width, height) : width * height * 3;
+  const stackAndStatics = 4 * 1024 * 1024;
+  return frameCount * (frameBytes + 64) + width * height * 4 + stackAndStatics;
 }
 
+// Share of each frame's blocks that changed since the previous frame (0-1),
+// or null where the converter did not analyse it
+type FrameChanges = Array<number | null>;
+
 /**
  * Resolve the output path, handling both file and directory destinations
  * Only available in Node.js
@@ -79,134 +198,1023 @@ async function resolveOutputPath(
 }
 
 /**
- * Optimize MP4 buffer - uses ffmpeg in Node.js or WASM H.264 encoder in browser
+ * Resolve the encoder settings for a job, honouring a latency budget if given
  */
-async function optimizeMP4Buffer(
+function resolveEncoderSettings(
+  workload: EncodeWorkload,
+  options: ConversionOptions,
+): EncoderSettings {
+  const { crf = 23, latencyBudgetMs, preset = 'medium' } = options;
+
+  if (latencyBudgetMs !== undefined) {
+    return selectEncoderSettings(workload, latencyBudgetMs, crf);
+  }
+
+  return {
+    crf,
+    preset: isX264Preset(preset) ? preset : 'medium',
+    scale: 1,
+  };
+}
+
+/**
+ * Work out what the optimization step will encode, and with which settings
+ */
+function planOptimization(
+  frames: Array<{ delay: number; height: number; width: number }>,
+  options: ConversionOptions,
+  changes?: FrameChanges,
+): {
+  durationMs: number;
+  keyframeTimesMs?: number[];
+  settings: EncoderSettings;
+  workload: EncodeWorkload;
+} {
+  const workload: EncodeWorkload = {
+    frames: frames.length,
+    height: frames[0]?.height ?? 0,
+    width: frames[0]?.width ?? 0,
+  };
+  const durationMs = frames.reduce(
+    (sum, frame) => sum + frameDurationMs(frame),
+    0,
+  );
+  return {
+    durationMs,
+    keyframeTimesMs: keyframeTimesMs(frames, changes),
+    settings: resolveEncoderSettings(workload, options),
+    workload,
+  };
+}
+
+/**
+ * Reference frames from the converter's parts (header, then frames)
+ */
+function partsReference(
+  parts: Uint8Array[],
+  frames: Array<{ delay: number; height: number; width: number }>,
+): ReferenceFrames {
+  return {
+    delays: frames.map((frame) => frame.delay),
+    frameAt: async (index) => parts[index + 1],
+    height: frames[0]?.height ?? 0,
+    width: frames[0]?.width ?? 0,
+  };
+}
+
+/**
+ * Reference frames from an unoptimized I420 MP4, in a buffer or a file
+ * The frames are the last samples of the moov-first layout, so they are
+ * found from the end without parsing the header.
+ * Only available in Node.js
+ */
+function rawMp4Reference(
+  video: Uint8Array | string,
+  frames: Array<{ delay: number; height: number; width: number }>,
+): ReferenceFrames {
+  const width = frames[0]?.width ?? 0;
+  const height = frames[0]?.height ?? 0;
+  const size = i420Size(width, height);
+  const framesStart = (length: number) => length - frames.length * size;
+
+  return {
+    delays: frames.map((frame) => frame.delay),
+    frameAt: async (index) => {
+      if (typeof video !== 'string') {
+        const offset = framesStart(video.length) + index * size;
+        return video.subarray(offset, offset + size);
+      }
+      const { open } = await import('node:fs/promises');
+      const handle = await open(video, 'r');
+      try {
+        const { size: length } = await handle.stat();
+        const frame = new Uint8Array(size);
+        await handle.read(frame, 0, size, framesStart(length) + index * size);
+        return frame;
+      } finally {
+        await handle.close();
+      }
+    },
+    height,
+    width,
+  };
+}
+
+/**
+ * The highest crf (smallest output) whose SSIM on a sample of the frames
+ * still meets targetSsim, keeping the plan's preset and scale
+ * Only available in Node.js
+ */
+async function tuneCrfForSsim(
+  targetSsim: number,
+  plan: ReturnType<typeof planOptimization>,
+  codec: VideoCodec | undefined,
+  reference: ReferenceFrames,
+  signal?: AbortSignal,
+): Promise<number> {
+  const { mkdtemp, rm } = await import('node:fs/promises');
+  const { tmpdir } = await import('node:os');
+  const { join } = await import('node:path');
+  const { resolveVideoCodec } = await import('./ffmpeg.js');
+
+  const sample = sampleFrameRuns(reference.delays.length);
+  const source = {
+    delays: sample.map((i) => reference.delays[i]),
+    frames: await Promise.all(sample.map((i) => reference.frameAt(i))),
+    height: reference.height,
+    rawPath: null,
+    width: reference.width,
+  };
+  const trial = {
+    backend: 'ffmpeg' as const,
+    codec: (await resolveVideoCodec(codec)).codec,
+    preset: plan.settings.preset,
+    scale: plan.settings.scale,
+  };
+
+  const dir = await mkdtemp(join(tmpdir(), 'gif2vid-ssim-'));
+  try {
+    return await searchCrfForSsim(targetSsim, async (crf) => {
+      const outputPath = join(dir, `${crf}.mp4`);
+      const result = await measureTrial(
+        source,
+        { ...trial, crf },
+        outputPath,
+        signal,
+      );
+      return result.ssim;
+    });
+  } finally {
+    await rm(dir, { force: true, recursive: true });
+  }
+}
+
+/**
+ * Run an ffmpeg optimization step and feed its timing back into calibration
+ * With targetSsim, crf is first tuned on reference, the job's frames.
+ * Only available in Node.js
+ */
+async function runFFmpegOptimization<T>(
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+  signal: AbortSignal | undefined,
+  reference: ReferenceFrames | null,
+  run: (ffmpegOptions: OptimizeOptions) => Promise<T>,
+): Promise<T> {
+  const { durationMs, workload } = plan;
+  const { codec, maxBytes, targetSsim } = options;
+  let { settings } = plan;
+  // maxBytes sets a bitrate instead, leaving crf unused
+  if (targetSsim !== undefined && maxBytes === undefined && reference) {
+    const crf = await tuneCrfForSsim(
+      targetSsim,
+      plan,
+      codec,
+      reference,
+      signal,
+    );
+    settings = { ...settings, crf };
+  }
+
+  const startTime = Date.now();
+  const result = await run({
+    ...settings,
+    codec,
+    durationMs,
+    frameCount: workload.frames,
+    keyframeTimesMs: plan.keyframeTimesMs,
+    maxBytes,
+    signal,
+  });
+
+  // Calibrate the x264 speed table for future latency budgets. A maxBytes
+  // encode runs two passes, plus retries when it overshoots, so its time
+  // says nothing about one pass at these settings
+  const elapsedMs = Date.now() - startTime;
+  if ((!codec || codec === 'h264') && maxBytes === undefined) {
+    recordEncodeTiming(workload, settings, elapsedMs);
+  }
+  recordSinglePassTiming('ffmpeg', plan, options, elapsedMs);
+  return result;
+}
+
+/**
+ * Feed a finished optimization back into the backend cost table
+ * Only single-pass H.264 encodes at the planned settings are comparable
+ * across backends: maxBytes runs two passes or retries, and targetSsim
+ * replaces the planned crf.
+ */
+function recordSinglePassTiming(
+  backend: OptimizationBackend,
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+  elapsedMs: number,
+): void {
+  const { codec, maxBytes, targetSsim } = options;
+  if (
+    (codec && codec !== 'h264') ||
+    maxBytes !== undefined ||
+    targetSsim !== undefined
+  ) {
+    return;
+  }
+  recordBackendTiming(backend, plan.workload, plan.settings.preset, elapsedMs);
+}
+
+/**
+ * Backends that can optimize a job in this environment, in order of
+ * preference. In Node.js the in-process H.264 encoder stands in for ffmpeg
+ * when it is not installed, and competes with it on speed when it is.
+ */
+async function optimizationBackends(
+  options: ConversionOptions,
+): Promise<OptimizationBackend[]> {
+  if (typeof window !== 'undefined') {
+    return ['wasm-encoder'];
+  }
+
+  const { getFFmpegCapabilities } = await import('./ffmpeg-registry.js');
+  const { loadWasmEncoder } = await import('./webcodecs.js');
+  const backends: OptimizationBackend[] = [];
+  if ((await getFFmpegCapabilities()).available) {
+    // Only ffmpeg output is measured against targetSsim, and only ffmpeg
+    // has a two-pass mode for hitting maxBytes
+    if (options.targetSsim !== undefined || options.maxBytes !== undefined) {
+      return ['ffmpeg'];
+    }
+    backends.push('ffmpeg');
+  }
+  // The WASM encoder only produces H.264
+  const h264 = !options.codec || options.codec === 'h264';
+  if (h264 && (await loadWasmEncoder())) {
+    backends.push('wasm-encoder');
+  }
+  // With neither, ffmpeg's error explains what is missing
+  return backends.length > 0 ? backends : ['ffmpeg'];
+}
+
+/**
+ * What the calibration of this machine's backends depends on
+ */
+async function calibrationKey(): Promise<string> {
+  if (typeof window !== 'undefined') {
+    return '';
+  }
+  const { availableParallelism, cpus } = await import('node:os');
+  const { getFFmpegCapabilities } = await import('./ffmpeg-registry.js');
+  const { version = 'none' } = await getFFmpegCapabilities();
+  return `${version}:${cpus()[0]?.model ?? ''}x${availableParallelism()}`;
+}
+
+/**
+ * Time one optimization of a synthetic workload, for calibration
+ * The encoders are called directly: these warm-up and tiny encodes say
+ * little about real jobs, so they must not feed the timing tables that
+ * runBackend updates.
+ */
+async function timeBackend(
+  backend: OptimizationBackend,
+  workload: EncodeWorkload,
+): Promise<number> {
+  const frames = syntheticFrames(workload);
+  const { changes, video } = await encodeFramesToMp4(
+    frames,
+    workload.width,
+    workload.height,
+  );
+  const plan = planOptimization(frames, {}, changes);
+
+  if (backend === 'wasm-encoder') {
+    const { encodeFramesWithWasmEncoder } = await import('./webcodecs.js');
+    const startTime = Date.now();
+    await encodeFramesWithWasmEncoder(frames, wasmEncoderOptions(plan, {}));
+    return Date.now() - startTime;
+  }
+
+  const { optimizeMP4 } = await import('./ffmpeg.js');
+  const startTime = Date.now();
+  await optimizeMP4(video instanceof Buffer ? video : Buffer.from(video), {
+    ...plan.settings,
+    durationMs: plan.durationMs,
+    frameCount: plan.workload.frames,
+    keyframeTimesMs: plan.keyframeTimesMs,
+  });
+  return Date.now() - startTime;
+}
+
+/**
+ * Pick the backend predicted to optimize this job fastest
+ * When there is a choice to make and calibration is enabled (see
+ * setBackendCalibration), the backends are calibrated in the background;
+ * until that finishes, jobs take the preferred backend rather than waiting
+ * for the calibration encodes.
+ */
+async function chooseBackend(
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+): Promise<OptimizationBackend> {
+  let candidates = await optimizationBackends(options);
+  // The WASM encoder cannot scale, so a plan that shrinks the video to meet
+  // a latency budget goes to ffmpeg whenever ffmpeg can take it
+  if (plan.settings.scale !== 1 && candidates.includes('ffmpeg')) {
+    candidates = candidates.filter((backend) => backend !== 'wasm-encoder');
+  }
+  if (candidates.length > 1 && isBackendCalibrationEnabled()) {
+    calibrateBackends(candidates, timeBackend, {
+      cacheKey: await calibrationKey(),
+    }).catch(() => {
+      // Uncalibrated backends are routed by preference
+    });
+  }
+  return selectBackend(plan.workload, candidates, plan.settings.preset);
+}
+
+/**
+ * Settings for the WASM H.264 encoder from an optimization plan
+ */
+function wasmEncoderOptions(
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): WasmEncoderOptions {
+  const { durationMs, settings, workload } = plan;
+  return {
+    bitrate:
+      options.maxBytes === undefined
+        ? undefined
+        : targetBitrateKbps(options.maxBytes, durationMs, workload.frames),
+    quantizationParameter: settings.crf,
+    signal,
+    speed: wasmEncoderSpeed(settings.preset),
+  };
+}
+
+/**
+ * Run a WASM H.264 encode, re-encoding at a lower bitrate while the output
+ * is over maxBytes. The encoder has no two-pass mode, so the first attempt
+ * can overshoot more than ffmpeg's does.
+ */
+async function encodeWithinMaxBytes(
+  encoderOptions: WasmEncoderOptions,
+  maxBytes: number | undefined,
+  encode: (encoderOptions: WasmEncoderOptions) => Promise<Uint8Array>,
+): Promise<Uint8Array> {
+  let { bitrate } = encoderOptions;
+  let video = await encode(encoderOptions);
+  if (maxBytes === undefined || bitrate === undefined) {
+    return video;
+  }
+  for (let attempt = 1; video.length > maxBytes; attempt++) {
+    if (attempt >= MAX_SIZE_ATTEMPTS) {
+      throw overMaxBytesError(video.length, maxBytes);
+    }
+    bitrate = reducedBitrateKbps(bitrate, video.length, maxBytes);
+    video = await encode({ ...encoderOptions, bitrate });
+  }
+  return video;
+}
+
+/**
+ * Encode width x height I420 frames with the WASM H.264 encoder
+ * Only available in Node.js
+ */
+async function encodeI420Frames(
+  frames: Uint8Array[],
+  delays: number[],
+  width: number,
+  height: number,
+  encoderOptions: WasmEncoderOptions,
+): Promise<Uint8Array> {
+  const { encodeI420WithWasmEncoder } = await import('./webcodecs.js');
+
+  // H.264 needs even dimensions; odd frames lose their last row or column
+  const evenWidth = Math.floor(width / 2) * 2;
+  const evenHeight = Math.floor(height / 2) * 2;
+  const scratch =
+    evenWidth === width && evenHeight === height
+      ? null
+      : new Uint8Array(i420Size(evenWidth, evenHeight));
+
+  return encodeI420WithWasmEncoder(
+    delays,
+    evenWidth,
+    evenHeight,
+    (index) =>
+      scratch
+        ? cropI420(frames[index], width, height, evenWidth, evenHeight, scratch)
+        : frames[index],
+    encoderOptions,
+  );
+}
+
+/**
+ * Encode the converter's I420 frames with the WASM H.264 encoder
+ * Only available in Node.js
+ */
+async function encodePartsWithWasmEncoder(
+  parts: Uint8Array[],
+  frames: Array<{ delay: number }>,
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): Promise<Uint8Array> {
+  const startTime = Date.now();
+  // parts[0] is the MP4 header; the frames follow it
+  const mp4 = await encodeWithinMaxBytes(
+    wasmEncoderOptions(plan, options, signal),
+    options.maxBytes,
+    (encoderOptions) =>
+      encodeI420Frames(
+        parts.slice(1),
+        frames.map((frame) => frame.delay),
+        plan.workload.width,
+        plan.workload.height,
+        encoderOptions,
+      ),
+  );
+  recordSinglePassTiming('wasm-encoder', plan, options, Date.now() - startTime);
+  return mp4;
+}
+
+/**
+ * Optimize the converter's I420 frames into outputPath with the WASM H.264
+ * encoder, writing the unoptimized MP4 there if that fails
+ * Only available in Node.js
+ */
+async function optimizePartsWithWasmEncoder(
+  parts: Uint8Array[],
+  frames: Array<{ delay: number }>,
+  plan: ReturnType<typeof planOptimization>,
+  outputPath: string,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): Promise<void> {
+  const { writeFile } = await import('node:fs/promises');
+
+  try {
+    const mp4 = await encodePartsWithWasmEncoder(
+      parts,
+      frames,
+      plan,
+      options,
+      signal,
+    );
+    await writeFile(outputPath, mp4, { signal });
+  } catch (error) {
+    const size = parts.reduce((sum, part) => sum + part.length, 0);
+    assertFallbackAllowed(error, size, options, signal);
+    await writeMp4Parts(outputPath, parts, signal);
+  }
+}
+
+/**
+ * Optimize an MP4 buffer with the given backend
+ */
+async function runBackend(
+  backend: OptimizationBackend,
   mp4Buffer: Buffer | Uint8Array,
-  frames?: Array<{
-    data: Uint8Array;
-    delay: number;
-    height: number;
-    width: number;
-  }>,
+  frames: EncoderFrame[],
+  plan: ReturnType<typeof planOptimization>,
+  options: ConversionOptions,
+  signal?: AbortSignal,
 ): Promise<Buffer | Uint8Array> {
-  const inBrowser = typeof window !== 'undefined';
-
-  if (inBrowser) {
-    // Use WASM H.264 encoder in browser (replaces buggy WebCodecs)
+  if (backend === 'wasm-encoder') {
     const { encodeFramesWithWasmEncoder } = await import('./webcodecs.js');
 
     if (!frames || frames.length === 0) {
       throw new Error(
-        'Browser optimization requires raw frames. ' +
+        'WASM encoder optimization requires raw frames. ' +
           'This is an internal error - please report this issue.',
       );
     }
 
     // Encode frames with WASM H.264 encoder
-    return encodeFramesWithWasmEncoder(frames);
-  } else {
-    // Use ffmpeg in Node.js
-    const { optimizeMP4 } = await import('./ffmpeg.js');
-    return optimizeMP4(
-      mp4Buffer instanceof Uint8Array ? Buffer.from(mp4Buffer) : mp4Buffer,
+    const startTime = Date.now();
+    const mp4 = await encodeWithinMaxBytes(
+      wasmEncoderOptions(plan, options, signal),
+      options.maxBytes,
+      (encoderOptions) => encodeFramesWithWasmEncoder(frames, encoderOptions),
     );
+    recordSinglePassTiming(
+      'wasm-encoder',
+      plan,
+      options,
+      Date.now() - startTime,
+    );
+    return mp4;
   }
+
+  const { optimizeMP4 } = await import('./ffmpeg.js');
+  return runFFmpegOptimization(
+    plan,
+    options,
+    signal,
+    rawMp4Reference(mp4Buffer, frames),
+    (ffmpegOptions) =>
+      optimizeMP4(
+        mp4Buffer instanceof Buffer ? mp4Buffer : Buffer.from(mp4Buffer),
+        ffmpegOptions,
+      ),
+  );
 }
 
 /**
- * Core function: Encode frames to MP4 buffer
+ * Optimize MP4 buffer with the backend predicted to be fastest for its size:
+ * ffmpeg in Node.js, the WASM H.264 encoder in the browser
  */
-async function encodeFramesToMp4(
-  frames: Array<{
-    data: Uint8Array;
-    delay: number;
-    height: number;
-    width: number;
-  }>,
+async function optimizeMP4Buffer(
+  mp4Buffer: Buffer | Uint8Array,
+  frames: EncoderFrame[],
+  changes: FrameChanges,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): Promise<Buffer | Uint8Array> {
+  const plan = planOptimization(frames, options, changes);
+  const backend = await chooseBackend(plan, options);
+
+  return runBackend(backend, mp4Buffer, frames, plan, options, signal);
+}
+
+/**
+ * Decide whether a failed optimization may fall back to the unoptimized MP4
+ * Cancellation is rethrown rather than treated as a failure, unless the
+ * deadline passed and the caller asked for a partial result.
+ */
+function assertFallbackAllowed(
+  error: unknown,
+  unoptimizedSize: number,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): void {
+  if (signal?.aborted) {
+    if (options.partialOnDeadline && isDeadlineAbort(signal)) {
+      return;
+    }
+    throw signal.reason;
+  }
+
+  // The unoptimized output is no use to a caller with a size limit
+  if (options.maxBytes !== undefined && unoptimizedSize > options.maxBytes) {
+    throw error;
+  }
+
+  // If optimization fails, continue with unoptimized output
+  console.warn(
+    'Optimization failed, using unoptimized output:',
+    (error as Error).message,
+  );
+}
+
+/**
+ * Optimize with the best available method, keeping the unoptimized buffer if
+ * optimization fails
+ */
+async function optimizeWithFallback(
+  mp4Buffer: Buffer | Uint8Array,
+  frames: EncoderFrame[],
+  changes: FrameChanges,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): Promise<Buffer | Uint8Array> {
+  try {
+    return await optimizeMP4Buffer(
+      mp4Buffer,
+      frames,
+      changes,
+      options,
+      signal,
+    );
+  } catch (error) {
+    assertFallbackAllowed(error, mp4Buffer.length, options, signal);
+    return mp4Buffer;
+  }
+}
+
+/**
+ * Optimize an unoptimized MP4 file into outputPath with ffmpeg, moving the
+ * unoptimized file into place if optimization fails
+ * Only available in Node.js
+ */
+async function optimizeFileWithFallback(
+  rawPath: string,
+  outputPath: string,
+  frames: Array<{ delay: number; height: number; width: number }>,
+  changes: FrameChanges,
+  options: ConversionOptions,
+  signal?: AbortSignal,
+): Promise<void> {
+  const { rename, stat } = await import('node:fs/promises');
+  const { optimizeMP4File } = await import('./ffmpeg.js');
+
+  try {
+    await runFFmpegOptimization(
+      planOptimization(frames, options, changes),
+      options,
+      signal,
+      rawMp4Reference(rawPath, frames),
+      (ffmpegOptions) => optimizeMP4File(rawPath, outputPath, ffmpegOptions),
+    );
+  } catch (error) {
+    const { size } = await stat(rawPath);
+    assertFallbackAllowed(error, size, options, signal);
+    await rename(rawPath, outputPath);
+  }
+}
+
+/**
+ * Core function: Encode frames with the WASM converter and pass the result on
+ * Frames may come from an async iterable, in which case each one is added as
+ * soon as it is produced. The consumer receives the MP4 as a list of parts -
+ * the header followed by each frame's data - viewing the WASM heap directly.
+ * The views are only valid until the consumer's promise settles.
+ * In Node.js frames are stored as I420, which ffmpeg encodes without a
+ * colour conversion; the browser keeps RGB24 for its unoptimized output.
+ * I420 frames are also scored against the previous frame as they are
+ * added, and the consumer gets the scores for keyframe placement.
+ */
+async function encodeFramesToMp4Parts<T>(
+  frames: Iterable<EncoderFrame> | AsyncIterable<EncoderFrame>,
   width: number,
   height: number,
-  fps: number = 10,
-): Promise<Buffer | Uint8Array> {
-  // Load WASM module
-  const wasmPath = await getWasmModulePath();
-  const createModule = await import(wasmPath).then((m) => m.default);
-  const Module = (await createModule()) as WasmModule;
+  fps: number,
+  signal: AbortSignal | undefined,
+  consume: (parts: Uint8Array[], changes: FrameChanges) => Promise<T> | T,
+): Promise<T> {
+  // Reuse a warm WASM module instance when one is available. When the frame
+  // count is known up front, the instance starts with the heap it will need.
+  const format =
+    typeof window === 'undefined' ? VIDEO_FORMAT_I420 : VIDEO_FORMAT_RGB24;
+  const Module = await acquireWasmModule(
+    Array.isArray(frames)
+      ? converterHeapBytes(width, height, frames.length, format)
+      : 0,
+  );
 
   // Initialize encoder
-  const initEncoder = Module.cwrap('init_encoder', 'number', [
+  const initEncoder = Module.cwrap('init_encoder_format', 'number', [
+    'number',
+    'number',
+    'number',
     'number',
+  ]) as (
+    width: number,
+    height: number,
+    fps: number,
+    format: number,
+  ) => number;
+  const addFramePixels = Module.cwrap('add_frame_pixels', 'number', [
     'number',
     'number',
-  ]) as (width: number, height: number, fps: number) => number;
-  const addFrame = Module.cwrap('add_frame', 'number', [
     'number',
     'number',
     'number',
     'number',
-  ]) as (ptr: number, width: number, height: number, delay: number) => number;
-  const getVideoSize = Module.cwrap(
-    'get_video_size',
+    'number',
+    'number',
+  ]) as (
+    pixels: number,
+    format: number,
+    stride: number,
+    width: number,
+    height: number,
+    palette: number,
+    paletteSize: number,
+    delay: number,
+  ) => number;
+  const getHeaderSize = Module.cwrap(
+    'get_header_size',
+    'number',
+    [],
+  ) as () => number;
+  const getHeaderBuffer = Module.cwrap(
+    'get_header_buffer',
     'number',
     [],
   ) as () => number;
-  const getVideoBuffer = Module.cwrap(
-    'get_video_buffer',
+  const getFrameCount = Module.cwrap(
+    'get_frame_count',
     'number',
     [],
   ) as () => number;
+  const getFrameSize = Module.cwrap('get_frame_size', 'number', [
+    'number',
+  ]) as (index: number) => number;
+  const getFrameBuffer = Module.cwrap('get_frame_buffer', 'number', [
+    'number',
+  ]) as (index: number) => number;
+  const getFrameChange = Module.cwrap('get_frame_change', 'number', [
+    'number',
+  ]) as (index: number) => number;
   const cleanup = Module.cwrap('cleanup', null, []) as () => void;
 
   try {
     // Initialize the encoder
-    const result = initEncoder(width, height, fps);
+    const result = initEncoder(width, height, fps, format);
     if (!result) {
       throw new Error('Failed to initialize video encoder');
     }
 
     // Add each frame to the video
-    for (let i = 0; i < frames.length; i++) {
-      const frame = frames[i];
-      const frameData = frame.data;
+    let i = 0;
+    for await (const frame of frames) {
+      // Stopping here leaves the finally block to free the WASM context
+      throwIfAborted(signal);
 
-      // Allocate memory in WASM heap
-      const dataPtr = Module._malloc(frameData.length);
-      Module.HEAPU8.set(frameData, dataPtr);
-
-      // Add frame to encoder with its delay
-      const addResult = addFrame(
-        dataPtr,
-        frame.width,
-        frame.height,
-        frame.delay,
+      // Frames go in as they are; the converter handles format and stride
+      const addResult = withHeapFrame(Module, frame, (heapFrame) =>
+        addFramePixels(
+          heapFrame.pixels,
+          heapFrame.format,
+          heapFrame.stride,
+          frame.width,
+          frame.height,
+          heapFrame.palette,
+          heapFrame.paletteSize,
+          frame.delay,
+        ),
       );
-      Module._free(dataPtr);
 
       if (!addResult) {
         throw new Error(`Failed to add frame ${i}`);
       }
+      i++;
     }
 
-    // Get the encoded video data
-    const videoSize = getVideoSize();
-    const videoBufferPtr = getVideoBuffer();
+    // Collect pointers first: building the header allocates, which may grow
+    // (and so replace) the heap buffer that the views are taken from
+    const spans: Array<[number, number]> = [
+      [getHeaderBuffer(), getHeaderSize()],
+    ];
+    const frameCount = getFrameCount();
+    const changes: FrameChanges = [];
+    for (let index = 0; index < frameCount; index++) {
+      spans.push([getFrameBuffer(index), getFrameSize(index)]);
+      const change = getFrameChange(index);
+      changes.push(change < 0 ? null : change / 1000);
+    }
 
-    // Copy video data from WASM memory
-    const videoData = new Uint8Array(
-      Module.HEAPU8.buffer,
-      videoBufferPtr as number,
-      videoSize as number,
+    const heap = Module.HEAPU8.buffer;
+    return await consume(
+      spans.map(([ptr, size]) => new Uint8Array(heap, ptr, size)),
+      changes,
     );
-
-    // Return Buffer in Node.js, Uint8Array in browser
-    if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
-      return Buffer.from(videoData);
-    }
-    return new Uint8Array(videoData);
   } finally {
     // Clean up
     cleanup();
+    releaseWasmModule(Module);
+  }
+}
+
+/**
+ * Encode frames to an unoptimized MP4 buffer, along with the per-frame
+ * change scores used for keyframe placement. With allocate, the MP4 is
+ * assembled in storage it provides.
+ */
+function encodeFramesToMp4(
+  frames: Iterable<EncoderFrame> | AsyncIterable<EncoderFrame>,
+  width: number,
+  height: number,
+  fps: number = 10,
+  signal?: AbortSignal,
+  allocate?: (size: number) => Uint8Array,
+): Promise<{ changes: FrameChanges; video: Buffer | Uint8Array }> {
+  return encodeFramesToMp4Parts(
+    frames,
+    width,
+    height,
+    fps,
+    signal,
+    (parts, changes) => {
+      // Return Buffer in Node.js, Uint8Array in browser
+      if (
+        !allocate &&
+        typeof Buffer !== 'undefined' &&
+        typeof window === 'undefined'
+      ) {
+        return { changes, video: Buffer.concat(parts) };
+      }
+
+      const total = parts.reduce((sum, part) => sum + part.length, 0);
+      const videoData = allocate ? allocate(total) : new Uint8Array(total);
+      let offset = 0;
+      for (const part of parts) {
+        videoData.set(part, offset);
+        offset += part.length;
+      }
+      return { changes, video: videoData };
+    },
+  );
+}
+
+/**
+ * Write MP4 parts to a file with writev, straight from the WASM heap, so the
+ * video is never assembled in memory. Only available in Node.js.
+ */
+async function writeMp4Parts(
+  path: string,
+  parts: Uint8Array[],
+  signal?: AbortSignal,
+): Promise<void> {
+  const { open } = await import('node:fs/promises');
+  const handle = await open(path, 'w');
+  try {
+    let pending = parts.filter((part) => part.length > 0);
+    while (pending.length > 0) {
+      throwIfAborted(signal);
+      const { bytesWritten } = await handle.writev(pending);
+      if (bytesWritten === 0) {
+        throw new Error(`Failed to write ${path}`);
+      }
+
+      // Drop what was written and resume after a short write
+      let skipped = bytesWritten;
+      while (pending.length > 0 && skipped >= pending[0].length) {
+        skipped -= pending[0].length;
+        pending = pending.slice(1);
+      }
+      if (skipped > 0) {
+        pending[0] = pending[0].subarray(skipped);
+      }
+    }
+  } finally {
+    await handle.close();
+  }
+}
+
+/**
+ * The delay shared by every frame, or null for a variable frame rate
+ */
+function constantFrameDuration(
+  frames: Array<{ delay: number }>,
+): number | null {
+  const durations = new Set(frames.map(frameDurationMs));
+  return durations.size === 1 ? [...durations][0] : null;
+}
+
+/**
+ * Start decoding a GIF stream, waiting only for the first frame
+ * The returned frames iterable continues decoding as bytes arrive; keep is
+ * called with each frame as it is handed to the encoder.
+ */
+async function streamGifFrames(
+  input: GifByteStream,
+  options: DecodeOptions,
+  keep: (frame: GifFrame) => void,
+): Promise<{
+  frames: AsyncIterable<EncoderFrame>;
+  height: number;
+  width: number;
+}> {
+  const decoded = decodeGifStream(input, options);
+  const first = await decoded.next();
+  if (first.done) {
+    throw new Error(
+      options.startMs === undefined && options.endMs === undefined
+        ? 'GIF contains no frames'
+        : 'No frames in the requested time range',
+    );
+  }
+
+  const firstFrame = first.value;
+  async function* frames() {
+    keep(firstFrame);
+    yield firstFrame;
+    for await (const frame of decoded) {
+      keep(frame);
+      yield frame;
+    }
+  }
+
+  return {
+    frames: frames(),
+    height: firstFrame.height,
+    width: firstFrame.width,
+  };
+}
+
+/**
+ * Keep only the frames shown between startMs and endMs, clipping the delays
+ * of the frames at either end
+ */
+function trimFrames(
+  frames: EncoderFrame[],
+  range: DecodeOptions,
+): EncoderFrame[] {
+  if (range.startMs === undefined && range.endMs === undefined) {
+    return frames;
+  }
+
+  const trimmed: EncoderFrame[] = [];
+  let time = 0;
+  for (const frame of frames) {
+    if (range.endMs !== undefined && time >= range.endMs) {
+      break;
+    }
+    const delay = frameDurationMs(frame);
+    const duration = visibleDuration(time, delay, range);
+    if (duration > 0) {
+      trimmed.push({ ...frame, delay: duration });
+    }
+    time += delay;
+  }
+
+  if (trimmed.length === 0) {
+    throw new Error('No frames in the requested time range');
+  }
+  return trimmed;
+}
+
+/**
+ * Crop frames to the region that changes across them when autoCrop is set
+ */
+function cropToContent(
+  frames: EncoderFrame[],
+  width: number,
+  height: number,
+  options: ConversionOptions,
+): { frames: EncoderFrame[]; height: number; width: number } {
+  const { autoCrop } = options;
+  if (!autoCrop) {
+    return { frames, height, width };
+  }
+  const alignment = autoCrop === true ? 'even' : autoCrop;
+  if (alignment !== 'even' && alignment !== 'macroblock') {
+    throw new Error(`Unsupported autoCrop alignment: ${alignment}`);
+  }
+  return autoCropFrames(frames, width, height, alignment);
+}
+
+/**
+ * Resize frames onto a canvas with the converter's scaler. A WASM instance
+ * is only taken once the first frame needs resizing.
+ */
+function createFrameResizer(
+  fit: 'contain' | 'fill',
+  width: number,
+  height: number,
+): {
+  release: () => void;
+  resize: (frame: PixelFrame) => Promise<Uint8Array>;
+} {
+  let scaler: {
+    Module: WasmModule;
+    resize: (
+      src: number,
+      srcWidth: number,
+      srcHeight: number,
+      dst: number,
+      dstWidth: number,
+      dstHeight: number,
+    ) => number;
+  } | null = null;
+  const size = width * height * 4;
+
+  return {
+    release() {
+      if (scaler) {
+        releaseWasmModule(scaler.Module);
+        scaler = null;
+      }
+    },
+    async resize(frame) {
+      if (!scaler) {
+        const Module = await acquireWasmModule();
+        scaler = {
+          Module,
+          // fit_rgba letterboxes, scale_rgba stretches
+          resize: Module.cwrap(
+            fit === 'fill' ? 'scale_rgba' : 'fit_rgba',
+            'number',
+            ['number', 'number', 'number', 'number', 'number', 'number'],
+          ) as (...args: number[]) => number,
+        };
+      }
+      const { Module, resize } = scaler;
+      const srcPtr = Module._malloc(frame.data.length);
+      const dstPtr = Module._malloc(size);
+      try {
+        Module.HEAPU8.set(frame.data, srcPtr);
+        if (!resize(srcPtr, frame.width, frame.height, dstPtr, width, height)) {
+          throw new Error('Failed to scale frame');
+        }
+        return Module.HEAPU8.slice(dstPtr, dstPtr + size);
+      } finally {
+        Module._free(srcPtr);
+        Module._free(dstPtr);
+      }
+    },
+  };
+}
+
+/**
+ * Gather streamed frames, for stages that need all of them up front
+ */
+async function collectFrames<T>(frames: AsyncIterable<T>): Promise<T[]> {
+  const collected: T[] = [];
+  for await (const frame of frames) {
+    collected.push(frame);
   }
+  return collected;
 }
 
 /**
@@ -221,45 +1229,46 @@ export async function convertFrames(
   }
 
   const { fps = 10 } = options;
+  const signal = createJobSignal(options);
   const firstFrame = frames[0];
-  const width = options.width || firstFrame.data.width;
-  const height = options.height || firstFrame.data.height;
-
-  // Convert FrameInput to internal frame format
-  const internalFrames = frames.map((frame) => {
-    let data: Uint8Array;
-    if (frame.data.data instanceof Uint8Array) {
-      data = frame.data.data;
-    } else if (
-      typeof Buffer !== 'undefined' &&
-      frame.data.data instanceof Buffer
-    ) {
-      data = new Uint8Array(frame.data.data);
-    } else {
-      data = new Uint8Array(frame.data.data);
-    }
 
+  // Convert FrameInput to internal frame format. Pixel data is viewed, not
+  // copied or converted: the converter ingests every supported format.
+  const allFrames = frames.map(({ data: image, delayMs }) => {
+    const { buffer, byteLength, byteOffset } = image.data;
     return {
-      data,
-      delay: frame.delayMs,
-      height: frame.data.height,
-      width: frame.data.width,
+      data: new Uint8Array(buffer, byteOffset, byteLength),
+      delay: delayMs,
+      format: image.format,
+      height: image.height,
+      palette: image.palette,
+      stride: image.stride,
+      width: image.width,
     };
   });
+  const { frames: internalFrames, height, width } = cropToContent(
+    trimFrames(allFrames, options),
+    options.width || firstFrame.data.width,
+    options.height || firstFrame.data.height,
+    options,
+  );
 
-  let mp4Buffer = await encodeFramesToMp4(internalFrames, width, height, fps);
+  const { changes, video: rawBuffer } = await encodeFramesToMp4(
+    internalFrames,
+    width,
+    height,
+    fps,
+    signal,
+  );
 
   // Always optimize with best available method
-  try {
-    const optimized = await optimizeMP4Buffer(mp4Buffer, internalFrames);
-    mp4Buffer = optimized;
-  } catch (error) {
-    // If optimization fails, continue with unoptimized buffer
-    console.warn(
-      'Optimization failed, using unoptimized output:',
-      (error as Error).message,
-    );
-  }
+  const mp4Buffer = await optimizeWithFallback(
+    rawBuffer,
+    internalFrames,
+    changes,
+    options,
+    signal,
+  );
 
   // Return appropriate type based on environment
   if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
@@ -270,40 +1279,427 @@ export async function convertFrames(
     : new Uint8Array(mp4Buffer);
 }
 
+/**
+ * Decode, encode and optimize a GIF buffer, handing the MP4 to finish.
+ * Decoded frames and the unoptimized MP4 live in pooled scratch buffers
+ * that go back to the pool once finish returns; scratch tells finish that
+ * the MP4 it was given is one of them.
+ */
+async function convertGifBufferWith<T>(
+  gifBuffer: Buffer | Uint8Array,
+  options: ConversionOptions,
+  finish: (mp4Buffer: Buffer | Uint8Array, scratch: boolean) => T,
+): Promise<T> {
+  const { fps = 10 } = options;
+  const signal = createJobSignal(options);
+
+  // Decode GIF using browser-compatible decoder
+  const decoded = decodeGif(gifBuffer, {
+    allocate: acquireBuffer,
+    endMs: options.endMs,
+    signal,
+    startMs: options.startMs,
+  });
+
+  try {
+    // Convert to internal frame format
+    const { frames: internalFrames, height, width } = cropToContent(
+      decoded.frames.map((frame) => ({
+        data: frame.data,
+        delay: frame.delay,
+        height: frame.height,
+        width: frame.width,
+      })),
+      decoded.width,
+      decoded.height,
+      options,
+    );
+
+    const { changes, video: rawBuffer } = await encodeFramesToMp4(
+      internalFrames,
+      width,
+      height,
+      fps,
+      signal,
+      acquireBuffer,
+    );
+
+    try {
+      // Always optimize with best available method
+      const mp4Buffer = await optimizeWithFallback(
+        rawBuffer,
+        internalFrames,
+        changes,
+        options,
+        signal,
+      );
+      return finish(mp4Buffer, mp4Buffer === rawBuffer);
+    } finally {
+      releaseBuffer(rawBuffer);
+    }
+  } finally {
+    for (const frame of decoded.frames) {
+      releaseBuffer(frame.data);
+    }
+  }
+}
+
 /**
  * Convert a GIF buffer to MP4 buffer
  */
 export async function convertGifBuffer(
   gifBuffer: Buffer | Uint8Array,
   options: ConversionOptions = {},
+): Promise<Buffer | Uint8Array> {
+  return convertGifBufferWith(gifBuffer, options, (mp4Buffer, scratch) => {
+    // Return appropriate type based on environment
+    if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
+      return mp4Buffer instanceof Buffer ? mp4Buffer : Buffer.from(mp4Buffer);
+    }
+    return scratch || !(mp4Buffer instanceof Uint8Array)
+      ? new Uint8Array(mp4Buffer)
+      : mp4Buffer;
+  });
+}
+
+/**
+ * Convert a GIF buffer to MP4, writing the video into a caller-owned buffer
+ * Returns the size of the MP4. If that is more than outBuffer.length,
+ * nothing is written and the conversion has to be repeated with a buffer of
+ * at least that size. Scratch memory comes from an internal pool, so a
+ * steady stream of conversions into reused buffers allocates little beyond
+ * what the optimizer needs.
+ */
+export async function convertGifBufferInto(
+  gifBuffer: Buffer | Uint8Array,
+  outBuffer: Uint8Array,
+  options: ConversionOptions = {},
+): Promise<number> {
+  return convertGifBufferWith(gifBuffer, options, (mp4Buffer) => {
+    if (mp4Buffer.length <= outBuffer.length) {
+      outBuffer.set(mp4Buffer);
+    }
+    return mp4Buffer.length;
+  });
+}
+
+/**
+ * Convert a GIF arriving as a stream (Node Readable or web ReadableStream)
+ * to MP4 buffer. Frames are decoded and encoded while the rest of the GIF
+ * is still being received.
+ */
+export async function convertGifStream(
+  input: GifByteStream,
+  options: ConversionOptions = {},
 ): Promise<Buffer | Uint8Array> {
   const { fps = 10 } = options;
+  const signal = createJobSignal(options);
 
-  // Decode GIF using browser-compatible decoder
-  const { frames, height, width } = decodeGif(gifBuffer);
+  // Optimization needs the decoded frames once the stream has ended
+  let internalFrames: EncoderFrame[] = [];
+  const stream = await streamGifFrames(
+    input,
+    { endMs: options.endMs, signal, startMs: options.startMs },
+    (frame) => internalFrames.push(frame),
+  );
+  let { height, width } = stream;
 
-  // Convert to internal frame format
-  const internalFrames = frames.map((frame) => ({
-    data: frame.data,
-    delay: frame.delay,
-    height: frame.height,
-    width: frame.width,
-  }));
+  // Cropping needs every frame first, so encoding waits for the stream
+  if (options.autoCrop) {
+    ({ frames: internalFrames, height, width } = cropToContent(
+      await collectFrames(stream.frames),
+      width,
+      height,
+      options,
+    ));
+  }
 
-  let mp4Buffer = await encodeFramesToMp4(internalFrames, width, height, fps);
+  const { changes, video: rawBuffer } = await encodeFramesToMp4(
+    options.autoCrop ? internalFrames : stream.frames,
+    width,
+    height,
+    fps,
+    signal,
+  );
 
   // Always optimize with best available method
+  const mp4Buffer = await optimizeWithFallback(
+    rawBuffer,
+    internalFrames,
+    changes,
+    options,
+    signal,
+  );
+
+  // Return appropriate type based on environment
+  if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
+    return mp4Buffer instanceof Buffer ? mp4Buffer : Buffer.from(mp4Buffer);
+  }
+  return mp4Buffer instanceof Uint8Array
+    ? mp4Buffer
+    : new Uint8Array(mp4Buffer);
+}
+
+/**
+ * Pass data on in chunks of at most STREAM_CHUNK_BYTES, copied so that they
+ * stay valid after the source (such as the WASM heap) is reused
+ */
+async function writeChunked(
+  data: Uint8Array,
+  write: (chunk: Uint8Array) => Promise<void>,
+): Promise<void> {
+  for (let offset = 0; offset < data.length; offset += STREAM_CHUNK_BYTES) {
+    await write(data.slice(offset, offset + STREAM_CHUNK_BYTES));
+  }
+}
+
+/**
+ * Convert a GIF stream and pass the MP4 to write as it is produced
+ * Only available in Node.js
+ *
+ * ffmpeg streams fragmented MP4 from its stdout while it encodes. Without
+ * ffmpeg, or when it fails before writing anything, the converter's
+ * moov-first MP4 is written straight from the WASM heap. maxBytes and the
+ * WASM H.264 encoder need the whole video before any of it can be sent.
+ */
+async function streamConversion(
+  input: GifByteStream,
+  options: ConversionOptions,
+  signal: AbortSignal | undefined,
+  write: (chunk: Uint8Array) => Promise<void>,
+): Promise<void> {
+  const { fps = 10 } = options;
+
+  // Only frame timings are kept: the frame data lives in the converter
+  let frameTimings: Array<{ delay: number; height: number; width: number }> =
+    [];
+  const stream = await streamGifFrames(
+    input,
+    { endMs: options.endMs, signal, startMs: options.startMs },
+    ({ delay, height, width }) => frameTimings.push({ delay, height, width }),
+  );
+  let { height, width } = stream;
+  let frames: AsyncIterable<EncoderFrame> | EncoderFrame[] = stream.frames;
+
+  // Cropping needs every frame first, so they are held until decoded
+  if (options.autoCrop) {
+    ({ frames, height, width } = cropToContent(
+      await collectFrames(stream.frames),
+      width,
+      height,
+      options,
+    ));
+    frameTimings = frames.map(({ delay, height, width }) => ({
+      delay,
+      height,
+      width,
+    }));
+  }
+
+  // Once any of the video has been sent, there is no falling back
+  let written = 0;
+  const send = (chunk: Uint8Array) => {
+    written += chunk.length;
+    return write(chunk);
+  };
+
+  await encodeFramesToMp4Parts(
+    frames,
+    width,
+    height,
+    fps,
+    signal,
+    async (parts, changes) => {
+      const plan = planOptimization(frameTimings, options, changes);
+      try {
+        const backend = await chooseBackend(plan, options);
+        if (backend === 'wasm-encoder') {
+          const mp4 = await encodePartsWithWasmEncoder(
+            parts,
+            frameTimings,
+            plan,
+            options,
+            signal,
+          );
+          await writeChunked(mp4, send);
+          return;
+        }
+
+        const { optimizeMP4, optimizeToStream } = await import('./ffmpeg.js');
+        if (options.maxBytes !== undefined) {
+          const mp4 = await runFFmpegOptimization(
+            plan,
+            options,
+            signal,
+            partsReference(parts, frameTimings),
+            (ffmpegOptions) => optimizeMP4(Buffer.concat(parts), ffmpegOptions),
+          );
+          await writeChunked(mp4, send);
+          return;
+        }
+
+        // Constant frame rate video goes to ffmpeg as rawvideo
+        const frameDurationMs = constantFrameDuration(frameTimings);
+        await runFFmpegOptimization(
+          plan,
+          options,
+          signal,
+          partsReference(parts, frameTimings),
+          (ffmpegOptions) =>
+            frameDurationMs === null
+              ? optimizeToStream(parts, null, send, ffmpegOptions)
+              : optimizeToStream(
+                  parts.slice(1),
+                  { frameDurationMs, height, width },
+                  send,
+                  ffmpegOptions,
+                ),
+        );
+      } catch (error) {
+        if (written > 0) {
+          throw error;
+        }
+        const size = parts.reduce((sum, part) => sum + part.length, 0);
+        assertFallbackAllowed(error, size, options, signal);
+        for (const part of parts) {
+          await writeChunked(part, send);
+        }
+      }
+    },
+  );
+}
+
+/**
+ * Convert a GIF to MP4, returned as a stream that starts before the
+ * conversion has finished: a Node Readable in Node.js, a web ReadableStream
+ * in the browser. Bytes are only produced as fast as they are read, so
+ * memory per job stays bounded by the converter's frames rather than the
+ * output, and cancelling the stream aborts the conversion. Errors, including
+ * an invalid GIF, are reported through the stream.
+ */
+export async function convertGifToStream(
+  input: GifByteStream | Buffer | Uint8Array,
+  options: ConversionOptions = {},
+): Promise<Readable | ReadableStream<Uint8Array>> {
+  const cancelled = new AbortController();
+  const signal = createJobSignal({
+    ...options,
+    signal: options.signal
+      ? AbortSignal.any([options.signal, cancelled.signal])
+      : cancelled.signal,
+  });
+
+  const gifStream: GifByteStream =
+    input instanceof Uint8Array
+      ? (async function* () {
+          yield input;
+        })()
+      : input;
+
+  // At most STREAM_BUFFER_BYTES wait to be read before the producer pauses
+  const { readable, writable } = new TransformStream<Uint8Array, Uint8Array>(
+    undefined,
+    new ByteLengthQueuingStrategy({ highWaterMark: STREAM_BUFFER_BYTES }),
+  );
+  const writer = writable.getWriter();
+  writer.closed.catch(() => cancelled.abort());
+  const write = async (chunk: Uint8Array) => {
+    await writer.ready;
+    writer.write(chunk).catch(() => {});
+  };
+
+  (async () => {
+    if (typeof window === 'undefined') {
+      await streamConversion(gifStream, options, signal, write);
+    } else {
+      // The browser's encoders only produce a whole file
+      const mp4 = await convertGifStream(gifStream, {
+        ...options,
+        deadlineMs: undefined,
+        signal,
+      });
+      await writeChunked(mp4, write);
+    }
+  })().then(
+    () => writer.close(),
+    (error) => writer.abort(error),
+  );
+
+  if (typeof window === 'undefined') {
+    const { Readable } = await import('node:stream');
+    return Readable.fromWeb(readable as NodeReadableStream<Uint8Array>);
+  }
+  return readable;
+}
+
+/**
+ * Join several GIFs, in order, into one MP4
+ * The GIFs are decoded one after another as the encoder reaches them and
+ * go through a single encode, so nothing is converted twice. The canvas is
+ * the first GIF's size unless width and height are given; frames of other
+ * sizes are resized onto it by the converter's scaler.
+ */
+export async function concatGifs(
+  gifBuffers: Array<Buffer | Uint8Array>,
+  options: ConcatOptions = {},
+): Promise<Buffer | Uint8Array> {
+  if (!gifBuffers || gifBuffers.length === 0) {
+    throw new Error('No GIFs provided');
+  }
+  const { fit = 'contain', fps = 10 } = options;
+  if (fit !== 'contain' && fit !== 'fill') {
+    throw new Error(`Unsupported fit: ${fit}`);
+  }
+  const signal = createJobSignal(options);
+
+  const first = decodeGif(gifBuffers[0], { signal });
+  const width = options.width || first.width;
+  const height = options.height || first.height;
+
+  const resizer = createFrameResizer(fit, width, height);
+
+  // Optimization needs every frame once the encode has finished
+  const internalFrames: EncoderFrame[] = [];
+  async function* frames() {
+    for (let i = 0; i < gifBuffers.length; i++) {
+      const decoded = i === 0 ? first : decodeGif(gifBuffers[i], { signal });
+      for (const frame of decoded.frames) {
+        const sameSize = frame.width === width && frame.height === height;
+        const encoderFrame = {
+          data: sameSize ? frame.data : await resizer.resize(frame),
+          delay: frame.delay,
+          height,
+          width,
+        };
+        internalFrames.push(encoderFrame);
+        yield encoderFrame;
+      }
+    }
+  }
+
+  let rawBuffer: Buffer | Uint8Array;
+  let changes: FrameChanges;
   try {
-    const optimized = await optimizeMP4Buffer(mp4Buffer, internalFrames);
-    mp4Buffer = optimized;
-  } catch (error) {
-    // If optimization fails, continue with unoptimized buffer
-    console.warn(
-      'Optimization failed, using unoptimized output:',
-      (error as Error).message,
-    );
+    ({ changes, video: rawBuffer } = await encodeFramesToMp4(
+      frames(),
+      width,
+      height,
+      fps,
+      signal,
+    ));
+  } finally {
+    resizer.release();
   }
 
+  // Always optimize with best available method
+  const mp4Buffer = await optimizeWithFallback(
+    rawBuffer,
+    internalFrames,
+    changes,
+    options,
+    signal,
+  );
+
   // Return appropriate type based on environment
   if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
     return mp4Buffer instanceof Buffer ? mp4Buffer : Buffer.from(mp4Buffer);
@@ -328,19 +1724,398 @@ export async function convertFile(
     );
   }
 
-  const { readFile, writeFile } = await import('node:fs/promises');
+  const { unlink } = await import('node:fs/promises');
+  const { createReadStream } = await import('node:fs');
 
   // Resolve the output path (handle directories and missing extensions)
   const resolvedOutputPath = await resolveOutputPath(inputPath, outputPath);
 
-  // Read the GIF file
-  const gifBuffer = await readFile(inputPath);
+  // Start the deadline clock before reading so file I/O counts against it
+  const signal = createJobSignal(options);
+  const { fps = 10 } = options;
+
+  // Stream the GIF from disk so decoding overlaps reading. Only frame
+  // timings are kept: the frame data lives in the converter until written.
+  let frameTimings: Array<{ delay: number; height: number; width: number }> =
+    [];
+  const stream = await streamGifFrames(
+    createReadStream(inputPath),
+    { endMs: options.endMs, signal, startMs: options.startMs },
+    ({ delay, height, width }) => frameTimings.push({ delay, height, width }),
+  );
+  let { height, width } = stream;
+  let frames: AsyncIterable<EncoderFrame> | EncoderFrame[] = stream.frames;
+
+  // Cropping needs every frame first, so they are held until decoded
+  if (options.autoCrop) {
+    ({ frames, height, width } = cropToContent(
+      await collectFrames(stream.frames),
+      width,
+      height,
+      options,
+    ));
+    frameTimings = frames.map(({ delay, height, width }) => ({
+      delay,
+      height,
+      width,
+    }));
+  }
 
-  // Convert GIF buffer to MP4 buffer
-  const mp4Buffer = await convertGifBuffer(gifBuffer, options);
+  // Constant frame rate video is piped to ffmpeg as rawvideo straight from
+  // the WASM heap. Otherwise the unoptimized video is written next to the
+  // output, so that it can be moved into place if optimization fails, and
+  // ffmpeg reads it from disk.
+  const rawPath = `${resolvedOutputPath}.${process.pid}-${Date.now()}.raw.mp4`;
+  let frameChanges: FrameChanges = [];
+  try {
+    const piped = await encodeFramesToMp4Parts(
+      frames,
+      width,
+      height,
+      fps,
+      signal,
+      async (parts, changes) => {
+        frameChanges = changes;
+        const plan = planOptimization(frameTimings, options, changes);
+        if ((await chooseBackend(plan, options)) === 'wasm-encoder') {
+          await optimizePartsWithWasmEncoder(
+            parts,
+            frameTimings,
+            plan,
+            resolvedOutputPath,
+            options,
+            signal,
+          );
+          return true;
+        }
 
-  // Write video to output file
-  await writeFile(resolvedOutputPath, mp4Buffer);
+        const frameDurationMs = constantFrameDuration(frameTimings);
+        if (frameDurationMs === null) {
+          await writeMp4Parts(rawPath, parts, signal);
+          return false;
+        }
+
+        const { optimizeRawVideo } = await import('./ffmpeg.js');
+        try {
+          await runFFmpegOptimization(
+            plan,
+            options,
+            signal,
+            partsReference(parts, frameTimings),
+            (ffmpegOptions) =>
+              optimizeRawVideo(
+                parts.slice(1),
+                { frameDurationMs, height, width },
+                resolvedOutputPath,
+                ffmpegOptions,
+              ),
+          );
+        } catch (error) {
+          const size = parts.reduce((sum, part) => sum + part.length, 0);
+          assertFallbackAllowed(error, size, options, signal);
+          await writeMp4Parts(resolvedOutputPath, parts, signal);
+        }
+        return true;
+      },
+    );
+
+    if (!piped) {
+      await optimizeFileWithFallback(
+        rawPath,
+        resolvedOutputPath,
+        frameTimings,
+        frameChanges,
+        options,
+        signal,
+      );
+    }
+  } finally {
+    try {
+      await unlink(rawPath);
+    } catch {
+      // Already moved into place, or never created
+    }
+  }
 
   return resolvedOutputPath;
 }
+
+/**
+ * Encode I420 frames with one set of encoder settings into outputPath, then
+ * decode the result and compare it with the frames. rawPath, the
+ * converter's MP4 of the same frames, keeps variable frame timing for
+ * ffmpeg; without it frames are piped in at their mean delay.
+ * Only available in Node.js
+ */
+async function measureTrial(
+  source: {
+    delays: number[];
+    frames: Uint8Array[];
+    height: number;
+    rawPath: string | null;
+    width: number;
+  },
+  trial: EncoderTrial,
+  outputPath: string,
+  signal?: AbortSignal,
+): Promise<EncoderTrialResult> {
+  const { stat, writeFile } = await import('node:fs/promises');
+  const { decodeToI420, optimizeMP4File, optimizeRawVideo, resolveVideoCodec } =
+    await import('./ffmpeg.js');
+  const { delays, frames, height, rawPath, width } = source;
+
+  // Decoded frame i shows source frame sourceIndex[i]
+  let sourceIndex = frames.map((_, i) => i);
+  const startTime = performance.now();
+  if (trial.backend === 'wasm-encoder') {
+    if (trial.codec !== 'h264' || trial.scale !== 1) {
+      throw new Error('The WASM encoder only encodes h264 at scale 1');
+    }
+    const mp4 = await encodeI420Frames(frames, delays, width, height, {
+      quantizationParameter: trial.crf,
+      signal,
+      speed: isX264Preset(trial.preset)
+        ? wasmEncoderSpeed(trial.preset)
+        : undefined,
+    });
+    await writeFile(outputPath, mp4, { signal });
+
+    // It repeats frames to hold them for their delays
+    const { wasmEncoderTiming } = await import('./webcodecs.js');
+    sourceIndex = wasmEncoderTiming(delays).repeats.flatMap((count, i) =>
+      Array<number>(count).fill(i),
+    );
+  } else {
+    if ((await resolveVideoCodec(trial.codec)).codec !== trial.codec) {
+      throw new Error(`No ffmpeg encoder for ${trial.codec} is installed`);
+    }
+    const ffmpegOptions = {
+      codec: trial.codec,
+      crf: trial.crf,
+      preset: trial.preset,
+      scale: trial.scale,
+      signal,
+    };
+    const constantDurationMs = constantFrameDuration(
+      delays.map((delay) => ({ delay })),
+    );
+    if (rawPath && constantDurationMs === null) {
+      await optimizeMP4File(rawPath, outputPath, ffmpegOptions);
+    } else {
+      const meanDelay =
+        delays.reduce((sum, delay) => sum + frameDurationMs({ delay }), 0) /
+        delays.length;
+      await optimizeRawVideo(
+        frames,
+        {
+          frameDurationMs: constantDurationMs ?? Math.round(meanDelay),
+          height,
+          width,
+        },
+        outputPath,
+        ffmpegOptions,
+      );
+    }
+  }
+  const encodeMs = performance.now() - startTime;
+  const { size: bytes } = await stat(outputPath);
+
+  // Scaled trials are decoded back up to the source size
+  const meter = await createQualityMeter(width, height);
+  try {
+    const decoded = await decodeToI420(
+      outputPath,
+      width,
+      height,
+      (frame, i) => {
+        if (i < sourceIndex.length) {
+          meter.add(frames[sourceIndex[i]], frame);
+        }
+      },
+      signal,
+    );
+    if (decoded !== sourceIndex.length) {
+      throw new Error(
+        `Decoded ${decoded} frames, expected ${sourceIndex.length}`,
+      );
+    }
+    const { psnr, ssim } = meter.result();
+    return { ...trial, bytes, encodeMs, psnr, ssim };
+  } finally {
+    meter.release();
+  }
+}
+
+/**
+ * Encode a GIF with each of several encoder settings and measure every
+ * result: encode time, size, and SSIM and PSNR of the decoded video against
+ * the GIF's frames as the converter stores them. The GIF is decoded once.
+ * ffmpeg is needed to decode the encoded videos.
+ * Only available in Node.js
+ */
+export async function measureEncoderSettings(
+  gifBuffer: Buffer | Uint8Array,
+  trials: EncoderTrial[],
+  options: { fps?: number; signal?: AbortSignal } = {},
+): Promise<EncoderTrialResult[]> {
+  if (typeof window !== 'undefined') {
+    throw new Error('measureEncoderSettings() is only available in Node.js');
+  }
+  const { mkdtemp, rm } = await import('node:fs/promises');
+  const { tmpdir } = await import('node:os');
+  const { join } = await import('node:path');
+  const { fps = 10, signal } = options;
+
+  const { frames, height, width } = decodeGif(gifBuffer, { signal });
+  if (frames.length === 0) {
+    throw new Error('GIF contains no frames');
+  }
+
+  const dir = await mkdtemp(join(tmpdir(), 'gif2vid-measure-'));
+  try {
+    return await encodeFramesToMp4Parts(
+      frames,
+      width,
+      height,
+      fps,
+      signal,
+      async (parts) => {
+        // The converter's MP4 is the reference every trial starts from
+        const rawPath = join(dir, 'raw.mp4');
+        await writeMp4Parts(rawPath, parts, signal);
+        const source = {
+          delays: frames.map((frame) => frame.delay),
+          frames: parts.slice(1),
+          height,
+          rawPath,
+          width,
+        };
+
+        const results: EncoderTrialResult[] = [];
+        for (const [i, trial] of trials.entries()) {
+          results.push(
+            await measureTrial(source, trial, join(dir, `${i}.mp4`), signal),
+          );
+        }
+        return results;
+      },
+    );
+  } finally {
+    await rm(dir, { force: true, recursive: true });
+  }
+}
+
+/**
+ * Extract a single frame of a GIF as a PNG or JPEG image
+ * Only the frames needed to composite the requested one are decoded, and
+ * scaling and image encoding run inside the WASM module, so this costs a
+ * small fraction of a full conversion.
+ */
+export async function extractFrame(
+  gifBuffer: Buffer | Uint8Array,
+  options: ExtractFrameOptions = {},
+): Promise<Buffer | Uint8Array> {
+  const { format = 'png', quality = 85, width } = options;
+  if (format !== 'png' && format !== 'jpeg') {
+    throw new Error(`Unsupported image format: ${format}`);
+  }
+
+  const frame = decodeCompositedFrame(gifBuffer, options);
+
+  // Keep the aspect ratio when scaling to the requested width
+  const outputWidth =
+    width && width > 0 ? Math.max(1, Math.round(width)) : frame.width;
+  const outputHeight = Math.max(
+    1,
+    Math.round((frame.height * outputWidth) / frame.width),
+  );
+
+  const Module = await acquireWasmModule();
+  const scaleRgba = Module.cwrap('scale_rgba', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as (
+    src: number,
+    srcWidth: number,
+    srcHeight: number,
+    dst: number,
+    dstWidth: number,
+    dstHeight: number,
+  ) => number;
+  const encodePng = Module.cwrap('encode_png', 'number', [
+    'number',
+    'number',
+    'number',
+  ]) as (ptr: number, width: number, height: number) => number;
+  const encodeJpeg = Module.cwrap('encode_jpeg', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as (ptr: number, width: number, height: number, quality: number) => number;
+  const getImageSize = Module.cwrap(
+    'get_image_size',
+    'number',
+    [],
+  ) as () => number;
+  const freeImage = Module.cwrap('free_image', null, []) as () => void;
+
+  const pixelsPtr = Module._malloc(frame.data.length);
+  let scaledPtr = 0;
+  try {
+    Module.HEAPU8.set(frame.data, pixelsPtr);
+
+    let imagePtr = pixelsPtr;
+    if (outputWidth !== frame.width || outputHeight !== frame.height) {
+      scaledPtr = Module._malloc(outputWidth * outputHeight * 4);
+      const scaled = scaleRgba(
+        pixelsPtr,
+        frame.width,
+        frame.height,
+        scaledPtr,
+        outputWidth,
+        outputHeight,
+      );
+      if (!scaled) {
+        throw new Error('Failed to scale frame');
+      }
+      imagePtr = scaledPtr;
+    }
+
+    const encodedPtr =
+      format === 'jpeg'
+        ? encodeJpeg(
+            imagePtr,
+            outputWidth,
+            outputHeight,
+            Math.min(100, Math.max(1, Math.round(quality))),
+          )
+        : encodePng(imagePtr, outputWidth, outputHeight);
+    if (!encodedPtr) {
+      throw new Error(`Failed to encode ${format} image`);
+    }
+
+    const encoded = new Uint8Array(
+      Module.HEAPU8.buffer,
+      encodedPtr,
+      getImageSize(),
+    );
+
+    // Return Buffer in Node.js, Uint8Array in browser
+    if (typeof Buffer !== 'undefined' && typeof window === 'undefined') {
+      return Buffer.from(encoded);
+    }
+    return new Uint8Array(encoded);
+  } finally {
+    freeImage();
+    Module._free(pixelsPtr);
+    if (scaledPtr) {
+      Module._free(scaledPtr);
+    }
+    releaseWasmModule(Module);
+  }
+}
@@ -0,0 +1,94 @@
+/**
+ * Keyframe placement from frame-difference analysis
+ * The converter scores each frame by the share of 16x16 blocks that changed
+ * since the previous one. Scene cuts get a keyframe; static stretches only
+ * get one when the interval cap is reached, instead of every N frames
+ * regardless of content. Works in both Node.js and browser environments.
+ */
+
+import { frameDurationMs } from './gif-decoder.js';
+
+export interface KeyframePolicy {
+  maxInterval: number; // Frames between keyframes at most, for seeking
+  minInterval: number; // Frames between keyframes at least
+  sceneChange: number; // Share of changed blocks (0-1) that starts a new scene
+}
+
+// The interval cap matches x264's default keyint
+export const DEFAULT_KEYFRAME_POLICY: KeyframePolicy = {
+  maxInterval: 250,
+  minInterval: 4,
+  sceneChange: 0.4,
+};
+
+/**
+ * Decides frame by frame whether to place a keyframe, for encoders that take
+ * the decision as each frame is submitted
+ */
+export class KeyframePlanner {
+  private policy: KeyframePolicy;
+  private sinceKeyframe = -1; // Frames since the last keyframe, -1 before any
+
+  constructor(policy: KeyframePolicy = DEFAULT_KEYFRAME_POLICY) {
+    this.policy = policy;
+  }
+
+  /**
+   * Whether the next frame should be a keyframe, given its change ratio
+   * (0-1, or null when unknown). The first frame always is.
+   */
+  next(change: number | null): boolean {
+    const { maxInterval, minInterval, sceneChange } = this.policy;
+    const since = this.sinceKeyframe;
+    const keyframe =
+      since < 0 ||
+      since + 1 >= maxInterval ||
+      (change !== null && change >= sceneChange && since + 1 >= minInterval);
+
+    this.sinceKeyframe = keyframe ? 0 : since + 1;
+    return keyframe;
+  }
+}
+
+/**
+ * Indices of the frames that should be keyframes
+ */
+export function planKeyframes(
+  changes: Array<number | null>,
+  policy: KeyframePolicy = DEFAULT_KEYFRAME_POLICY,
+): number[] {
+  const planner = new KeyframePlanner(policy);
+  const keyframes: number[] = [];
+  changes.forEach((change, index) => {
+    if (planner.next(change)) {
+      keyframes.push(index);
+    }
+  });
+  return keyframes;
+}
+
+/**
+ * Presentation times of the planned keyframes, for encoders that take them
+ * up front (ffmpeg -force_key_frames). Returns undefined when there was no
+ * analysis, leaving placement to the encoder.
+ */
+export function keyframeTimesMs(
+  frames: Array<{ delay: number }>,
+  changes: Array<number | null> | undefined,
+  policy?: KeyframePolicy,
+): number[] | undefined {
+  if (!changes || changes.length !== frames.length) {
+    return undefined;
+  }
+  if (changes.every((change) => change === null)) {
+    return undefined;
+  }
+
+  const starts: number[] = [];
+  let time = 0;
+  for (const frame of frames) {
+    starts.push(time);
+    time += frameDurationMs(frame);
+  }
+  return planKeyframes(changes, policy).map((index) => starts[index]);
+}
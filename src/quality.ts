@@ -0,0 +1,111 @@
+/**
+ * Quality of encoded video against the frames it was encoded from
+ * Frames are compared in the converter (analysis.c): SSIM over 8x8
+ * windows and squared error for PSNR, both over all three I420 planes with
+ * luma weighted 4:1:1 as ffmpeg's ssim and psnr filters do. Works in both
+ * Node.js and browser environments.
+ */
+
+import {
+  acquireWasmModule,
+  i420Size,
+  releaseWasmModule,
+} from './wasm-module.js';
+
+export interface VideoQuality {
+  frames: number; // Frames compared
+  psnr: number; // Over all compared frames, in dB (100 when identical)
+  ssim: number; // Mean over compared frames, 0-1 (1 when identical)
+}
+
+export interface QualityMeter {
+  // Compare a decoded frame with its source; both are width x height I420
+  add: (source: Uint8Array, decoded: Uint8Array) => void;
+  release: () => void;
+  result: () => VideoQuality;
+}
+
+// i420_ssim and i420_sse, taking heap pointers to two frames
+type FrameMetric = (
+  source: number,
+  decoded: number,
+  width: number,
+  height: number,
+) => number;
+
+// PSNR reported for identical frames, whose squared error is zero
+const MAX_PSNR = 100;
+
+/**
+ * PSNR of 8-bit samples with this total squared error
+ */
+export function psnrFromSse(sse: number, samples: number): number {
+  if (samples <= 0 || sse <= 0) {
+    return MAX_PSNR;
+  }
+  return Math.min(MAX_PSNR, 10 * Math.log10((255 * 255 * samples) / sse));
+}
+
+/**
+ * Start measuring the quality of width x height I420 frames
+ * Holds a converter instance until released.
+ */
+export async function createQualityMeter(
+  width: number,
+  height: number,
+): Promise<QualityMeter> {
+  const size = i420Size(width, height);
+  const Module = await acquireWasmModule(2 * size);
+  const frameSsim = Module.cwrap('i420_ssim', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as FrameMetric;
+  const frameSse = Module.cwrap('i420_sse', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as FrameMetric;
+
+  const sourcePtr = Module._malloc(size);
+  const decodedPtr = Module._malloc(size);
+  if (!sourcePtr || !decodedPtr) {
+    Module._free(sourcePtr);
+    Module._free(decodedPtr);
+    releaseWasmModule(Module);
+    throw new Error('Failed to allocate frames for quality measurement');
+  }
+
+  let frames = 0;
+  let ssimSum = 0;
+  let sseSum = 0;
+  let released = false;
+
+  return {
+    add: (source, decoded) => {
+      if (source.length < size || decoded.length < size) {
+        throw new Error('Frame is smaller than the measured size');
+      }
+      Module.HEAPU8.set(source.subarray(0, size), sourcePtr);
+      Module.HEAPU8.set(decoded.subarray(0, size), decodedPtr);
+      ssimSum += frameSsim(sourcePtr, decodedPtr, width, height);
+      sseSum += frameSse(sourcePtr, decodedPtr, width, height);
+      frames++;
+    },
+    release: () => {
+      if (!released) {
+        released = true;
+        Module._free(sourcePtr);
+        Module._free(decodedPtr);
+        releaseWasmModule(Module);
+      }
+    },
+    result: () => ({
+      frames,
+      psnr: psnrFromSse(sseSum, frames * size),
+      ssim: frames > 0 ? ssimSum / frames : 1,
+    }),
+  };
+}
@@ -0,0 +1,446 @@
+/**
+ * Filesystem spool queue with lease semantics
+ * Only available in Node.js
+ *
+ * Producers drop GIFs and option manifests into a shared directory (a local
+ * disk, NFS or any filesystem with atomic rename), and any number of worker
+ * processes on any number of hosts take jobs from it. The directory holds:
+ *
+ *   jobs/<id>.gif               input bytes, written before the manifest and
+ *                               removed once it is in done/ or failed/
+ *   queue/<id>.json             manifest { id, options, attempts } ready to run
+ *   leases/<id>~<worker>.json   manifest claimed by a worker
+ *   done/<id>.json              finished manifests
+ *   failed/<id>.json            manifests with an `error`
+ *   out/<id>.mp4                converted output
+ *
+ * A worker claims a job by renaming its manifest from queue/ into leases/;
+ * rename is atomic, so exactly one worker wins. The manifest is touched
+ * just before, since rename keeps its mtime and a lease must not look
+ * expired the moment it appears. While converting, the worker
+ * touches its lease file, and a lease whose mtime is older than the lease
+ * time is moved back to queue/ by whichever worker notices first. Hosts
+ * therefore need roughly synchronised clocks. Every file is written to a
+ * temporary name and renamed into place, so readers never see partial
+ * files. A job whose lease expires part way through may run twice; its
+ * output is the same either way and the last rename wins.
+ */
+
+import { randomBytes } from 'node:crypto';
+import {
+  mkdir,
+  readdir,
+  readFile,
+  rename,
+  stat,
+  unlink,
+  utimes,
+  writeFile,
+} from 'node:fs/promises';
+import { hostname } from 'node:os';
+import { join } from 'node:path';
+import type { ConversionOptions } from './index.js';
+
+export interface SpoolManifest {
+  attempts: number; // Times the job has been claimed
+  error?: string; // Set on manifests in failed/
+  id: string;
+  options: ConversionOptions;
+}
+
+export type SpoolConverter = (
+  gif: Uint8Array,
+  options: ConversionOptions,
+) => Promise<Uint8Array>;
+
+export interface SpoolWorkerOptions {
+  concurrency?: number; // Jobs held at once (default: CPUs - 1)
+  convert?: SpoolConverter; // Default: a pool of conversion worker threads
+  drain?: boolean; // Exit once the queue is empty instead of polling
+  leaseMs?: number; // Lease lifetime without a heartbeat (default: 30s)
+  maxAttempts?: number; // Claims before a job is failed (default: 3)
+  pollMs?: number; // Queue polling interval when idle (default: 500ms)
+  signal?: AbortSignal; // Stop claiming jobs; in-flight jobs still finish
+  workerId?: string; // Default: host, pid and a random suffix
+}
+
+export interface SpoolWorkerResult {
+  completed: number;
+  failed: number;
+}
+
+export interface SpoolStatus {
+  done: number;
+  failed: number;
+  leased: number;
+  queued: number;
+}
+
+const SPOOL_DIRS = ['jobs', 'queue', 'leases', 'done', 'failed', 'out'];
+
+// Ids become file names, and '~' separates the id from the worker in leases
+const ID_PATTERN = /^[A-Za-z0-9_.-]{1,128}$/;
+
+/**
+ * Create the spool's subdirectories
+ */
+async function ensureSpool(dir: string): Promise<void> {
+  await Promise.all(
+    SPOOL_DIRS.map((name) => mkdir(join(dir, name), { recursive: true })),
+  );
+}
+
+/**
+ * Write a file under a temporary name in the same directory, then rename it
+ * into place
+ */
+async function writeAtomic(
+  path: string,
+  data: string | Uint8Array,
+): Promise<void> {
+  const suffix = `${process.pid}-${randomBytes(4).toString('hex')}`;
+  const tempPath = `${path}.${suffix}.tmp`;
+  try {
+    await writeFile(tempPath, data);
+    await rename(tempPath, path);
+  } catch (error) {
+    await unlink(tempPath).catch(() => {});
+    throw error;
+  }
+}
+
+function isMissing(error: unknown): boolean {
+  return (error as NodeJS.ErrnoException).code === 'ENOENT';
+}
+
+/**
+ * Manifest names in a spool directory, oldest job id first
+ */
+async function listManifests(dir: string): Promise<string[]> {
+  try {
+    return (await readdir(dir))
+      .filter((name) => name.endsWith('.json') && !name.startsWith('.'))
+      .sort();
+  } catch (error) {
+    if (isMissing(error)) {
+      return [];
+    }
+    throw error;
+  }
+}
+
+/**
+ * A new job id; ids sort in enqueue order, so workers take jobs FIFO
+ */
+function newJobId(): string {
+  const time = Date.now().toString(36).padStart(9, '0');
+  return `${time}-${randomBytes(6).toString('hex')}`;
+}
+
+/**
+ * Add a GIF to the spool. Returns the job id; the output will appear at
+ * out/<id>.mp4 and the manifest in done/ or failed/.
+ */
+export async function enqueueSpoolJob(
+  dir: string,
+  gif: Uint8Array,
+  options: ConversionOptions = {},
+  id: string = newJobId(),
+): Promise<string> {
+  if (!ID_PATTERN.test(id)) {
+    throw new Error(`Invalid spool job id: ${id}`);
+  }
+  if (options.signal) {
+    throw new Error('Spool job options cannot include a signal');
+  }
+
+  await ensureSpool(dir);
+  // The manifest is what workers look for, so the GIF must land first
+  await writeAtomic(join(dir, 'jobs', `${id}.gif`), gif);
+  const manifest: SpoolManifest = { attempts: 0, id, options };
+  await writeAtomic(join(dir, 'queue', `${id}.json`), JSON.stringify(manifest));
+  return id;
+}
+
+/**
+ * Count the jobs in each state
+ */
+export async function getSpoolStatus(dir: string): Promise<SpoolStatus> {
+  const [done, failed, leased, queued] = await Promise.all(
+    ['done', 'failed', 'leases', 'queue'].map((name) =>
+      listManifests(join(dir, name)),
+    ),
+  );
+  return {
+    done: done.length,
+    failed: failed.length,
+    leased: leased.length,
+    queued: queued.length,
+  };
+}
+
+/**
+ * Move leases that have gone without a heartbeat back to the queue
+ * Returns how many were re-queued by this call.
+ */
+export async function requeueExpiredLeases(
+  dir: string,
+  leaseMs: number,
+): Promise<number> {
+  const leasesDir = join(dir, 'leases');
+  let requeued = 0;
+  for (const name of await listManifests(leasesDir)) {
+    const separator = name.lastIndexOf('~');
+    if (separator <= 0) {
+      continue;
+    }
+    const leasePath = join(leasesDir, name);
+    try {
+      const { mtimeMs } = await stat(leasePath);
+      if (Date.now() - mtimeMs <= leaseMs) {
+        continue;
+      }
+      // Only one of several reapers can win the rename
+      await rename(
+        leasePath,
+        join(dir, 'queue', `${name.slice(0, separator)}.json`),
+      );
+      requeued++;
+    } catch (error) {
+      if (!isMissing(error)) {
+        throw error;
+      }
+      // Finished or re-queued by someone else meanwhile
+    }
+  }
+  return requeued;
+}
+
+/**
+ * Default worker id: unique across hosts and processes, safe in file names
+ */
+function defaultWorkerId(): string {
+  const host = hostname().replace(/[^A-Za-z0-9_.-]/g, '_') || 'host';
+  return `${host}-${process.pid}-${randomBytes(3).toString('hex')}`;
+}
+
+/**
+ * Resolve after ms, or early when the signal fires
+ */
+function sleep(ms: number, signal?: AbortSignal): Promise<void> {
+  return new Promise((resolve) => {
+    const timer = setTimeout(done, ms);
+    function done() {
+      clearTimeout(timer);
+      signal?.removeEventListener('abort', done);
+      resolve();
+    }
+    signal?.addEventListener('abort', done, { once: true });
+  });
+}
+
+/**
+ * Take jobs from the spool and convert them until the signal fires (or,
+ * with `drain`, until the queue is empty). Several workers, in one process
+ * or many, can share a spool directory.
+ */
+export async function runSpoolWorker(
+  dir: string,
+  options: SpoolWorkerOptions = {},
+): Promise<SpoolWorkerResult> {
+  const {
+    drain = false,
+    leaseMs = 30_000,
+    maxAttempts = 3,
+    pollMs = 500,
+    signal,
+    workerId = defaultWorkerId(),
+  } = options;
+  if (!ID_PATTERN.test(workerId)) {
+    throw new Error(`Invalid spool worker id: ${workerId}`);
+  }
+
+  let concurrency = options.concurrency;
+  let convert = options.convert;
+  let closePool: (() => Promise<void>) | null = null;
+  if (!convert) {
+    const { availableParallelism } = await import('node:os');
+    const { ConversionPool } = await import('./daemon.js');
+    concurrency ??= Math.max(1, availableParallelism() - 1);
+    const pool = new ConversionPool(concurrency);
+    convert = (gif, jobOptions) => pool.convert(gif, jobOptions);
+    closePool = () => pool.close();
+  }
+  const slots = Math.max(1, concurrency ?? 1);
+  const runConversion = convert;
+
+  const paths = {
+    done: (id: string) => join(dir, 'done', `${id}.json`),
+    failed: (id: string) => join(dir, 'failed', `${id}.json`),
+    gif: (id: string) => join(dir, 'jobs', `${id}.gif`),
+    lease: (id: string) => join(dir, 'leases', `${id}~${workerId}.json`),
+    output: (id: string) => join(dir, 'out', `${id}.mp4`),
+    queued: (name: string) => join(dir, 'queue', name),
+  };
+
+  const result: SpoolWorkerResult = { completed: 0, failed: 0 };
+
+  const fail = async (manifest: SpoolManifest, error: string) => {
+    await writeAtomic(
+      paths.failed(manifest.id),
+      JSON.stringify({ ...manifest, error }),
+    );
+    // Only the lease holder removes the input; a worker that took over an
+    // expired lease may still be reading it
+    const owned = await unlink(paths.lease(manifest.id)).then(
+      () => true,
+      () => false,
+    );
+    if (owned) {
+      await unlink(paths.gif(manifest.id)).catch(() => {});
+    }
+    result.failed++;
+  };
+
+  /**
+   * Try to lease a queued manifest; null if another worker got it first
+   */
+  const claim = async (name: string): Promise<SpoolManifest | null> => {
+    const id = name.slice(0, -'.json'.length);
+    if (!ID_PATTERN.test(id)) {
+      return null;
+    }
+    const leasePath = paths.lease(id);
+    try {
+      // Otherwise a reaper could re-queue the lease as soon as it appears,
+      // and the manifest update below would then recreate it alongside the
+      // re-queued copy
+      const now = new Date();
+      await utimes(paths.queued(name), now, now);
+      await rename(paths.queued(name), leasePath);
+    } catch (error) {
+      if (isMissing(error)) {
+        return null;
+      }
+      throw error;
+    }
+    try {
+      let manifest: SpoolManifest;
+      try {
+        manifest = { ...JSON.parse(await readFile(leasePath, 'utf8')), id };
+      } catch (error) {
+        if (isMissing(error)) {
+          throw error;
+        }
+        await fail({ attempts: 1, id, options: {} }, 'Unreadable manifest');
+        return null;
+      }
+      manifest.attempts = (manifest.attempts || 0) + 1;
+      // Still ours: the lease is fresh, so no reaper will have taken it
+      await stat(leasePath);
+      await writeAtomic(leasePath, JSON.stringify(manifest));
+      return manifest;
+    } catch (error) {
+      if (isMissing(error)) {
+        // A reaper saw the old mtime and re-queued it first
+        return null;
+      }
+      throw error;
+    }
+  };
+
+  const run = async (manifest: SpoolManifest) => {
+    const { id } = manifest;
+    if (manifest.attempts > maxAttempts) {
+      await fail(manifest, `Lease expired ${maxAttempts} times`);
+      return;
+    }
+
+    // Keep the lease alive; if it disappears, another worker re-queued it
+    let leaseLost = false;
+    const heartbeat = setInterval(
+      () => {
+        const now = new Date();
+        utimes(paths.lease(id), now, now).catch((error) => {
+          leaseLost ||= isMissing(error);
+        });
+      },
+      Math.max(10, leaseMs / 3),
+    );
+
+    try {
+      let mp4: Uint8Array;
+      try {
+        const gif = await readFile(paths.gif(id));
+        mp4 = await runConversion(new Uint8Array(gif), manifest.options || {});
+      } catch (error) {
+        if (!leaseLost) {
+          await fail(manifest, (error as Error).message);
+        }
+        return;
+      }
+      if (leaseLost) {
+        return;
+      }
+
+      // Output first: a job is only marked done once its output exists
+      await writeAtomic(paths.output(id), mp4);
+      try {
+        await rename(paths.lease(id), paths.done(id));
+      } catch (error) {
+        if (!isMissing(error)) {
+          throw error;
+        }
+        // Re-queued while the output was written; the rerun is harmless
+        return;
+      }
+      result.completed++;
+      await unlink(paths.gif(id)).catch(() => {});
+    } finally {
+      clearInterval(heartbeat);
+    }
+  };
+
+  const active = new Set<Promise<void>>();
+  let workerError: unknown = null;
+
+  try {
+    await ensureSpool(dir);
+    while (!signal?.aborted && !workerError) {
+      await requeueExpiredLeases(dir, leaseMs);
+
+      const queued = await listManifests(join(dir, 'queue'));
+      for (const name of queued) {
+        if (active.size >= slots || signal?.aborted) {
+          break;
+        }
+        const manifest = await claim(name);
+        if (manifest) {
+          const job = run(manifest)
+            .catch((error) => {
+              workerError ??= error;
+            })
+            .finally(() => active.delete(job));
+          active.add(job);
+        }
+      }
+
+      if (drain && active.size === 0 && queued.length === 0) {
+        break;
+      }
+      if (active.size >= slots) {
+        await Promise.race(active);
+      } else {
+        await Promise.race([sleep(pollMs, signal), ...active]);
+      }
+    }
+
+    await Promise.all(active);
+    if (workerError) {
+      throw workerError;
+    }
+  } finally {
+    await closePool?.();
+  }
+  return result;
+}
@@ -0,0 +1,253 @@
+/**
+ * Encoder parameter sweep over a corpus of GIFs
+ * Every combination of codec, preset, crf and scale is measured with each
+ * local backend that can run it (see measureEncoderSettings), and the
+ * settings on the Pareto frontier of size, encode time and quality are
+ * reported. Sweeping one content class at a time (screen recordings,
+ * stickers, photographic clips) shows which defaults suit it.
+ * Only available in Node.js
+ */
+
+import { readdir, readFile, stat } from 'node:fs/promises';
+import { extname, join } from 'node:path';
+import { checkFFmpeg, resolveVideoCodec, type VideoCodec } from './ffmpeg.js';
+import {
+  type EncoderTrial,
+  type EncoderTrialResult,
+  measureEncoderSettings,
+} from './index.js';
+import { loadWasmEncoder } from './webcodecs.js';
+
+export interface SweepGrid {
+  codecs: VideoCodec[];
+  crfs: number[];
+  presets: string[];
+  scales: number[];
+}
+
+export interface SweepOptions extends Partial<SweepGrid> {
+  fps?: number;
+  onError?: (file: string, error: Error) => void;
+  onFile?: (file: string, results: EncoderTrialResult[]) => void;
+  signal?: AbortSignal;
+}
+
+// One setting over every GIF that was measured
+export interface SweepSummary extends EncoderTrial {
+  bytes: number; // Total over the corpus
+  encodeMs: number; // Total over the corpus
+  minSsim: number; // Worst single GIF
+  pareto: boolean; // No other setting is smaller, faster and better at once
+  psnr: number; // Mean over the corpus
+  ssim: number; // Mean over the corpus
+}
+
+export interface SweepResult {
+  failed: Array<{ error: string; file: string }>;
+  files: string[]; // GIFs every setting was measured on
+  summary: SweepSummary[];
+}
+
+export const DEFAULT_SWEEP_GRID: SweepGrid = {
+  codecs: ['h264', 'hevc', 'av1'],
+  crfs: [18, 23, 28, 33],
+  presets: ['veryfast', 'medium', 'slow'],
+  scales: [1, 0.75, 0.5],
+};
+
+/**
+ * Every trial in the grid that the given backends can run: ffmpeg for the
+ * installed codecs, and the WASM encoder for h264 at full size
+ */
+export function expandSweepGrid(
+  grid: SweepGrid,
+  backends: { codecs: ReadonlySet<VideoCodec>; wasmEncoder: boolean },
+): EncoderTrial[] {
+  const trials: EncoderTrial[] = [];
+  for (const codec of grid.codecs) {
+    for (const preset of grid.presets) {
+      for (const crf of grid.crfs) {
+        for (const scale of grid.scales) {
+          if (backends.codecs.has(codec)) {
+            trials.push({ backend: 'ffmpeg', codec, crf, preset, scale });
+          }
+          if (backends.wasmEncoder && codec === 'h264' && scale === 1) {
+            trials.push({ backend: 'wasm-encoder', codec, crf, preset, scale });
+          }
+        }
+      }
+    }
+  }
+  return trials;
+}
+
+/**
+ * The points no other point beats on size, encode time and quality at once
+ */
+export function paretoFrontier<
+  T extends { bytes: number; encodeMs: number; ssim: number },
+>(points: T[]): T[] {
+  return points.filter(
+    (point) =>
+      !points.some(
+        (other) =>
+          other.bytes <= point.bytes &&
+          other.encodeMs <= point.encodeMs &&
+          other.ssim >= point.ssim &&
+          (other.bytes < point.bytes ||
+            other.encodeMs < point.encodeMs ||
+            other.ssim > point.ssim),
+      ),
+  );
+}
+
+/**
+ * Combine each setting's results across the corpus and mark the frontier
+ * perFile holds one result list per GIF, each covering the same trials.
+ */
+export function summarizeSweep(
+  perFile: EncoderTrialResult[][],
+): SweepSummary[] {
+  if (perFile.length === 0) {
+    return [];
+  }
+  const summary = perFile[0].map((_, i): SweepSummary => {
+    const results = perFile.map((file) => file[i]);
+    const { backend, codec, crf, preset, scale } = results[0];
+    return {
+      backend,
+      bytes: results.reduce((sum, r) => sum + r.bytes, 0),
+      codec,
+      crf,
+      encodeMs: results.reduce((sum, r) => sum + r.encodeMs, 0),
+      minSsim: Math.min(...results.map((r) => r.ssim)),
+      pareto: false,
+      preset,
+      psnr: results.reduce((sum, r) => sum + r.psnr, 0) / results.length,
+      scale,
+      ssim: results.reduce((sum, r) => sum + r.ssim, 0) / results.length,
+    };
+  });
+  for (const point of paretoFrontier(summary)) {
+    point.pareto = true;
+  }
+  return summary;
+}
+
+/**
+ * Markdown table of a sweep, smallest output first, with the frontier
+ * marked
+ */
+export function formatSweepReport(result: SweepResult): string {
+  const lines = [
+    `${result.files.length} GIFs, ${result.summary.length} settings` +
+      (result.failed.length > 0 ? `, ${result.failed.length} failed` : ''),
+    '',
+    '| | backend | codec | preset | crf | scale | KB | encode ms | SSIM | min SSIM | PSNR |',
+    '|-|-|-|-|-|-|-:|-:|-:|-:|-:|',
+  ];
+  const sorted = [...result.summary].sort((a, b) => a.bytes - b.bytes);
+  for (const s of sorted) {
+    lines.push(
+      [
+        '',
+        s.pareto ? '*' : '',
+        s.backend,
+        s.codec,
+        s.preset,
+        s.crf,
+        s.scale,
+        (s.bytes / 1024).toFixed(1),
+        s.encodeMs.toFixed(0),
+        s.ssim.toFixed(4),
+        s.minSsim.toFixed(4),
+        s.psnr.toFixed(2),
+        '',
+      ]
+        .join(' | ')
+        .trim(),
+    );
+  }
+  lines.push('', '* on the Pareto frontier of size, encode time and SSIM');
+  for (const { error, file } of result.failed) {
+    lines.push(`Failed: ${file}: ${error}`);
+  }
+  return lines.join('\n');
+}
+
+/**
+ * GIF files named by paths, walking directories
+ */
+export async function findCorpusGifs(paths: string[]): Promise<string[]> {
+  const files: string[] = [];
+  for (const path of paths) {
+    if ((await stat(path)).isDirectory()) {
+      const entries = await readdir(path, { recursive: true });
+      files.push(
+        ...entries
+          .filter((entry) => extname(entry).toLowerCase() === '.gif')
+          .sort()
+          .map((entry) => join(path, entry)),
+      );
+    } else {
+      files.push(path);
+    }
+  }
+  return files;
+}
+
+/**
+ * Measure every setting in the grid on every GIF under paths
+ * ffmpeg is needed to decode the encoded videos; codecs it cannot encode
+ * are left out.
+ */
+export async function runEncoderSweep(
+  paths: string[],
+  options: SweepOptions = {},
+): Promise<SweepResult> {
+  const grid: SweepGrid = {
+    codecs: options.codecs ?? DEFAULT_SWEEP_GRID.codecs,
+    crfs: options.crfs ?? DEFAULT_SWEEP_GRID.crfs,
+    presets: options.presets ?? DEFAULT_SWEEP_GRID.presets,
+    scales: options.scales ?? DEFAULT_SWEEP_GRID.scales,
+  };
+  if (!(await checkFFmpeg()).available) {
+    throw new Error('The encoder sweep needs ffmpeg to decode its output');
+  }
+
+  const codecs = new Set<VideoCodec>();
+  for (const codec of grid.codecs) {
+    if ((await resolveVideoCodec(codec)).codec === codec) {
+      codecs.add(codec);
+    }
+  }
+  const wasmEncoder = (await loadWasmEncoder()) !== null;
+  const trials = expandSweepGrid(grid, { codecs, wasmEncoder });
+  if (trials.length === 0) {
+    throw new Error('No installed encoder can run any setting in the sweep');
+  }
+
+  const files: string[] = [];
+  const failed: SweepResult['failed'] = [];
+  const perFile: EncoderTrialResult[][] = [];
+  for (const file of await findCorpusGifs(paths)) {
+    try {
+      const results = await measureEncoderSettings(
+        await readFile(file),
+        trials,
+        { fps: options.fps, signal: options.signal },
+      );
+      files.push(file);
+      perFile.push(results);
+      options.onFile?.(file, results);
+    } catch (error) {
+      if (options.signal?.aborted) {
+        throw error;
+      }
+      failed.push({ error: (error as Error).message, file });
+      options.onError?.(file, error as Error);
+    }
+  }
+
+  return { failed, files, summary: summarizeSweep(perFile) };
+}
@@ -0,0 +1,352 @@
+/**
+ * Access to the WASM converter module
+ * Instances are kept warm in a pool, and frames of any supported pixel
+ * format are copied into the heap as they are - conversion to the layout the
+ * encoder stores happens in C. Works in both Node.js and browser environments.
+ */
+
+export interface WasmModule {
+  _free: (ptr: number) => void;
+  _malloc: (size: number) => number;
+  cwrap: (
+    name: string,
+    returnType: string | null,
+    argTypes: string[],
+  ) => (...args: unknown[]) => unknown;
+  getValue: (ptr: number, type: string) => number;
+  HEAPU8: Uint8Array;
+}
+
+// Pixel layouts the converter ingests directly
+export type PixelFormat = 'bgra' | 'indexed' | 'rgb24' | 'rgba';
+
+// PIXEL_FORMAT_* in converter/yuv.h
+const PIXEL_FORMATS: Record<PixelFormat, { id: number; size: number }> = {
+  bgra: { id: 1, size: 4 },
+  indexed: { id: 3, size: 1 },
+  rgb24: { id: 2, size: 3 },
+  rgba: { id: 0, size: 4 },
+};
+
+export interface PixelFrame {
+  data: Uint8Array;
+  format?: PixelFormat; // Layout of data (default: 'rgba')
+  height: number;
+  palette?: Uint8Array; // RGB triples, required for 'indexed'
+  stride?: number; // Bytes from one row to the next (default: packed rows)
+  width: number;
+}
+
+// A frame copied into the WASM heap, as the converter's ingest functions
+// take it
+export interface HeapFrame {
+  format: number;
+  palette: number;
+  paletteSize: number;
+  pixels: number;
+  stride: number;
+}
+
+/**
+ * Get WASM module path for current environment
+ */
+async function getWasmModulePath(): Promise<string> {
+  if (typeof window === 'undefined') {
+    // Node.js environment - use node-specific build
+    const { join } = await import('node:path');
+    return join(import.meta.dirname, '../converter/wasm/gif2vid-node.js');
+  } else {
+    // Browser environment - use web-specific build
+    const scriptUrl = new URL(import.meta.url);
+    return new URL('../../converter/wasm/gif2vid-web.js', scriptUrl).href;
+  }
+}
+
+export interface WasmHeapPolicy {
+  // Idle instances unused for this long are dropped, so the pool shrinks
+  // back after a burst of concurrent jobs
+  idleMs: number;
+  // Total heap the idle instances may hold; past it the longest idle are
+  // dropped first
+  maxIdleBytes: number;
+  // Instances whose heap grew past this are discarded on release instead of
+  // pooled, since WASM memory never shrinks
+  recycleBytes: number;
+}
+
+export interface WasmHeapStats {
+  highWaterBytes: number; // Largest heap any instance has reached
+  idleHeapBytes: number; // Heap held by pooled instances
+  idleInstances: number;
+  recycledInstances: number; // Instances discarded for their heap size
+}
+
+// Emscripten's default, and the smallest heap an instance is created with
+const MIN_INITIAL_HEAP = 16 * 1024 * 1024;
+const WASM_PAGE = 64 * 1024;
+
+const heapPolicy: WasmHeapPolicy = {
+  idleMs: 60_000,
+  maxIdleBytes: 512 * 1024 * 1024,
+  recycleBytes: 256 * 1024 * 1024,
+};
+// Longest idle first
+const idleWasmModules: Array<{ Module: WasmModule; since: number }> = [];
+let highWaterBytes = 0;
+let recycledInstances = 0;
+let pruneTimer: ReturnType<typeof setTimeout> | null = null;
+
+/**
+ * Current heap size of an instance
+ */
+function heapBytes(Module: WasmModule): number {
+  return Module.HEAPU8.buffer.byteLength;
+}
+
+/**
+ * Drop instances that have been idle longer than the policy allows, then the
+ * longest idle while the pool holds more heap than it allows
+ */
+function pruneIdleModules(): void {
+  const cutoff = Date.now() - heapPolicy.idleMs;
+  for (let i = idleWasmModules.length - 1; i >= 0; i--) {
+    if (idleWasmModules[i].since < cutoff) {
+      idleWasmModules.splice(i, 1);
+    }
+  }
+
+  let idleBytes = 0;
+  for (const { Module } of idleWasmModules) {
+    idleBytes += heapBytes(Module);
+  }
+  while (idleBytes > heapPolicy.maxIdleBytes) {
+    const dropped = idleWasmModules.shift();
+    if (!dropped) {
+      break;
+    }
+    idleBytes -= heapBytes(dropped.Module);
+  }
+  schedulePrune();
+}
+
+/**
+ * Prune again when the longest idle instance expires, so a process that
+ * goes quiet still gives its heaps back. The timer does not keep Node.js
+ * running.
+ */
+function schedulePrune(): void {
+  if (pruneTimer) {
+    clearTimeout(pruneTimer);
+    pruneTimer = null;
+  }
+  if (idleWasmModules.length === 0) {
+    return;
+  }
+  const expiresAt = idleWasmModules[0].since + heapPolicy.idleMs;
+  pruneTimer = setTimeout(
+    () => {
+      pruneTimer = null;
+      pruneIdleModules();
+    },
+    Math.max(0, expiresAt - Date.now()) + 1,
+  );
+  (pruneTimer as { unref?: () => void }).unref?.();
+}
+
+/**
+ * Take a warm WASM module instance, creating one if none are idle.
+ * The converter keeps its encoder state in C globals, so each instance
+ * serves one conversion at a time and is handed back with releaseWasmModule.
+ * Given the heap a job is expected to need, the smallest idle instance that
+ * already has it is used; failing that, a new instance starts with that
+ * much memory rather than growing into it, since every growth copies the
+ * whole heap.
+ */
+export async function acquireWasmModule(
+  expectedHeapBytes: number = 0,
+): Promise<WasmModule> {
+  pruneIdleModules();
+  let best = -1;
+  for (let i = 0; i < idleWasmModules.length; i++) {
+    const size = heapBytes(idleWasmModules[i].Module);
+    if (
+      size >= expectedHeapBytes &&
+      (best < 0 || size < heapBytes(idleWasmModules[best].Module))
+    ) {
+      best = i;
+    }
+  }
+  // No instance is big enough; small jobs can still grow any idle one
+  if (best < 0 && expectedHeapBytes <= MIN_INITIAL_HEAP) {
+    best = idleWasmModules.length - 1;
+  }
+  if (best >= 0) {
+    return idleWasmModules.splice(best, 1)[0].Module;
+  }
+
+  const wasmPath = await getWasmModulePath();
+  const createModule = await import(wasmPath).then((m) => m.default);
+  const initialBytes =
+    Math.ceil(Math.max(MIN_INITIAL_HEAP, expectedHeapBytes) / WASM_PAGE) *
+    WASM_PAGE;
+  return (await createModule({ INITIAL_MEMORY: initialBytes })) as WasmModule;
+}
+
+/**
+ * Return a WASM module instance to the warm pool, or drop it if its heap
+ * has grown past the recycle threshold
+ */
+export function releaseWasmModule(Module: WasmModule): void {
+  const size = heapBytes(Module);
+  highWaterBytes = Math.max(highWaterBytes, size);
+  pruneIdleModules();
+  if (size > heapPolicy.recycleBytes) {
+    recycledInstances++;
+    return;
+  }
+  idleWasmModules.push({ Module, since: Date.now() });
+  pruneIdleModules();
+}
+
+/**
+ * Change when idle and oversized instances are dropped
+ */
+export function setWasmHeapPolicy(policy: Partial<WasmHeapPolicy>): void {
+  Object.assign(heapPolicy, policy);
+  pruneIdleModules();
+}
+
+/**
+ * Heap usage of the module pool
+ */
+export function getWasmHeapStats(): WasmHeapStats {
+  pruneIdleModules();
+  return {
+    highWaterBytes,
+    idleHeapBytes: idleWasmModules.reduce(
+      (sum, { Module }) => sum + heapBytes(Module),
+      0,
+    ),
+    idleInstances: idleWasmModules.length,
+    recycledInstances,
+  };
+}
+
+/**
+ * Bytes per pixel of a pixel format
+ */
+export function pixelSize(format: PixelFormat = 'rgba'): number {
+  const layout = PIXEL_FORMATS[format];
+  if (!layout) {
+    throw new Error(`Unsupported pixel format: ${format}`);
+  }
+  return layout.size;
+}
+
+/**
+ * Size in bytes of a frame in I420, as produced by convert_to_i420
+ */
+export function i420Size(width: number, height: number): number {
+  return width * height + 2 * Math.ceil(width / 2) * Math.ceil(height / 2);
+}
+
+/**
+ * Copy the top-left width x height of an I420 frame into dst, dropping the
+ * odd last row and column that H.264 encoders without cropping cannot take.
+ * width and height are even and at most the frame's size.
+ */
+export function cropI420(
+  frame: Uint8Array,
+  frameWidth: number,
+  frameHeight: number,
+  width: number,
+  height: number,
+  dst: Uint8Array,
+): Uint8Array {
+  const chromaWidth = Math.ceil(frameWidth / 2);
+  const chromaHeight = Math.ceil(frameHeight / 2);
+  const planes = [
+    { dst: 0, height, src: 0, srcStride: frameWidth, width },
+    {
+      dst: width * height,
+      height: height / 2,
+      src: frameWidth * frameHeight,
+      srcStride: chromaWidth,
+      width: width / 2,
+    },
+    {
+      dst: (width * height * 5) / 4,
+      height: height / 2,
+      src: frameWidth * frameHeight + chromaWidth * chromaHeight,
+      srcStride: chromaWidth,
+      width: width / 2,
+    },
+  ];
+  for (const plane of planes) {
+    for (let row = 0; row < plane.height; row++) {
+      const src = plane.src + row * plane.srcStride;
+      dst.set(
+        frame.subarray(src, src + plane.width),
+        plane.dst + row * plane.width,
+      );
+    }
+  }
+  return dst;
+}
+
+/**
+ * Copy a frame into the WASM heap and run fn with the pointers, freeing the
+ * copy afterwards. Only the bytes the converter reads are copied: a
+ * sub-rectangle of a larger surface is passed as a view starting at its
+ * first pixel, with the surface's stride.
+ */
+export function withHeapFrame<T>(
+  Module: WasmModule,
+  frame: PixelFrame,
+  fn: (heapFrame: HeapFrame) => T,
+): T {
+  const format = frame.format ?? 'rgba';
+  const layout = PIXEL_FORMATS[format];
+  if (!layout) {
+    throw new Error(`Unsupported pixel format: ${format}`);
+  }
+
+  const rowBytes = frame.width * layout.size;
+  const stride = frame.stride ?? rowBytes;
+  if (!(Number.isInteger(stride) && stride >= rowBytes)) {
+    throw new Error(`Invalid stride ${stride} for a ${frame.width}px row`);
+  }
+  const length =
+    frame.height > 0 ? (frame.height - 1) * stride + rowBytes : 0;
+  if (frame.data.length < length) {
+    throw new Error(
+      `Frame data is ${frame.data.length} bytes, ${length} are needed`,
+    );
+  }
+  if (format === 'indexed' && !frame.palette) {
+    throw new Error('Indexed frames require a palette');
+  }
+
+  const pixels = Module._malloc(length);
+  const palette = frame.palette ? Module._malloc(frame.palette.length) : 0;
+  try {
+    Module.HEAPU8.set(frame.data.subarray(0, length), pixels);
+    if (frame.palette) {
+      Module.HEAPU8.set(frame.palette, palette);
+    }
+    return fn({
+      format: layout.id,
+      palette,
+      paletteSize: frame.palette
+        ? Math.min(256, Math.floor(frame.palette.length / 3))
+        : 0,
+      pixels,
+      stride,
+    });
+  } finally {
+    Module._free(pixels);
+    if (palette) {
+      Module._free(palette);
+    }
+  }
+}
@@ -6,6 +6,17 @@
  * video dimensions. We now use h264-mp4-encoder (WASM) instead.
  */
 
+import { throwIfAborted } from './abort.js';
+import { KeyframePlanner } from './keyframes.js';
+import {
+  acquireWasmModule,
+  i420Size,
+  type PixelFrame,
+  releaseWasmModule,
+  type WasmModule,
+  withHeapFrame,
+} from './wasm-module.js';
+
 export interface WebCodecsInfo {
   available: boolean;
   error?: string;
@@ -38,20 +49,100 @@ export function checkWebCodecs(): WebCodecsInfo {
 }
 
 /**
- * Encode raw RGBA frames to optimized MP4 using WebCodecs API + WASM muxer
+ * Returns a function that converts a frame of any pixel format into one
+ * I420 buffer in the WASM heap, cropped to width x height. Encoders are fed
+ * from that buffer, so no frame is reformatted in JS.
+ * change() scores the last converted frame against the one scored before
+ * it (0-1, see KeyframePlanner); it is only paid for when called.
+ */
+function createI420Converter(
+  Module: WasmModule,
+  width: number,
+  height: number,
+): {
+  change: () => number | null;
+  convert: (frame: PixelFrame) => Uint8Array;
+  free: () => void;
+} {
+  const convertToI420 = Module.cwrap('convert_to_i420', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as (
+    pixels: number,
+    format: number,
+    stride: number,
+    width: number,
+    height: number,
+    palette: number,
+    paletteSize: number,
+    dst: number,
+  ) => number;
+
+  const trackLumaChange = Module.cwrap('track_luma_change', 'number', [
+    'number',
+    'number',
+    'number',
+    'number',
+  ]) as (prev: number, cur: number, width: number, height: number) => number;
+
+  const size = i420Size(width, height);
+  const yuvPtr = Module._malloc(size);
+  let prevLumaPtr = 0; // Allocated on the first change() call
+
+  return {
+    change: () => {
+      if (!prevLumaPtr) {
+        prevLumaPtr = Module._malloc(width * height);
+        Module.HEAPU8.fill(0, prevLumaPtr, prevLumaPtr + width * height);
+      }
+      const change = trackLumaChange(prevLumaPtr, yuvPtr, width, height);
+      return change < 0 ? null : change / 1000;
+    },
+    convert: (frame) => {
+      const converted = withHeapFrame(Module, frame, (heapFrame) =>
+        convertToI420(
+          heapFrame.pixels,
+          heapFrame.format,
+          heapFrame.stride,
+          width,
+          height,
+          heapFrame.palette,
+          heapFrame.paletteSize,
+          yuvPtr,
+        ),
+      );
+      if (!converted) {
+        throw new Error('Failed to convert frame to I420');
+      }
+      // Viewed after the copy above, which may have grown the heap
+      return Module.HEAPU8.subarray(yuvPtr, yuvPtr + size);
+    },
+    free: () => {
+      Module._free(yuvPtr);
+      if (prevLumaPtr) {
+        Module._free(prevLumaPtr);
+      }
+    },
+  };
+}
+
+/**
+ * Encode raw frames to optimized MP4 using WebCodecs API + WASM muxer
  */
 export async function encodeFramesWithWebCodecs(
-  frames: Array<{
-    data: Uint8Array;
-    width: number;
-    height: number;
-    delay: number;
-  }>,
+  frames: Array<PixelFrame & { delay: number }>,
   options: {
     bitrate?: number; // Target bitrate in bits per second (default: 2000000)
+    signal?: AbortSignal; // Checked between frames
   } = {},
 ): Promise<Uint8Array> {
-  const { bitrate = 2000000 } = options;
+  const { bitrate = 2000000, signal } = options;
 
   // Check if WebCodecs is available
   const webCodecsInfo = checkWebCodecs();
@@ -73,10 +164,9 @@ export async function encodeFramesWithWebCodecs(
   const evenWidth = Math.floor(width / 2) * 2;
   const evenHeight = Math.floor(height / 2) * 2;
 
-  // Load WASM module for MP4 muxing
-  const scriptUrl = new URL(import.meta.url);
-  const wasmUrl = new URL('../converter/wasm/gif2vid-web.js', scriptUrl).href;
-  const wasmModule = await (await import(wasmUrl).then((m) => m.default))();
+  // WASM module for frame conversion and MP4 muxing
+  const wasmModule = await acquireWasmModule();
+  const i420 = createI420Converter(wasmModule, evenWidth, evenHeight);
 
   // Initialize muxer with even dimensions
   const initMuxer = wasmModule.cwrap('init_webcodecs_muxer', 'number', [
@@ -99,6 +189,8 @@ export async function encodeFramesWithWebCodecs(
   const cleanupMuxer = wasmModule.cwrap('cleanup_webcodecs_muxer', null, []);
 
   if (!initMuxer(evenWidth, evenHeight)) {
+    i420.free();
+    releaseWasmModule(wasmModule);
     throw new Error('Failed to initialize WebCodecs muxer');
   }
 
@@ -192,58 +284,35 @@ export async function encodeFramesWithWebCodecs(
         hardwareAcceleration: 'prefer-software', // Use software encoder to avoid HW bugs
       });
 
+      // Keyframes go where the content changes, not every N frames
+      const keyframes = new KeyframePlanner();
+
       // Encode all frames
-      const encodeAllFrames = async () => {
+      const encodeAllFrames = () => {
         try {
           for (let i = 0; i < frames.length; i++) {
-            const frame = frames[i];
+            throwIfAborted(signal);
             const timestamp = i * 33333; // ~30fps in microseconds
 
-            // Crop frame data to even dimensions if needed
-            let frameData = frame.data;
-
-            if (frame.width !== evenWidth || frame.height !== evenHeight) {
-              const croppedData = new Uint8Array(evenWidth * evenHeight * 4);
-              for (let y = 0; y < evenHeight; y++) {
-                const srcOffset = y * frame.width * 4;
-                const dstOffset = y * evenWidth * 4;
-                croppedData.set(
-                  frameData.subarray(srcOffset, srcOffset + evenWidth * 4),
-                  dstOffset,
-                );
-              }
-              frameData = croppedData;
-            }
-
-            // Create VideoFrame from ImageBitmap for better compatibility
-            const imageData = new ImageData(
-              new Uint8ClampedArray(frameData),
-              evenWidth,
-              evenHeight,
-            );
-
-            // Create ImageBitmap from ImageData
-            const bitmap = await createImageBitmap(imageData, {
-              resizeWidth: evenWidth,
-              resizeHeight: evenHeight,
-              resizeQuality: 'pixelated',
-            });
-
-            // Create VideoFrame from ImageBitmap with explicit dimensions
-            const videoFrame = new VideoFrame(bitmap, {
-              timestamp,
+            // Converted and cropped to even dimensions in WASM; VideoFrame
+            // copies the planes, so the buffer is reused for the next frame
+            const videoFrame = new VideoFrame(i420.convert(frames[i]), {
+              codedHeight: evenHeight,
+              codedWidth: evenWidth,
               duration: 33333, // ~30fps
+              format: 'I420',
+              timestamp,
             });
 
-            // Close bitmap immediately after creating VideoFrame
-            bitmap.close();
-
             // Encode the frame
-            const keyFrame = i === 0 || i % 30 === 0; // Keyframe every 30 frames
+            const keyFrame = keyframes.next(i420.change());
             encoder.encode(videoFrame, { keyFrame });
             videoFrame.close();
           }
         } catch (error) {
+          if (encoder.state !== 'closed') {
+            encoder.close();
+          }
           cleanupMuxer();
           reject(error);
         }
@@ -255,65 +324,137 @@ export async function encodeFramesWithWebCodecs(
   } catch (error) {
     cleanupMuxer();
     throw error;
+  } finally {
+    i420.free();
+    releaseWasmModule(wasmModule);
   }
 }
 
+// The parts of h264-mp4-encoder used here
+interface H264MP4Encoder {
+  addFrameYuv: (data: Uint8Array) => void;
+  debug: boolean;
+  delete: () => void;
+  finalize: () => void;
+  frameRate: number;
+  FS: { readFile: (path: string) => Uint8Array };
+  groupOfPictures: number;
+  height: number;
+  initialize: () => void;
+  kbps: number;
+  outputFilename: string;
+  quantizationParameter: number;
+  speed: number;
+  width: number;
+}
+
+interface H264MP4EncoderModule {
+  createH264MP4Encoder: () => Promise<H264MP4Encoder>;
+}
+
+export interface WasmEncoderOptions {
+  bitrate?: number; // Target bitrate in kbps (default: 2000)
+  quantizationParameter?: number; // Quality [10..51], lower = better (default: 23)
+  signal?: AbortSignal; // Checked between frames
+  speed?: number; // Encoder speed [0..10], higher = faster (default: 5)
+}
+
+let nodeWasmEncoder: Promise<H264MP4EncoderModule | null> | null = null;
+
 /**
- * Encode raw RGBA frames to MP4 using h264-mp4-encoder WASM library
- * This is a replacement for WebCodecs which has bugs in Chrome
+ * Load h264-mp4-encoder: in browsers the window.HME global its script tag
+ * sets, in Node.js the package itself (loaded once per process). Resolves
+ * to null when it is not available.
  */
-export async function encodeFramesWithWasmEncoder(
-  frames: Array<{
-    data: Uint8Array;
-    width: number;
-    height: number;
-    delay: number;
-  }>,
-  options: {
-    bitrate?: number; // Target bitrate in kbps (default: 2000)
-    quantizationParameter?: number; // Quality [10..51], lower = better (default: 23)
-  } = {},
-): Promise<Uint8Array> {
-  const { bitrate = 2000, quantizationParameter = 23 } = options;
-
-  if (frames.length === 0) {
-    throw new Error('No frames provided');
+export function loadWasmEncoder(): Promise<H264MP4EncoderModule | null> {
+  if (typeof window !== 'undefined') {
+    return Promise.resolve((window as any).HME ?? null);
   }
+  if (!nodeWasmEncoder) {
+    nodeWasmEncoder = import('h264-mp4-encoder').then(
+      (module) => {
+        // A CommonJS package, so its exports may arrive as the default
+        const loaded = module as unknown as H264MP4EncoderModule & {
+          default?: H264MP4EncoderModule;
+        };
+        return loaded.default ?? loaded;
+      },
+      () => null,
+    );
+  }
+  return nodeWasmEncoder;
+}
 
-  const firstFrame = frames[0];
-  let { width, height } = firstFrame;
-
+/**
+ * Frame rate h264-mp4-encoder is run at for frames with these delays, and
+ * how many times each frame is added to hold it for its delay
+ * (h264-mp4-encoder has no variable frame timing)
+ */
+export function wasmEncoderTiming(delays: number[]): {
+  frameRate: number;
+  repeats: number[];
+} {
   // Calculate average frame rate from GIF delays
   // Frame delay is already in milliseconds (converted by gif-decoder)
-  const totalDelay = frames.reduce((sum, frame) => sum + frame.delay, 0);
-  const avgDelayMs = totalDelay / frames.length; // Average delay in milliseconds
+  const totalDelay = delays.reduce((sum, delay) => sum + delay, 0);
+  const avgDelayMs = totalDelay / delays.length; // Average delay in milliseconds
   const frameRate = avgDelayMs > 0 ? Math.round(1000 / avgDelayMs) : 30;
 
-  // Ensure dimensions are even (required for H.264)
-  const evenWidth = Math.floor(width / 2) * 2;
-  const evenHeight = Math.floor(height / 2) * 2;
+  // delay is already in milliseconds, frameRate is fps
+  const msPerFrame = 1000 / frameRate;
+  return {
+    frameRate,
+    repeats: delays.map((delay) =>
+      Math.max(1, Math.round(delay / msPerFrame)),
+    ),
+  };
+}
 
-  // Access h264-mp4-encoder from global window.HME (loaded as script tag)
-  // The library is loaded as a script tag in test-browser.html
-  if (typeof window === 'undefined' || !(window as any).HME) {
+/**
+ * Encode I420 frames with h264-mp4-encoder
+ * width and height must be even, and frameAt(i) must return frame i in
+ * I420 at that size. The view is only read during the call.
+ */
+export async function encodeI420WithWasmEncoder(
+  delays: number[],
+  width: number,
+  height: number,
+  frameAt: (index: number) => Uint8Array,
+  options: WasmEncoderOptions = {},
+): Promise<Uint8Array> {
+  const {
+    bitrate = 2000,
+    quantizationParameter = 23,
+    signal,
+    speed = 5,
+  } = options;
+
+  if (delays.length === 0) {
+    throw new Error('No frames provided');
+  }
+
+  const { frameRate, repeats } = wasmEncoderTiming(delays);
+
+  const HME = await loadWasmEncoder();
+  if (!HME) {
     throw new Error(
-      'h264-mp4-encoder not loaded. ' +
-        'Make sure to include the script tag: ' +
-        '<script src="path/to/h264-mp4-encoder.web.js"></script>',
+      typeof window === 'undefined'
+        ? 'h264-mp4-encoder could not be loaded'
+        : 'h264-mp4-encoder not loaded. ' +
+            'Make sure to include the script tag: ' +
+            '<script src="path/to/h264-mp4-encoder.web.js"></script>',
     );
   }
-
-  const HME = (window as any).HME;
   const encoder = await HME.createH264MP4Encoder();
 
   try {
     // Configure encoder
-    encoder.width = evenWidth;
-    encoder.height = evenHeight;
+    encoder.width = width;
+    encoder.height = height;
     encoder.frameRate = frameRate; // Use calculated frame rate from GIF delays
     encoder.kbps = bitrate;
     encoder.quantizationParameter = quantizationParameter;
-    encoder.speed = 5; // Balance between quality and speed
+    encoder.speed = speed; // Balance between quality and speed
     encoder.groupOfPictures = Math.max(1, Math.floor(frameRate)); // Keyframe based on frame rate
     encoder.outputFilename = 'output.mp4';
     encoder.debug = false;
@@ -323,33 +464,13 @@ export async function encodeFramesWithWasmEncoder(
     // Encode frames with proper timing
     // h264-mp4-encoder doesn't support variable frame timing, so we need to
     // duplicate frames to match the GIF delays
-    for (let i = 0; i < frames.length; i++) {
-      const frame = frames[i];
-      let frameData = frame.data;
-
-      // Crop frame data to even dimensions if needed
-      if (frame.width !== evenWidth || frame.height !== evenHeight) {
-        const croppedData = new Uint8Array(evenWidth * evenHeight * 4);
-        for (let y = 0; y < evenHeight; y++) {
-          const srcOffset = y * frame.width * 4;
-          const dstOffset = y * evenWidth * 4;
-          croppedData.set(
-            frameData.subarray(srcOffset, srcOffset + evenWidth * 4),
-            dstOffset,
-          );
-        }
-        frameData = croppedData;
-      }
-
-      // Calculate how many times to repeat this frame based on its delay
-      // delay is already in milliseconds, frameRate is fps
-      const frameDelayMs = frame.delay;
-      const msPerFrame = 1000 / frameRate;
-      const repeatCount = Math.max(1, Math.round(frameDelayMs / msPerFrame));
+    for (let i = 0; i < delays.length; i++) {
+      throwIfAborted(signal);
+      const frameData = frameAt(i);
 
       // Add frame multiple times to achieve the correct timing
-      for (let repeat = 0; repeat < repeatCount; repeat++) {
-        encoder.addFrameRgba(frameData);
+      for (let repeat = 0; repeat < repeats[i]; repeat++) {
+        encoder.addFrameYuv(frameData);
       }
     }
 
@@ -357,28 +478,65 @@ export async function encodeFramesWithWasmEncoder(
     encoder.finalize();
 
     // Read the output MP4 file
-    const uint8Array = encoder.FS.readFile(encoder.outputFilename);
-
-    return uint8Array;
+    return encoder.FS.readFile(encoder.outputFilename);
   } finally {
     // Clean up encoder resources
     encoder.delete();
   }
 }
 
+/**
+ * Encode raw frames to MP4 using h264-mp4-encoder WASM library
+ * This is a replacement for WebCodecs which has bugs in Chrome
+ */
+export async function encodeFramesWithWasmEncoder(
+  frames: Array<PixelFrame & { delay: number }>,
+  options: WasmEncoderOptions = {},
+): Promise<Uint8Array> {
+  if (frames.length === 0) {
+    throw new Error('No frames provided');
+  }
+
+  // Ensure dimensions are even (required for H.264)
+  const evenWidth = Math.floor(frames[0].width / 2) * 2;
+  const evenHeight = Math.floor(frames[0].height / 2) * 2;
+
+  const wasmModule = await acquireWasmModule();
+  const i420 = createI420Converter(wasmModule, evenWidth, evenHeight);
+  try {
+    // Converted and cropped to even dimensions in WASM. The encoder takes
+    // I420 as is, skipping its own RGBA conversion.
+    return await encodeI420WithWasmEncoder(
+      frames.map((frame) => frame.delay),
+      evenWidth,
+      evenHeight,
+      (index) => i420.convert(frames[index]),
+      options,
+    );
+  } finally {
+    i420.free();
+    releaseWasmModule(wasmModule);
+  }
+}
+
 /**
  * Check if optimization is available in current environment
  */
-export function isOptimizationAvailable(): {
+export async function isOptimizationAvailable(): Promise<{
   ffmpeg: boolean;
   webcodecs: boolean;
   wasmEncoder: boolean;
   method: 'ffmpeg' | 'wasm-encoder' | 'webcodecs' | 'none';
-} {
+}> {
   const inBrowser = typeof window !== 'undefined';
   const webcodecs = checkWebCodecs().available;
-  const wasmEncoder = inBrowser; // WASM encoder available in browser
-  const ffmpeg = !inBrowser; // ffmpeg only available in Node.js
+  // h264-mp4-encoder: window.HME in browsers, the package in Node.js
+  const wasmEncoder = (await loadWasmEncoder()) !== null;
+  let ffmpeg = false; // ffmpeg only available in Node.js
+  if (!inBrowser) {
+    const { getFFmpegCapabilities } = await import('./ffmpeg-registry.js');
+    ffmpeg = (await getFFmpegCapabilities()).available;
+  }
 
   let method: 'ffmpeg' | 'wasm-encoder' | 'webcodecs' | 'none' = 'none';
   if (ffmpeg) {